@@ -0,0 +1,148 @@
+#include "ChunkedDataPointCollection.h"
+
+#include <string.h>
+
+#include <fstream>
+#include <stdexcept>
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  const char* ChunkedDataPointCollection::binaryFileHeader_ = "MicrosoftResearch.Cambridge.Sherwood.ChunkedData";
+
+  void ChunkedDataPointCollection::Write(const DataPointCollection& data, const std::string& path)
+  {
+    std::ofstream o(path.c_str(), std::ios_base::binary);
+
+    const int majorVersion = 0, minorVersion = 0;
+    o.write(binaryFileHeader_, strlen(binaryFileHeader_));
+    o.write((const char*)(&majorVersion), sizeof(majorVersion));
+    o.write((const char*)(&minorVersion), sizeof(minorVersion));
+
+    int dimension = data.Dimensions();
+    unsigned int count = data.Count();
+    char hasLabels = data.HasLabels(), hasTargets = data.HasTargetValues();
+    int classCount = data.HasLabels() ? data.CountClasses() : 0;
+
+    o.write((const char*)(&dimension), sizeof(dimension));
+    o.write((const char*)(&count), sizeof(count));
+    o.write(&hasLabels, sizeof(hasLabels));
+    o.write(&hasTargets, sizeof(hasTargets));
+    o.write((const char*)(&classCount), sizeof(classCount));
+
+    // Fixed size records so that data points can be located by seeking
+    for (unsigned int i = 0; i < count; i++)
+    {
+      o.write((const char*)(data.GetDataPoint(i)), dimension * sizeof(float));
+      if (hasLabels)
+      {
+        int label = data.GetIntegerLabel(i);
+        o.write((const char*)(&label), sizeof(label));
+      }
+      if (hasTargets)
+      {
+        float target = data.GetTarget(i);
+        o.write((const char*)(&target), sizeof(target));
+      }
+    }
+
+    if (o.fail())
+      throw std::runtime_error("Failed to write chunked data file.");
+  }
+
+  ChunkedDataPointCollection::ChunkedDataPointCollection(const std::string& path, unsigned int chunkSize)
+    : path_(path), chunkSize_(chunkSize)
+  {
+    if (chunkSize == 0)
+      throw std::runtime_error("Chunk size must be greater than zero.");
+
+    std::ifstream i(path.c_str(), std::ios_base::binary);
+
+    std::vector<char> buffer(strlen(binaryFileHeader_)+1);
+    i.read(&buffer[0], strlen(binaryFileHeader_));
+    buffer[buffer.size()-1] = '\0';
+
+    if(strcmp(&buffer[0], binaryFileHeader_)!=0)
+      throw std::runtime_error("Unsupported chunked data format.");
+
+    int majorVersion = 0, minorVersion = 0;
+    i.read((char*)(&majorVersion), sizeof(majorVersion));
+    i.read((char*)(&minorVersion), sizeof(minorVersion));
+
+    if(majorVersion!=0 || minorVersion!=0)
+      throw std::runtime_error("Unsupported file version number.");
+
+    char hasLabels, hasTargets;
+    i.read((char*)(&dimension_), sizeof(dimension_));
+    i.read((char*)(&count_), sizeof(count_));
+    i.read(&hasLabels, sizeof(hasLabels));
+    i.read(&hasTargets, sizeof(hasTargets));
+    i.read((char*)(&classCount_), sizeof(classCount_));
+
+    if (i.fail() || dimension_ <= 0)
+      throw std::runtime_error("Invalid data");
+
+    hasLabels_ = hasLabels != 0;
+    hasTargets_ = hasTargets != 0;
+
+    dataOffset_ = i.tellg();
+  }
+
+  void ChunkedDataPointCollection::ReadDataPoint(std::istream& i, DataPointCollection& data) const
+  {
+    std::vector<float>::size_type n = data.data_.size();
+    data.data_.resize(n + dimension_);
+    i.read((char*)(&data.data_[n]), dimension_ * sizeof(float));
+
+    if (hasLabels_)
+    {
+      int label;
+      i.read((char*)(&label), sizeof(label));
+      data.labels_.push_back(label);
+    }
+
+    if (hasTargets_)
+    {
+      float target;
+      i.read((char*)(&target), sizeof(target));
+      data.targets_.push_back(target);
+    }
+  }
+
+  std::auto_ptr<IDataPointCollection> ChunkedDataPointCollection::LoadChunk(unsigned int chunkIndex) const
+  {
+    std::vector<unsigned int> indices;
+    for (unsigned int i = chunkIndex * chunkSize_; i < count_ && i < (chunkIndex + 1) * chunkSize_; i++)
+      indices.push_back(i);
+
+    return LoadSubset(indices);
+  }
+
+  std::auto_ptr<IDataPointCollection> ChunkedDataPointCollection::LoadSubset(const std::vector<unsigned int>& indices) const
+  {
+    // Each call uses its own stream, so chunks can be loaded concurrently
+    std::ifstream i(path_.c_str(), std::ios_base::binary);
+
+    std::auto_ptr<DataPointCollection> data = std::auto_ptr<DataPointCollection>(new DataPointCollection());
+    data->dimension_ = dimension_;
+    data->data_.reserve(indices.size() * dimension_);
+
+    std::streamoff recordSize = dimension_ * sizeof(float) + (hasLabels_ ? sizeof(int) : 0) + (hasTargets_ ? sizeof(float) : 0);
+
+    for (std::vector<unsigned int>::size_type j = 0; j < indices.size(); j++)
+    {
+      if (indices[j] >= count_)
+        throw std::runtime_error("Data point index out of range.");
+
+      // Only seek if the data points aren't consecutive
+      if (j == 0 || indices[j] != indices[j - 1] + 1)
+        i.seekg(dataOffset_ + indices[j] * recordSize);
+
+      ReadDataPoint(i, *data);
+    }
+
+    if (i.fail())
+      throw std::runtime_error("Failed to read chunked data file.");
+
+    return std::auto_ptr<IDataPointCollection>(data.release());
+  }
+} } }
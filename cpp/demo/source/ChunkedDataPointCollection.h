@@ -0,0 +1,77 @@
+#pragma once
+
+// This file declares the ChunkedDataPointCollection class, which provides
+// chunked access to data points stored in a binary file so that training
+// data need not be held in memory.
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "Sherwood.h"
+
+#include "DataPointCollection.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  class ChunkedDataPointCollection: public IChunkedDataPointCollection
+  {
+    static const char* binaryFileHeader_;
+
+    std::string path_;
+    unsigned int chunkSize_;
+
+    int dimension_;
+    unsigned int count_;
+    bool hasLabels_, hasTargets_;
+    int classCount_;
+
+    std::streamoff dataOffset_;
+
+  public:
+    /// <summary>
+    /// Write data points to a binary file for subsequent chunked access.
+    /// </summary>
+    /// <param name="data">The data points.</param>
+    /// <param name="path">The file path.</param>
+    static void Write(const DataPointCollection& data, const std::string& path);
+
+    /// <summary>
+    /// Open a file written by Write().
+    /// </summary>
+    /// <param name="path">The file path.</param>
+    /// <param name="chunkSize">The number of data points per chunk.</param>
+    ChunkedDataPointCollection(const std::string& path, unsigned int chunkSize);
+
+    unsigned int Count() const
+    {
+      return count_;
+    }
+
+    unsigned int ChunkSize() const
+    {
+      return chunkSize_;
+    }
+
+    int Dimensions() const
+    {
+      return dimension_;
+    }
+
+    /// <summary>
+    /// The number of classes in the data from which the file was written
+    /// (individual chunks and subsets may not contain all of them).
+    /// </summary>
+    int CountClasses() const
+    {
+      return classCount_;
+    }
+
+    std::auto_ptr<IDataPointCollection> LoadChunk(unsigned int chunkIndex) const;
+
+    std::auto_ptr<IDataPointCollection> LoadSubset(const std::vector<unsigned int>& indices) const;
+
+  private:
+    void ReadDataPoint(std::istream& i, DataPointCollection& data) const;
+  };
+} } }
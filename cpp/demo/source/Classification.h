@@ -3,16 +3,22 @@
 // This file defines types used to illustrate the use of the decision forest
 // library in simple multi-class classification task (2D data points).
 
+#include <cmath>
+
 #include <stdexcept>
 #include <algorithm>
+#include <string>
+#include <fstream>
 
 #include "Graphics.h"
 
 #include "Sherwood.h"
+#include "ParallelForestTrainer.h"
 
 #include "StatisticsAggregators.h"
 #include "FeatureResponseFunctions.h"
 #include "DataPointCollection.h"
+#include "ChunkedDataPointCollection.h"
 #include "Classification.h"
 #include "PlotCanvas.h"
 
@@ -82,6 +88,26 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     {
       return gain < 0.01;
     }
+
+    double ComputeRisk(const HistogramAggregator& leaf, const HistogramAggregator& data)
+    {
+      // The number of data points misclassified by the leaf's most common class
+      if (data.SampleCount() == 0)
+        return 0.0;
+      return data.SampleCount() - data.GetCount(leaf.FindTallestBinIndex());
+    }
+  };
+
+  /// <summary>
+  /// Converts leaf histograms to class posteriors (see LeafPosteriors).
+  /// </summary>
+  struct ClassPosterior
+  {
+    void operator()(const HistogramAggregator& h, float* p) const
+    {
+      for (int c = 0; c < h.BinCount(); c++)
+        p[c] = h.SampleCount() == 0 ? 1.0f / h.BinCount() : h.GetProbability(c);
+    }
   };
 
   template<class F>
@@ -93,7 +119,8 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     static std::auto_ptr<Forest<F, HistogramAggregator> > Train (
       const DataPointCollection& trainingData,
       IFeatureResponseFactory<F>* featureFactory,
-      const TrainingParameters& TrainingParameters ) // where F : IFeatureResponse
+      const TrainingParameters& TrainingParameters,
+      const std::string& initialForestPath="" ) // where F : IFeatureResponse
     {
       if (trainingData.Dimensions() != 2)
         throw std::runtime_error("Training data points must be 2D.");
@@ -108,15 +135,49 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       ClassificationTrainingContext<F> classificationContext(trainingData.CountClasses(), featureFactory);
 
-      std::auto_ptr<Forest<F, HistogramAggregator> > forest 
-        = ForestTrainer<F, HistogramAggregator>::TrainForest (
-        random, TrainingParameters, classificationContext, trainingData );
+      std::auto_ptr<Forest<F, HistogramAggregator> > forest;
+
+      if (initialForestPath != "")
+      {
+        // Warm start: add trees to a previously trained forest
+        forest = Forest<F, HistogramAggregator>::Deserialize(initialForestPath);
+        ForestTrainer<F, HistogramAggregator>::GrowForest (
+          random, TrainingParameters, classificationContext, trainingData, *forest );
+      }
+      else
+      {
+        forest = ForestTrainer<F, HistogramAggregator>::TrainForest (
+          random, TrainingParameters, classificationContext, trainingData );
+      }
 
       return forest;
     }
 
+    static std::auto_ptr<Forest<F, HistogramAggregator> > TrainParallel (
+      const DataPointCollection& trainingData,
+      IFeatureResponseFactory<F>* featureFactory,
+      const TrainingParameters& TrainingParameters,
+      int maxThreads ) // where F : IFeatureResponse
+    {
+      if (trainingData.Dimensions() != 2)
+        throw std::runtime_error("Training data points must be 2D.");
+      if (trainingData.HasLabels() == false)
+        throw std::runtime_error("Training data points must be labelled.");
+      if (trainingData.HasTargetValues() == true)
+        throw std::runtime_error("Training data points should not have target values.");
+
+      std::cout << "Running training using " << maxThreads << " threads..." << std::endl;
+
+      Random random;
+
+      ClassificationTrainingContext<F> classificationContext(trainingData.CountClasses(), featureFactory);
+
+      return ParallelForestTrainer<F, HistogramAggregator>::TrainForest (
+        random, TrainingParameters, maxThreads, classificationContext, trainingData );
+    }
+
     static std::auto_ptr<Bitmap<PixelBgr> > Visualize(
-      Forest<F, HistogramAggregator>& forest,
+      const Forest<F, HistogramAggregator>& forest,
       DataPointCollection& trainingData,
       Size PlotSize,
       PointF PlotDilation) // where F: IFeatureResponse
@@ -130,8 +191,236 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       std::cout << "\nApplying the forest to test data..." << std::endl;
 
+      std::vector<float> posteriors;
+      Test(forest, *testData, posteriors);
+
+      return Render(posteriors, trainingData, plotCanvas, PlotSize);
+    }
+
+    static std::auto_ptr<FernEnsemble<F, HistogramAggregator> > TrainFerns (
+      const DataPointCollection& trainingData,
+      IFeatureResponseFactory<F>* featureFactory,
+      const TrainingParameters& TrainingParameters ) // where F : IFeatureResponse
+    {
+      if (trainingData.Dimensions() != 2)
+        throw std::runtime_error("Training data points must be 2D.");
+      if (trainingData.HasLabels() == false)
+        throw std::runtime_error("Training data points must be labelled.");
+      if (trainingData.HasTargetValues() == true)
+        throw std::runtime_error("Training data points should not have target values.");
+
+      std::cout << "Running training..." << std::endl;
+
+      Random random;
+
+      ClassificationTrainingContext<F> classificationContext(trainingData.CountClasses(), featureFactory);
+
+      return FernEnsembleTrainer<F, HistogramAggregator>::TrainEnsemble (
+        random, TrainingParameters, classificationContext, trainingData );
+    }
+
+    static std::auto_ptr<Bitmap<PixelBgr> > VisualizeFerns(
+      const FernEnsemble<F, HistogramAggregator>& ferns,
+      DataPointCollection& trainingData,
+      Size PlotSize,
+      PointF PlotDilation) // where F: IFeatureResponse
+    {
+      PlotCanvas plotCanvas(trainingData.GetRange(0), trainingData.GetRange(1), PlotSize, PlotDilation);
+
+      std::auto_ptr<DataPointCollection> testData = std::auto_ptr<DataPointCollection>(
+        DataPointCollection::Generate2dGrid(plotCanvas.plotRangeX, PlotSize.Width, plotCanvas.plotRangeY, PlotSize.Height) );
+
+      std::cout << "\nApplying the ferns to test data..." << std::endl;
+
+      std::vector<std::vector<int> > leafIndices;
+      ferns.Apply(*testData, leafIndices);
+
+      // Aggregate statistics for each sample over all fern leaves reached
+      std::vector<HistogramAggregator> distributions(testData->Count());
+      for (unsigned int i = 0; i < testData->Count(); i++)
+      {
+        distributions[i] = HistogramAggregator(trainingData.CountClasses());
+        for (int f = 0; f < ferns.FernCount(); f++)
+          distributions[i].Aggregate(ferns.GetFern(f).GetLeafStatistics(leafIndices[f][i]));
+      }
+
+      return Render(GetPosteriors(distributions), trainingData, plotCanvas, PlotSize);
+    }
+
+    static std::auto_ptr<Jungle<F, HistogramAggregator> > TrainJungle (
+      const DataPointCollection& trainingData,
+      IFeatureResponseFactory<F>* featureFactory,
+      const TrainingParameters& TrainingParameters,
+      int maxWidth ) // where F : IFeatureResponse
+    {
+      if (trainingData.Dimensions() != 2)
+        throw std::runtime_error("Training data points must be 2D.");
+      if (trainingData.HasLabels() == false)
+        throw std::runtime_error("Training data points must be labelled.");
+      if (trainingData.HasTargetValues() == true)
+        throw std::runtime_error("Training data points should not have target values.");
+
+      std::cout << "Running training..." << std::endl;
+
+      Random random;
+
+      ClassificationTrainingContext<F> classificationContext(trainingData.CountClasses(), featureFactory);
+
+      return JungleTrainer<F, HistogramAggregator>::TrainJungle (
+        random, TrainingParameters, maxWidth, classificationContext, trainingData );
+    }
+
+    static std::auto_ptr<Forest<F, HistogramAggregator> > TrainOnline (
+      const DataPointCollection& trainingData,
+      IFeatureResponseFactory<F>* featureFactory,
+      const TrainingParameters& TrainingParameters,
+      int passes ) // where F : IFeatureResponse
+    {
+      if (trainingData.Dimensions() != 2)
+        throw std::runtime_error("Training data points must be 2D.");
+      if (trainingData.HasLabels() == false)
+        throw std::runtime_error("Training data points must be labelled.");
+      if (trainingData.HasTargetValues() == true)
+        throw std::runtime_error("Training data points should not have target values.");
+
+      std::cout << "Running online training..." << std::endl;
+
+      Random random;
+
+      ClassificationTrainingContext<F> classificationContext(trainingData.CountClasses(), featureFactory);
+
+      // Information gain is measured in bits
+      OnlineTrainingParameters onlineParameters;
+      onlineParameters.GainRange = log((double)(trainingData.CountClasses())) / log(2.0);
+
+      OnlineForestTrainer<F, HistogramAggregator> trainer(
+        random, TrainingParameters, onlineParameters, classificationContext );
+
+      // Simulate a stream by presenting the training data points one at a
+      // time, in a different random order on each pass
+      std::vector<unsigned int> order(trainingData.Count());
+      for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+
+      for (int p = 0; p < passes; p++)
+      {
+        std::cout << "\rPass " << p << "...";
+        for (int i = (int)(order.size()) - 1; i > 0; i--)
+          std::swap(order[i], order[random.Next(0, i + 1)]);
+        for (unsigned int i = 0; i < order.size(); i++)
+          trainer.Update(trainingData, order[i]);
+      }
+      std::cout << "\rCompleted " << passes << " passes.      " << std::endl;
+
+      return trainer.ReleaseForest();
+    }
+
+    static std::auto_ptr<Forest<F, HistogramAggregator> > TrainOutOfCore (
+      const ChunkedDataPointCollection& trainingData,
+      IFeatureResponseFactory<F>* featureFactory,
+      const TrainingParameters& TrainingParameters,
+      unsigned int inMemoryThreshold ) // where F : IFeatureResponse
+    {
+      if (trainingData.Dimensions() != 2)
+        throw std::runtime_error("Training data points must be 2D.");
+      if (trainingData.CountClasses() == 0)
+        throw std::runtime_error("Training data points must be labelled.");
+
+      std::cout << "Running out-of-core training..." << std::endl;
+
+      Random random;
+
+      ClassificationTrainingContext<F> classificationContext(trainingData.CountClasses(), featureFactory);
+
+      return OutOfCoreForestTrainer<F, HistogramAggregator>::TrainForest (
+        random, TrainingParameters, inMemoryThreshold, classificationContext, trainingData );
+    }
+
+    static std::auto_ptr<Forest<F, HistogramAggregator> > TrainDistributed (
+      int nClasses,
+      IFeatureResponseFactory<F>* featureFactory,
+      const TrainingParameters& TrainingParameters,
+      const std::vector<IMessageChannel*>& workers ) // where F : IFeatureResponse
+    {
+      std::cout << "Running distributed training..." << std::endl;
+
+      Random random;
+
+      ClassificationTrainingContext<F> classificationContext(nClasses, featureFactory);
+
+      return DistributedForestTrainer<F, HistogramAggregator>::TrainForest (
+        random, TrainingParameters, classificationContext, workers );
+    }
+
+    static void ServeDistributed (
+      const DataPointCollection& trainingData,
+      const std::vector<unsigned int>& shard,
+      IFeatureResponseFactory<F>* featureFactory,
+      IMessageChannel& coordinator ) // where F : IFeatureResponse
+    {
+      if (trainingData.Dimensions() != 2)
+        throw std::runtime_error("Training data points must be 2D.");
+      if (trainingData.HasLabels() == false)
+        throw std::runtime_error("Training data points must be labelled.");
+
+      std::cout << "Serving " << shard.size() << " data points..." << std::endl;
+
+      ClassificationTrainingContext<F> classificationContext(trainingData.CountClasses(), featureFactory);
+
+      DistributedTrainingWorker<F, HistogramAggregator> worker(classificationContext, trainingData, shard);
+      worker.Serve(coordinator);
+
+      std::cout << "Training complete." << std::endl;
+    }
+
+    static std::auto_ptr<Bitmap<PixelBgr> > VisualizeJungle(
+      const Jungle<F, HistogramAggregator>& jungle,
+      DataPointCollection& trainingData,
+      Size PlotSize,
+      PointF PlotDilation) // where F: IFeatureResponse
+    {
+      PlotCanvas plotCanvas(trainingData.GetRange(0), trainingData.GetRange(1), PlotSize, PlotDilation);
+
+      std::auto_ptr<DataPointCollection> testData = std::auto_ptr<DataPointCollection>(
+        DataPointCollection::Generate2dGrid(plotCanvas.plotRangeX, PlotSize.Width, plotCanvas.plotRangeY, PlotSize.Height) );
+
+      std::cout << "\nApplying the jungle to test data..." << std::endl;
+
       std::vector<std::vector<int> > leafNodeIndices;
-      forest.Apply(*testData, leafNodeIndices);
+      jungle.Apply(*testData, leafNodeIndices);
+
+      // Aggregate statistics for each sample over all leaf nodes reached
+      std::vector<HistogramAggregator> distributions(testData->Count());
+      for (unsigned int i = 0; i < testData->Count(); i++)
+      {
+        distributions[i] = HistogramAggregator(trainingData.CountClasses());
+        for (int d = 0; d < jungle.DagCount(); d++)
+          distributions[i].Aggregate(jungle.GetDag(d).GetNode(leafNodeIndices[d][i]).TrainingDataStatistics);
+      }
+
+      return Render(GetPosteriors(distributions), trainingData, plotCanvas, PlotSize);
+    }
+
+  private:
+    // Flatten per-pixel class distributions to posteriors (as for Render()).
+    static std::vector<float> GetPosteriors(const std::vector<HistogramAggregator>& distributions)
+    {
+      int nClasses = distributions.empty() ? 0 : distributions[0].BinCount();
+      std::vector<float> posteriors(distributions.size() * nClasses);
+      for (unsigned int i = 0; i < distributions.size(); i++)
+        ClassPosterior()(distributions[i], &posteriors[i * nClasses]);
+      return posteriors;
+    }
+
+    // Create a visualization image from per-pixel class posteriors
+    // (trainingData.CountClasses() per pixel).
+    static std::auto_ptr<Bitmap<PixelBgr> > Render(
+      const std::vector<float>& posteriors,
+      DataPointCollection& trainingData,
+      const PlotCanvas& plotCanvas,
+      Size PlotSize)
+    {
+      int nClasses = trainingData.CountClasses();
 
       // Same colours as those used in the book
       assert(trainingData.CountClasses()<=4);
@@ -153,22 +442,19 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       {
         for (int i = 0; i < PlotSize.Width; i++)
         {
-          // Aggregate statistics for this sample over all leaf nodes reached
-          HistogramAggregator h(trainingData.CountClasses());
-          for (int t = 0; t < forest.TreeCount(); t++)
-          {
-            int leafIndex = leafNodeIndices[t][index];
-            h.Aggregate(forest.GetTree((t)).GetNode(leafIndex).TrainingDataStatistics);
-          }
+          const float* posterior = &posteriors[index * nClasses];
 
           // Let's muddy the colors with grey where the entropy is high.
-          float mudiness = 0.5f*(float)(h.Entropy());
+          double entropy = 0.0;
+          for (int b = 0; b < nClasses; b++)
+            entropy -= posterior[b] == 0.0f ? 0.0 : posterior[b] * log(posterior[b])/log(2.0);
+          float mudiness = 0.5f*(float)(entropy);
 
           float R = 0.0f, G = 0.0f, B = 0.0f;
 
-          for (int b = 0; b < trainingData.CountClasses(); b++)
+          for (int b = 0; b < nClasses; b++)
           {
-            float p = (1.0f-mudiness)*h.GetProbability(b); // NB probabilities sum to 1.0 over the classes
+            float p = (1.0f-mudiness)*posterior[b]; // NB probabilities sum to 1.0 over the classes
 
             R += colors[b].R * p;
             G += colors[b].G * p;
@@ -203,34 +489,46 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       return result;
     }
 
+  public:
     /// <summary>
     /// Apply a trained forest to some test data.
     /// </summary>
     /// <typeparam name="F">Type of split function</typeparam>
     /// <param name="forest">Trained forest</param>
     /// <param name="testData">Test data</param>
-    /// <returns>An array of class distributions, one per test data point</returns>
-    static void Test(const Forest<F, HistogramAggregator>& forest, const DataPointCollection& testData, std::vector<HistogramAggregator>& distributions) // where F : IFeatureResponse
+    /// <param name="posteriors">Receives the class posterior (averaged over
+    /// trees) per test data point, one float per class.</param>
+    static void Test(const Forest<F, HistogramAggregator>& forest, const DataPointCollection& testData, std::vector<float>& posteriors) // where F : IFeatureResponse
     {
-      int nClasses = forest.GetTree(0).GetNode(0).TrainingDataStatistics.BinCount();
+      // NB Split node statistics may have been stripped (see Forest::StripSplitStatistics())
+      int nClasses = forest.GetPackedTree(0).GetLeafStatistics(0).BinCount();
 
-      std::vector<std::vector<int> > leafIndicesPerTree;
-      forest.Apply(testData, leafIndicesPerTree);
+      // Leaf histograms are converted to posteriors once, so that
+      // prediction only sums per-leaf vectors
+      LeafPosteriors<F, HistogramAggregator> leafPosteriors(forest, nClasses, ClassPosterior());
+      leafPosteriors.Predict(testData, posteriors);
+    }
 
-      std::vector<HistogramAggregator> result(testData.Count());
+    /// <summary>
+    /// Write a trained forest as C++ source code that computes its class
+    /// posteriors (see ForestCodeGenerator).
+    /// </summary>
+    /// <param name="forest">Trained forest</param>
+    /// <param name="path">Path of the source file to be written</param>
+    /// <param name="layout">How the generated code traverses each tree</param>
+    static void WriteCode(const Forest<F, HistogramAggregator>& forest, const std::string& path, CodeLayout::e layout) // where F : IFeatureResponse
+    {
+      int nClasses = forest.GetPackedTree(0).GetLeafStatistics(0).BinCount();
 
-      for (int i = 0; i < testData.Count(); i++)
-      {
-        // Aggregate statistics for this sample over all leaf nodes reached
-        result[i] = HistogramAggregator(nClasses);
-        for (int t = 0; t < forest.TreeCount(); t++)
-        {
-          int leafIndex = leafIndicesPerTree[t][i];
-          result[i].Aggregate(forest.GetTree(t).GetNode(leafIndex).TrainingDataStatistics);
-        }
-      }
+      LeafPosteriors<F, HistogramAggregator> leafPosteriors(forest, nClasses, ClassPosterior());
 
-      return result;
+      std::ofstream o(path.c_str());
+      if (!o.is_open())
+        throw std::runtime_error("Failed to open file for writing.");
+
+      ForestCodeGenerator<F, HistogramAggregator>::Generate(o, leafPosteriors, "forest", layout);
+
+      std::cout << "Wrote forest source code to " << path << std::endl;
     }
   };
 
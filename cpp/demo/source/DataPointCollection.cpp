@@ -152,6 +152,64 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     return result;
   }
 
+  std::auto_ptr<DataPointCollection> DataPointCollection::Subset(const std::vector<unsigned int>& indices) const
+  {
+    std::auto_ptr<DataPointCollection> result =  std::auto_ptr<DataPointCollection>(new DataPointCollection());
+
+    result->dimension_ = dimension_;
+    result->labelIndices_ = labelIndices_;
+
+    result->data_.reserve(indices.size() * dimension_);
+    for (std::vector<unsigned int>::size_type j = 0; j < indices.size(); j++)
+    {
+      if (indices[j] >= Count())
+        throw std::runtime_error("Data point index out of range.");
+
+      const float* datum = GetDataPoint(indices[j]);
+      result->data_.insert(result->data_.end(), datum, datum + dimension_);
+
+      if (HasLabels())
+        result->labels_.push_back(GetIntegerLabel(indices[j]));
+      if (HasTargetValues())
+        result->targets_.push_back(GetTarget(indices[j]));
+    }
+
+    return result;
+  }
+
+  std::auto_ptr<DataPointCollection> DataPointCollection::View(const std::vector<unsigned int>& indices) const
+  {
+    std::auto_ptr<DataPointCollection> result =  std::auto_ptr<DataPointCollection>(new DataPointCollection());
+
+    result->dimension_ = dimension_;
+    result->labelIndices_ = labelIndices_;
+
+    // A view of a view refers directly to the collection that stores the data points
+    result->base_ = base_ != 0 ? base_ : this;
+    result->indices_.reserve(indices.size());
+    for (std::vector<unsigned int>::size_type j = 0; j < indices.size(); j++)
+    {
+      if (indices[j] >= Count())
+        throw std::runtime_error("Data point index out of range.");
+
+      result->indices_.push_back(base_ != 0 ? indices_[indices[j]] : indices[j]);
+    }
+
+    return result;
+  }
+
+  std::auto_ptr<DataPointCollection> DataPointCollection::View(unsigned int start, unsigned int stride, unsigned int count) const
+  {
+    if (stride == 0)
+      throw std::runtime_error("Stride must be at least one.");
+
+    std::vector<unsigned int> indices(count);
+    for (unsigned int j = 0; j < count; j++)
+      indices[j] = start + j * stride;
+
+    return View(indices);
+  }
+
 
   /// <summary>
   /// Get the data range in the specified data dimension.
@@ -166,14 +224,14 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     if (dimension < 0 || dimension>dimension_)
       throw std::runtime_error("Insufficient data to compute range.");
 
-    float min = data_[0 + dimension], max = data_[0 + dimension];
+    float min = GetDataPoint(0)[dimension], max = GetDataPoint(0)[dimension];
 
-    for (int i = 0; i < (int)(data_.size())/dimension_; i++)
+    for (int i = 0; i < (int)(Count()); i++)
     {
-      if (data_[i*dimension_ +  dimension] < min)
-        min = data_[i*dimension_ +  dimension];
-      else if (data_[i*dimension_ +  dimension] > max)
-        max = data_[i*dimension_ +  dimension];
+      if (GetDataPoint(i)[dimension] < min)
+        min = GetDataPoint(i)[dimension];
+      else if (GetDataPoint(i)[dimension] > max)
+        max = GetDataPoint(i)[dimension];
     }
 
     return std::pair<float, float>(min, max);
@@ -191,14 +249,14 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     if (Count() < 0)
       throw std::runtime_error("Insufficient data to compute range.");
 
-    float min = targets_[0], max = targets_[0];
+    float min = GetTarget(0), max = GetTarget(0);
 
-    for (int i = 0; i < (int)(data_.size())/dimension_; i++)
+    for (int i = 0; i < (int)(Count()); i++)
     {
-      if (targets_[i] < min)
-        min = targets_[i];
-      else if (targets_[i] > max)
-        max = targets_[i];
+      if (GetTarget(i) < min)
+        min = GetTarget(i);
+      else if (GetTarget(i) > max)
+        max = GetTarget(i);
     }
 
     return std::pair<float, float>(min, max);
@@ -28,8 +28,16 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
   /// A collection of data points, each represented by a float[] and (optionally)
   /// associated with a string class label and/or a float target value.
   /// </summary>
+
+  // *** NB A collection can instead be a view (see View()) of data points
+  // stored by another collection. The per-data point accessors resolve a
+  // view's indices themselves, rather than being virtual, so that features
+  // and aggregators (which cast IDataPointCollection references to
+  // DataPointCollection) accept views at the cost of one predictable branch.
   class DataPointCollection: public IDataPointCollection
   {
+    friend class ChunkedDataPointCollection;
+
     std::vector<float> data_;
     int dimension_;
 
@@ -41,9 +49,17 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     // only for regression problems...
     std::vector<float> targets_;
 
+    // only for views...
+    const DataPointCollection* base_;     // the collection that stores the data points
+    std::vector<unsigned int> indices_;   // indices of the viewed data points in base_
+
   public:
     static const int UnknownClassLabel = -1;
 
+    DataPointCollection(): dimension_(0), base_(0)
+    {
+    }
+
     /// <summary>
     /// Load a collection of data from a tab-delimited file with one data point
     /// per line. The data may optionally have associated with class labels
@@ -78,12 +94,51 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// <returns>A new DataPointCollection</returns>
     static std::auto_ptr<DataPointCollection> Generate1dGrid(std::pair<float, float> range, int nSteps);
 
+    /// <summary>
+    /// Create a new collection containing copies of the specified data
+    /// points, e.g. to hold out a validation set. Class labels keep the same
+    /// integer indices as in this collection.
+    /// </summary>
+    /// <param name="indices">Indices of the data points to copy.</param>
+    /// <returns>A new DataPointCollection</returns>
+    std::auto_ptr<DataPointCollection> Subset(const std::vector<unsigned int>& indices) const;
+
+    /// <summary>
+    /// Create a view of the specified data points (in the specified order,
+    /// possibly with repetitions), e.g. a cross-validation fold or a
+    /// bootstrap sample. A view refers to, rather than copies, the data
+    /// points of this collection, which must outlive it. It can be used
+    /// wherever a DataPointCollection can, e.g. for training or by
+    /// Forest::Apply(), and copying it copies only its indices.
+    /// </summary>
+    /// <param name="indices">Indices of the data points to view.</param>
+    /// <returns>A new DataPointCollection</returns>
+    std::auto_ptr<DataPointCollection> View(const std::vector<unsigned int>& indices) const;
+
+    /// <summary>
+    /// Create a view of every stride-th data point, starting with the
+    /// start-th (see View()).
+    /// </summary>
+    /// <param name="start">Index of the first data point.</param>
+    /// <param name="stride">Step between data points.</param>
+    /// <param name="count">Number of data points.</param>
+    /// <returns>A new DataPointCollection</returns>
+    std::auto_ptr<DataPointCollection> View(unsigned int start, unsigned int stride, unsigned int count) const;
+
+    /// <summary>
+    /// Is this collection a view of data points stored by another (see View())?
+    /// </summary>
+    bool IsView() const
+    {
+      return base_ != 0;
+    }
+
     /// <summary>
     /// Do these data have class labels?
     /// </summary>
     bool HasLabels() const
     {
-      return labels_.size() != 0;
+      return base_ != 0 ? base_->HasLabels() : labels_.size() != 0;
     }
 
     /// <summary>
@@ -102,7 +157,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// </summary>
     bool HasTargetValues() const
     {
-      return targets_.size() != 0;
+      return base_ != 0 ? base_->HasTargetValues() : targets_.size() != 0;
     }
 
     /// <summary>
@@ -111,7 +166,31 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// <returns>The number of data points</returns>
     unsigned int Count() const
     {
-      return data_.size()/dimension_;
+      return base_ != 0 ? indices_.size() : data_.size()/dimension_;
+    }
+
+    /// <summary>
+    /// Create a copy of this collection (see IDataPointCollection::Clone()).
+    /// The copy of a view holds copies of the viewed data points.
+    /// </summary>
+    /// <returns>The copy.</returns>
+    std::auto_ptr<IDataPointCollection> Clone() const
+    {
+      if (base_ != 0)
+        return std::auto_ptr<IDataPointCollection>(base_->Subset(indices_).release());
+      return std::auto_ptr<IDataPointCollection>(new DataPointCollection(*this));
+    }
+
+    /// <summary>
+    /// The memory occupied by the data points, or by the indices of a view
+    /// (see IDataPointCollection::GetMemoryUsage()).
+    /// </summary>
+    /// <returns>The size in bytes.</returns>
+    virtual std::size_t GetMemoryUsage() const
+    {
+      if (base_ != 0)
+        return indices_.size() * sizeof(unsigned int);
+      return Count() * (dimension_ * sizeof(float) + (HasLabels() ? sizeof(int) : 0) + (HasTargetValues() ? sizeof(float) : 0));
     }
 
     /// <summary>
@@ -143,7 +222,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// <returns>Pointer to the first element of the data point.</returns>
     const float* GetDataPoint(int i) const
     {
-      return &data_[i*dimension_];
+      return base_ != 0 ? base_->GetDataPoint(indices_[i]) : &data_[i*dimension_];
     }
 
     /// <summary>
@@ -157,7 +236,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       if (!HasLabels())
         throw std::runtime_error("Data have no associated class labels.");
 
-      return labels_[i]; // may throw an exception if index is out of range
+      return base_ != 0 ? base_->labels_[indices_[i]] : labels_[i];
     }
 
     /// <summary>
@@ -171,7 +250,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       if (!HasTargetValues())
         throw std::runtime_error("Data have no associated target values.");
 
-      return targets_[i]; // may throw an exception if index is out of range
+      return base_ != 0 ? base_->targets_[indices_[i]] : targets_[i];
     }
   };
 
@@ -147,11 +147,11 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
         Bounds leftChildBounds = bounds;
         leftChildBounds.Upper[feature.Axis()] = nodeCopy.Threshold;
-        ComputeNormalizationFactorsRecurse(t, nodeIndex * 2 + 1, nTrainingPoints, leftChildBounds, normalizationFactors);
+        ComputeNormalizationFactorsRecurse(t, nodeCopy.LeftChildIndex, nTrainingPoints, leftChildBounds, normalizationFactors);
 
         Bounds rightChildBounds = bounds;
         rightChildBounds.Lower[feature.Axis()] = nodeCopy.Threshold;
-        ComputeNormalizationFactorsRecurse(t, nodeIndex * 2 + 2, nTrainingPoints, rightChildBounds, normalizationFactors);
+        ComputeNormalizationFactorsRecurse(t, nodeCopy.LeftChildIndex + 1, nTrainingPoints, rightChildBounds, normalizationFactors);
       }
     }
 
@@ -159,7 +159,8 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       const DataPointCollection& trainingData,
       const TrainingParameters& parameters,
       double a,
-      double b)
+      double b,
+      const std::string& initialForestPath="")
     {
       if (trainingData.Dimensions() != 2)
         throw std::runtime_error("Training data points for density estimation were not 2D.");
@@ -174,12 +175,27 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       DensityEstimationTrainingContext densityEstimationTrainingContext(a, b);
 
-      std::auto_ptr<Forest<AxisAlignedFeatureResponse, GaussianAggregator2d> > forest
-        = ForestTrainer<AxisAlignedFeatureResponse, GaussianAggregator2d>::TrainForest (
-        random,
-        parameters,
-        densityEstimationTrainingContext,
-        trainingData );
+      std::auto_ptr<Forest<AxisAlignedFeatureResponse, GaussianAggregator2d> > forest;
+
+      if (initialForestPath != "")
+      {
+        // Warm start: add trees to a previously trained forest
+        forest = Forest<AxisAlignedFeatureResponse, GaussianAggregator2d>::Deserialize(initialForestPath);
+        ForestTrainer<AxisAlignedFeatureResponse, GaussianAggregator2d>::GrowForest (
+          random,
+          parameters,
+          densityEstimationTrainingContext,
+          trainingData,
+          *forest );
+      }
+      else
+      {
+        forest = ForestTrainer<AxisAlignedFeatureResponse, GaussianAggregator2d>::TrainForest (
+          random,
+          parameters,
+          densityEstimationTrainingContext,
+          trainingData );
+      }
 
       return forest;
     }
@@ -109,11 +109,11 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
                 Bounds leftChildBounds = bounds.Clone();
                 leftChildBounds.Upper[feature.Axis()] = nodeCopy.Threshold;
-                ComputeNormalizationFactorsRecurse(t, nodeIndex * 2 + 1, leftChildBounds, normalizationFactors);
+                ComputeNormalizationFactorsRecurse(t, nodeCopy.LeftChildIndex, leftChildBounds, normalizationFactors);
 
                 Bounds rightChildBounds = bounds.Clone();
                 rightChildBounds.Lower[feature.Axis()] = nodeCopy.Threshold;
-                ComputeNormalizationFactorsRecurse(t, nodeIndex * 2 + 2, rightChildBounds, normalizationFactors);
+                ComputeNormalizationFactorsRecurse(t, nodeCopy.LeftChildIndex + 1, rightChildBounds, normalizationFactors);
             }
         }
 
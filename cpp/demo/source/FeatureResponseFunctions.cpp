@@ -53,4 +53,28 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     return s.str();
   }
 
+  double GetFeatureCost_(const LinearFeatureResponse2d& feature)
+  {
+    return (feature.dx_ != 0.0f ? 1.0 : 0.0) + (feature.dy_ != 0.0f ? 1.0 : 0.0);
+  }
+
+  void WriteFeatureCode_(std::ostream& o, const AxisAlignedFeatureResponse& feature)
+  {
+    o << "x[" << feature.Axis() << "]";
+  }
+
+  int GetFeatureAxis_(const AxisAlignedFeatureResponse& feature)
+  {
+    return feature.Axis();
+  }
+
+  void WriteFeatureCode_(std::ostream& o, const LinearFeatureResponse2d& feature)
+  {
+    // Enough digits for the coefficients to round trip exactly
+    std::stringstream s;
+    s.precision(9);
+    s << std::showpoint << "(" << feature.dx_ << "f * x[0] + " << feature.dy_ << "f * x[1])";
+    o << s.str();
+  }
+
 } } }
@@ -5,6 +5,7 @@
 // instances using simple structs so that all tree data can be stored
 // contiguously in a linear array.
 
+#include <iostream>
 #include <string>
 
 #include "Sherwood.h"
@@ -90,5 +91,29 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     float GetResponse(const IDataPointCollection& data, unsigned int index) const;
 
     std::string ToString()  const;
+
+    friend double GetFeatureCost_(const LinearFeatureResponse2d& feature);
+
+    friend void WriteFeatureCode_(std::ostream& o, const LinearFeatureResponse2d& feature);
   };	
+
+  /// <summary>
+  /// The relative cost of evaluating a LinearFeatureResponse2d, i.e. the
+  /// number of non-zero elements in its direction vector (see FeatureCost.h).
+  /// AxisAlignedFeatureResponse instances have the default cost of 1.0.
+  /// </summary>
+  double GetFeatureCost_(const LinearFeatureResponse2d& feature);
+
+  /// <summary>
+  /// Write the response of a feature as a C++ expression (see
+  /// ForestCodeGenerator.h).
+  /// </summary>
+  void WriteFeatureCode_(std::ostream& o, const AxisAlignedFeatureResponse& feature);
+
+  void WriteFeatureCode_(std::ostream& o, const LinearFeatureResponse2d& feature);
+
+  /// <summary>
+  /// The axis of an AxisAlignedFeatureResponse (see QuickScorer.h).
+  /// </summary>
+  int GetFeatureAxis_(const AxisAlignedFeatureResponse& feature);
 } } }
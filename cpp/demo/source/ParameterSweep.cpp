@@ -0,0 +1,297 @@
+#include "ParameterSweep.h"
+
+#include <cmath>
+
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <iomanip>
+
+#include "DensityEstimation.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  namespace
+  {
+    bool ScoreIsGreater(const SweepResult& a, const SweepResult& b)
+    {
+      return a.Score > b.Score;
+    }
+  }
+
+  std::vector<float> ParameterSweep::ParseList(const std::string& s)
+  {
+    std::vector<std::string> elements;
+    tokenize(s, elements, ",");
+
+    std::vector<float> values;
+    for (std::vector<std::string>::size_type i = 0; i < elements.size(); i++)
+      values.push_back(to_float(elements[i]));
+
+    if (values.size() == 0)
+      throw std::runtime_error("Empty list of parameter values.");
+
+    return values;
+  }
+
+  std::vector<SweepConfiguration> ParameterSweep::CreateConfigurations(
+    const TrainingParameters& base,
+    const std::vector<float>& T,
+    const std::vector<float>& D,
+    const std::vector<float>& F,
+    const std::vector<float>& L,
+    const std::vector<float>& a,
+    const std::vector<float>& b,
+    unsigned int count,
+    Random& random )
+  {
+    std::vector<SweepConfiguration> configurations;
+
+    for (unsigned int t = 0; t < T.size(); t++)
+      for (unsigned int d = 0; d < D.size(); d++)
+        for (unsigned int f = 0; f < F.size(); f++)
+          for (unsigned int l = 0; l < L.size(); l++)
+            for (unsigned int i = 0; i < a.size(); i++)
+              for (unsigned int j = 0; j < b.size(); j++)
+              {
+                if (T[t] < 1 || D[d] < 1 || F[f] < 1 || L[l] < 1)
+                  throw std::runtime_error("Parameter value out of range.");
+
+                SweepConfiguration c;
+                c.Parameters = base;
+                c.Parameters.NumberOfTrees = (int)(T[t]);
+                c.Parameters.MaxDecisionLevels = (int)(D[d]) - 1;
+                c.Parameters.NumberOfCandidateFeatures = (int)(F[f]);
+                c.Parameters.NumberOfCandidateThresholdsPerFeature = (unsigned int)(L[l]);
+                c.A = a[i];
+                c.B = b[j];
+                configurations.push_back(c);
+              }
+
+    if (count > 0 && count < configurations.size())
+    {
+      // Partial Fisher-Yates shuffle
+      for (unsigned int i = 0; i < count; i++)
+        std::swap(configurations[i], configurations[random.Next(i, configurations.size())]);
+      configurations.resize(count);
+    }
+
+    return configurations;
+  }
+
+  void ParameterSweep::CreateFolds(
+    const DataPointCollection& data,
+    int foldCount,
+    float validationFraction,
+    Random& random,
+    std::vector<DataPointCollection>& trainingData,
+    std::vector<DataPointCollection>& validationData )
+  {
+    if (foldCount == 1 && (validationFraction <= 0.0f || validationFraction >= 1.0f))
+      throw std::runtime_error("Validation fraction must lie strictly between zero and one.");
+    if (foldCount < 1 || (unsigned int)(foldCount) > data.Count())
+      throw std::runtime_error("Invalid number of cross-validation folds.");
+
+    std::vector<unsigned int> indices(data.Count());
+    for (unsigned int i = 0; i < data.Count(); i++)
+      indices[i] = i;
+    for (unsigned int i = data.Count(); i > 1; i--)
+      std::swap(indices[i - 1], indices[random.Next(0, i)]);
+
+    trainingData.clear();
+    validationData.clear();
+
+    for (int fold = 0; fold < foldCount; fold++)
+    {
+      // Fold f holds out the f-th contiguous block of shuffled indices
+      unsigned int i0, i1;
+      if (foldCount == 1)
+      {
+        i0 = 0;
+        i1 = (unsigned int)(validationFraction * data.Count() + 0.5f);
+      }
+      else
+      {
+        i0 = (unsigned int)((unsigned long long)(data.Count()) * fold / foldCount);
+        i1 = (unsigned int)((unsigned long long)(data.Count()) * (fold + 1) / foldCount);
+      }
+
+      if (i1 == i0 || i1 - i0 == data.Count())
+        throw std::runtime_error("Too few data points to hold out a validation set.");
+
+      std::vector<unsigned int> training(indices.begin(), indices.begin() + i0);
+      training.insert(training.end(), indices.begin() + i1, indices.end());
+
+      trainingData.push_back(*data.View(training));
+      validationData.push_back(*data.View(std::vector<unsigned int>(indices.begin() + i0, indices.begin() + i1)));
+    }
+  }
+
+  std::vector<SweepResult> ParameterSweep::SweepDensityEstimation(
+    const std::vector<DataPointCollection>& trainingData,
+    const std::vector<DataPointCollection>& validationData,
+    const std::vector<SweepConfiguration>& configurations,
+    int maxThreads,
+    Random& random )
+  {
+    if (trainingData[0].Dimensions() != 2)
+      throw std::runtime_error("Training data points for density estimation were not 2D.");
+
+    int nFolds = trainingData.size();
+    int nTasks = configurations.size() * nFolds;
+
+    std::vector<int> seeds = DrawSeeds(nTasks, random);
+    std::vector<double> seconds(nTasks), scores(nTasks);
+    std::vector<std::string> errors(nTasks);
+
+    int completed = 0;
+
+#pragma omp parallel for schedule(dynamic) num_threads(maxThreads)
+    for (int task = 0; task < nTasks; task++)
+    {
+      int c = task / nFolds, fold = task % nFolds;
+
+      // An exception must not escape the parallel region
+      try
+      {
+        double start = omp_get_wtime();
+
+        Random taskRandom(seeds[task]);
+        DensityEstimationTrainingContext context(configurations[c].A, configurations[c].B);
+        ProgressStream silent(std::cout, Silent);
+
+        std::auto_ptr<Forest<AxisAlignedFeatureResponse, GaussianAggregator2d> > forest =
+          ForestTrainer<AxisAlignedFeatureResponse, GaussianAggregator2d>::TrainForest(
+            taskRandom, GetTaskParameters(configurations[c]), context, trainingData[fold], &silent);
+
+        seconds[task] = omp_get_wtime() - start;
+
+        // Score by mean log density of the validation data (see
+        // DensityEstimationExample::Visualize())
+        std::vector<std::vector<double> > normalizationFactors(forest->TreeCount());
+        for (int t = 0; t < forest->TreeCount(); t++)
+        {
+          normalizationFactors[t].resize(forest->GetTree(t).NodeCount());
+          DensityEstimationExample::ComputeNormalizationFactorsRecurse(
+            forest->GetTree(t), 0, trainingData[fold].Count(), DensityEstimationExample::Bounds(2), normalizationFactors[t]);
+        }
+
+        const DataPointCollection& validation = validationData[fold];
+
+        std::vector<std::vector<int> > leafNodeIndices;
+        forest->Apply(validation, leafNodeIndices, &silent);
+
+        double logDensity = 0.0;
+        for (unsigned int i = 0; i < validation.Count(); i++)
+        {
+          const float* datum = validation.GetDataPoint(i);
+
+          double probability = 0.0;
+          for (int t = 0; t < forest->TreeCount(); t++)
+          {
+            int leafIndex = leafNodeIndices[t][i];
+            const GaussianPdf2d& pdf = forest->GetTree(t).GetNode(leafIndex).TrainingDataStatistics.GetPdf();
+            probability += normalizationFactors[t][leafIndex] * pdf.GetProbability(datum[0], datum[1]);
+          }
+          probability /= forest->TreeCount();
+
+          logDensity += log(std::max(probability, 1e-300));
+        }
+        scores[task] = logDensity / validation.Count();
+      }
+      catch (const std::exception& e)
+      {
+        errors[task] = e.what();
+      }
+
+      ReportProgress(completed, nTasks);
+    }
+    std::cout << std::endl;
+
+    return CollateResults(configurations, nFolds, seconds, scores, errors);
+  }
+
+  void ParameterSweep::PrintResults(std::ostream& o, std::vector<SweepResult> results, const std::string& scoreName, bool showPriors)
+  {
+    std::stable_sort(results.begin(), results.end(), ScoreIsGreater);
+
+    o << std::setw(6) << "T" << std::setw(6) << "D" << std::setw(6) << "F" << std::setw(6) << "L";
+    if (showPriors)
+      o << std::setw(10) << "a" << std::setw(10) << "b";
+    o << std::setw(12) << "seconds" << "  " << scoreName << std::endl;
+
+    for (std::vector<SweepResult>::size_type r = 0; r < results.size(); r++)
+    {
+      const SweepConfiguration& c = results[r].Configuration;
+      o << std::setw(6) << c.Parameters.NumberOfTrees
+        << std::setw(6) << c.Parameters.MaxDecisionLevels + 1
+        << std::setw(6) << c.Parameters.NumberOfCandidateFeatures
+        << std::setw(6) << c.Parameters.NumberOfCandidateThresholdsPerFeature;
+      if (showPriors)
+        o << std::setw(10) << c.A << std::setw(10) << c.B;
+      if (results[r].Error != "")
+      {
+        o << std::setw(12) << "-" << "  failed: " << results[r].Error << std::endl;
+        continue;
+      }
+      o << std::setw(12) << std::fixed << std::setprecision(3) << results[r].TrainingSeconds
+        << "  " << std::setprecision(4) << results[r].Score << std::endl;
+      o.unsetf(std::ios_base::floatfield);
+    }
+  }
+
+  std::vector<int> ParameterSweep::DrawSeeds(int count, Random& random)
+  {
+    // Drawn up front so that results don't depend on thread scheduling
+    std::vector<int> seeds(count);
+    for (int c = 0; c < count; c++)
+      seeds[c] = random.Next();
+    return seeds;
+  }
+
+  TrainingParameters ParameterSweep::GetTaskParameters(const SweepConfiguration& configuration)
+  {
+    // Concurrent tasks must not share a checkpoint file, and a memory
+    // budget is checked per training run (not for the many that run
+    // concurrently here), so neither applies within a sweep
+    TrainingParameters parameters = configuration.Parameters;
+    parameters.CheckpointPath = "";
+    parameters.MemoryBudget = 0;
+    return parameters;
+  }
+
+  void ParameterSweep::ReportProgress(int& completed, int total)
+  {
+#pragma omp critical(ParameterSweepProgress)
+    std::cout << "\rTrained " << ++completed << " of " << total << " forests..." << std::flush;
+  }
+
+  std::vector<SweepResult> ParameterSweep::CollateResults(
+    const std::vector<SweepConfiguration>& configurations,
+    int nFolds,
+    const std::vector<double>& seconds,
+    const std::vector<double>& scores,
+    const std::vector<std::string>& errors )
+  {
+    std::vector<SweepResult> results(configurations.size());
+    for (std::vector<SweepResult>::size_type c = 0; c < results.size(); c++)
+    {
+      results[c].Configuration = configurations[c];
+      results[c].TrainingSeconds = 0.0;
+      results[c].Score = 0.0;
+      for (int fold = 0; fold < nFolds; fold++)
+      {
+        results[c].TrainingSeconds += seconds[c * nFolds + fold] / nFolds;
+        results[c].Score += scores[c * nFolds + fold] / nFolds;
+        if (results[c].Error == "")
+          results[c].Error = errors[c * nFolds + fold];
+      }
+
+      // Failed configurations rank last
+      if (results[c].Error != "")
+        results[c].Score = -std::numeric_limits<double>::infinity();
+    }
+    return results;
+  }
+} } }
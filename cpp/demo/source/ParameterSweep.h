@@ -0,0 +1,223 @@
+#pragma once
+
+// This file defines the ParameterSweep class, which searches over training
+// parameters by concurrently training many forests on a single in-memory
+// copy of the training data, and scoring each on held-out validation data
+// (a single split or k-fold cross-validation).
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+
+#include <omp.h>
+
+#include "Sherwood.h"
+
+#include "DataPointCollection.h"
+#include "StatisticsAggregators.h"
+#include "Classification.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// One point in the space of parameters searched by ParameterSweep.
+  /// </summary>
+  struct SweepConfiguration
+  {
+    TrainingParameters Parameters;
+    float A, B;   // priors, for density estimation only
+  };
+
+  /// <summary>
+  /// The outcome of training and validating one SweepConfiguration.
+  /// </summary>
+  struct SweepResult
+  {
+    SweepConfiguration Configuration;
+    double TrainingSeconds;   // mean over folds
+    double Score;             // mean over folds, higher is better
+    std::string Error;        // empty unless training or scoring failed (in any fold)
+  };
+
+  /// <summary>
+  /// Grid or random search over training parameters. Configurations (and
+  /// cross-validation folds) are trained concurrently, each on a single
+  /// thread, so that sweeps over small forests make good use of a multi-core
+  /// machine. Folds are views of the data (see DataPointCollection::View()),
+  /// so all share a single copy of it. A configuration that fails (e.g.
+  /// because training throws) is reported as such rather than ending the
+  /// sweep.
+  /// </summary>
+  class ParameterSweep
+  {
+  public:
+    /// <summary>
+    /// Parse a comma-separated list of numbers, e.g. "10,50,100".
+    /// </summary>
+    /// <param name="s">The list.</param>
+    /// <returns>The numbers.</returns>
+    static std::vector<float> ParseList(const std::string& s);
+
+    /// <summary>
+    /// Enumerate the Cartesian product of lists of parameter values.
+    /// </summary>
+    /// <param name="base">Values of the parameters not being searched.</param>
+    /// <param name="count">If non-zero, draw this many configurations at
+    /// random (without replacement) from the grid, i.e. random search.</param>
+    /// <param name="random">Random number generator.</param>
+    /// <returns>The configurations.</returns>
+    static std::vector<SweepConfiguration> CreateConfigurations(
+      const TrainingParameters& base,
+      const std::vector<float>& T,
+      const std::vector<float>& D,
+      const std::vector<float>& F,
+      const std::vector<float>& L,
+      const std::vector<float>& a,
+      const std::vector<float>& b,
+      unsigned int count,
+      Random& random );
+
+    /// <summary>
+    /// Divide data at random into training and validation views.
+    /// </summary>
+    /// <param name="data">The data, which must outlive the views.</param>
+    /// <param name="foldCount">The number of cross-validation folds (each
+    /// data point is held out by exactly one fold) or 1 to hold out
+    /// validationFraction of the data once.</param>
+    /// <param name="validationFraction">The fraction of data points to hold
+    /// out if foldCount is 1.</param>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="trainingData">Receives the training data for each fold.</param>
+    /// <param name="validationData">Receives the validation data for each fold.</param>
+    static void CreateFolds(
+      const DataPointCollection& data,
+      int foldCount,
+      float validationFraction,
+      Random& random,
+      std::vector<DataPointCollection>& trainingData,
+      std::vector<DataPointCollection>& validationData );
+
+    /// <summary>
+    /// Train a classification forest per configuration and fold, and score
+    /// it by its accuracy on the fold's validation data.
+    /// </summary>
+    template<class F>
+    static std::vector<SweepResult> SweepClassification(
+      const std::vector<DataPointCollection>& trainingData,
+      const std::vector<DataPointCollection>& validationData,
+      IFeatureResponseFactory<F>* featureFactory,
+      const std::vector<SweepConfiguration>& configurations,
+      int maxThreads,
+      Random& random ) // where F : IFeatureResponse
+    {
+      if (trainingData[0].HasLabels() == false)
+        throw std::runtime_error("Training data points must be labelled.");
+
+      int nClasses = trainingData[0].CountClasses();
+      int nFolds = trainingData.size();
+      int nTasks = configurations.size() * nFolds;
+
+      std::vector<int> seeds = DrawSeeds(nTasks, random);
+      std::vector<double> seconds(nTasks), scores(nTasks);
+      std::vector<std::string> errors(nTasks);
+
+      int completed = 0;
+
+#pragma omp parallel for schedule(dynamic) num_threads(maxThreads)
+      for (int task = 0; task < nTasks; task++)
+      {
+        int c = task / nFolds, fold = task % nFolds;
+
+        // An exception must not escape the parallel region
+        try
+        {
+          double start = omp_get_wtime();
+
+          Random taskRandom(seeds[task]);
+          ClassificationTrainingContext<F> context(nClasses, featureFactory);
+          ProgressStream silent(std::cout, Silent);
+
+          std::auto_ptr<Forest<F, HistogramAggregator> > forest = ForestTrainer<F, HistogramAggregator>::TrainForest(
+            taskRandom, GetTaskParameters(configurations[c]), context, trainingData[fold], &silent);
+
+          seconds[task] = omp_get_wtime() - start;
+          scores[task] = ComputeAccuracy(*forest, validationData[fold], nClasses);
+        }
+        catch (const std::exception& e)
+        {
+          errors[task] = e.what();
+        }
+
+        ReportProgress(completed, nTasks);
+      }
+      std::cout << std::endl;
+
+      return CollateResults(configurations, nFolds, seconds, scores, errors);
+    }
+
+    /// <summary>
+    /// Train a density estimation forest per configuration and fold, and
+    /// score it by the mean log probability density of the fold's
+    /// validation data.
+    /// </summary>
+    static std::vector<SweepResult> SweepDensityEstimation(
+      const std::vector<DataPointCollection>& trainingData,
+      const std::vector<DataPointCollection>& validationData,
+      const std::vector<SweepConfiguration>& configurations,
+      int maxThreads,
+      Random& random );
+
+    /// <summary>
+    /// Print results, best first.
+    /// </summary>
+    /// <param name="o">Output stream.</param>
+    /// <param name="results">The results.</param>
+    /// <param name="scoreName">Description of the score, e.g. "accuracy".</param>
+    /// <param name="showPriors">Include the density estimation priors.</param>
+    static void PrintResults(std::ostream& o, std::vector<SweepResult> results, const std::string& scoreName, bool showPriors);
+
+  private:
+    static std::vector<int> DrawSeeds(int count, Random& random);
+
+    static TrainingParameters GetTaskParameters(const SweepConfiguration& configuration);
+
+    static void ReportProgress(int& completed, int total);
+
+    static std::vector<SweepResult> CollateResults(
+      const std::vector<SweepConfiguration>& configurations,
+      int nFolds,
+      const std::vector<double>& seconds,
+      const std::vector<double>& scores,
+      const std::vector<std::string>& errors );
+
+    template<class F>
+    static double ComputeAccuracy(
+      const Forest<F, HistogramAggregator>& forest,
+      const DataPointCollection& validationData,
+      int nClasses )
+    {
+      ProgressStream silent(std::cout, Silent);
+
+      std::vector<std::vector<int> > leafNodeIndices;
+      forest.Apply(validationData, leafNodeIndices, &silent);
+
+      unsigned int correct = 0, total = 0;
+      for (unsigned int i = 0; i < validationData.Count(); i++)
+      {
+        if (validationData.GetIntegerLabel(i) == DataPointCollection::UnknownClassLabel)
+          continue;
+
+        HistogramAggregator h(nClasses);
+        for (int t = 0; t < forest.TreeCount(); t++)
+          h.Aggregate(forest.GetTree(t).GetNode(leafNodeIndices[t][i]).TrainingDataStatistics);
+
+        if (h.FindTallestBinIndex() == validationData.GetIntegerLabel(i))
+          correct++;
+        total++;
+      }
+
+      return total == 0 ? 0.0 : (double)(correct) / total;
+    }
+  };
+} } }
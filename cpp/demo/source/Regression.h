@@ -58,6 +58,16 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     }
   };
 
+  class BoostedRegressionTrainingContext : public BoostingTrainingContext<AxisAlignedFeatureResponse>
+  {
+  public:
+    // Implementation of ITrainingContext (the remainder is provided by BoostingTrainingContext)
+    AxisAlignedFeatureResponse GetRandomFeature(Random& random)
+    {
+      return AxisAlignedFeatureResponse(0); // not actually random because only one feature possible  in 1D
+    }
+  };
+
   class RegressionExample
   {
   public:
@@ -68,7 +78,8 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
     static std::auto_ptr<Forest<AxisAlignedFeatureResponse, LinearFitAggregator1d> > Train(
       const DataPointCollection& trainingData,
-      const TrainingParameters& parameters)
+      const TrainingParameters& parameters,
+      const std::string& initialForestPath="")
     {
       std::cout << "Training the forest..." << std::endl;
 
@@ -76,13 +87,92 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       RegressionTrainingContext regressionTrainingContext;
 
-      std::auto_ptr<Forest<AxisAlignedFeatureResponse, LinearFitAggregator1d> > forest
-        = ForestTrainer<AxisAlignedFeatureResponse, LinearFitAggregator1d>::TrainForest(
-        random, parameters, regressionTrainingContext, trainingData);
+      std::auto_ptr<Forest<AxisAlignedFeatureResponse, LinearFitAggregator1d> > forest;
+
+      if (initialForestPath != "")
+      {
+        // Warm start: add trees to a previously trained forest
+        forest = Forest<AxisAlignedFeatureResponse, LinearFitAggregator1d>::Deserialize(initialForestPath);
+        ForestTrainer<AxisAlignedFeatureResponse, LinearFitAggregator1d>::GrowForest(
+          random, parameters, regressionTrainingContext, trainingData, *forest);
+      }
+      else
+      {
+        forest = ForestTrainer<AxisAlignedFeatureResponse, LinearFitAggregator1d>::TrainForest(
+          random, parameters, regressionTrainingContext, trainingData);
+      }
 
       return forest;
     }
 
+    static std::auto_ptr<Forest<AxisAlignedFeatureResponse, GradientStatistics> > TrainBoosted(
+      const DataPointCollection& trainingData,
+      const TrainingParameters& parameters,
+      const BoostingParameters& boostingParameters)
+    {
+      std::cout << "Training the boosted forest..." << std::endl;
+
+      Random random;
+
+      BoostedRegressionTrainingContext boostingTrainingContext;
+      SquaredLoss loss;
+
+      std::vector<float> targets(trainingData.Count());
+      for (unsigned int i = 0; i < trainingData.Count(); i++)
+        targets[i] = trainingData.GetTarget(i);
+
+      return BoostingTrainer<AxisAlignedFeatureResponse>::TrainForest(
+        random, parameters, boostingParameters, boostingTrainingContext, loss, trainingData, targets);
+    }
+
+    static std::auto_ptr<Bitmap<PixelBgr> > VisualizeBoosted(
+      const Forest<AxisAlignedFeatureResponse, GradientStatistics>& forest,
+      const DataPointCollection& trainingData,
+      Size PlotSize,
+      PointF PlotDilation )
+    {
+      PlotCanvas plotCanvas(trainingData.GetRange(0), trainingData.GetTargetRange(), PlotSize, PlotDilation);
+
+      std::auto_ptr<DataPointCollection> testData = DataPointCollection::Generate1dGrid(plotCanvas.plotRangeX, PlotSize.Width);
+
+      std::cout << "\nApplying the boosted forest to test data..." << std::endl;
+
+      std::vector<double> predictions;
+      PredictAdditive(forest, *testData.get(), predictions);
+
+      std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(new Bitmap<PixelBgr> (PlotSize.Width, PlotSize.Height));
+      for (int j = 0; j < PlotSize.Height; j++)
+        for (int i = 0; i < PlotSize.Width; i++)
+          result->SetPixel(i, j, PixelBgr::FromArgb(255, 255, 255));
+
+      // Plot the predicted curve and the original training data
+      Graphics<PixelBgr> g(result->GetBuffer(), result->GetWidth(), result->GetHeight(), result->GetStride());
+
+      for (int i = 0; i < PlotSize.Width-1; i++)
+      {
+        g.DrawLine(
+          MeanColor,
+          (float)(i),
+          (float)((predictions[i] - plotCanvas.plotRangeY.first)/plotCanvas.stepY),
+          (float)(i+1),
+          (float)((predictions[i+1] - plotCanvas.plotRangeY.first)/plotCanvas.stepY));
+      }
+
+      for (unsigned int s = 0; s < trainingData.Count(); s++)
+      {
+        // Map sample coordinate back to a pixel coordinate in the visualization image
+        PointF x(
+          (trainingData.GetDataPoint(s)[0] - plotCanvas.plotRangeX.first) / plotCanvas.stepX,
+          (trainingData.GetTarget(s) - plotCanvas.plotRangeY.first) / plotCanvas.stepY);
+
+        RectangleF rectangle(x.X - 2.0f, x.Y - 2.0f, 4.0f, 4.0f);
+        g.FillRectangle(DataPointColor, rectangle.X, rectangle.Y, rectangle.Width, rectangle.Height);
+        g.DrawRectangle(DataPointBorderColor, rectangle.X, rectangle.Y, rectangle.Width, rectangle.Height);
+      }
+
+      return result;
+    }
+
     static std::auto_ptr<Bitmap<PixelBgr> > Visualize(
       Forest<AxisAlignedFeatureResponse, LinearFitAggregator1d>& forest,
       const DataPointCollection& trainingData,
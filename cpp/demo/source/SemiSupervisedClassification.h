@@ -207,7 +207,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       return forest;
     }
 
-    static std::auto_ptr<Bitmap<PixelBgr> > VisualizeLabels(const Forest<LinearFeatureResponse2d, SemiSupervisedClassificationStatisticsAggregator>& forest, DataPointCollection trainingData, Size PlotSize, PointF PlotDilation)
+    static std::auto_ptr<Bitmap<PixelBgr> > VisualizeLabels(const Forest<LinearFeatureResponse2d, SemiSupervisedClassificationStatisticsAggregator>& forest, const DataPointCollection& trainingData, Size PlotSize, PointF PlotDilation)
     {
       // Generate some test samples in a grid pattern (a useful basis for creating visualization images)
       PlotCanvas plotCanvas(trainingData.GetRange(0), trainingData.GetRange(1), PlotSize, PlotDilation);
@@ -295,7 +295,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       return result;
     }
 
-    static std::auto_ptr<Bitmap<PixelBgr> > VisualizeDensity(const Forest<LinearFeatureResponse2d, SemiSupervisedClassificationStatisticsAggregator>& forest, DataPointCollection trainingData, Size PlotSize, PointF PlotDilation)
+    static std::auto_ptr<Bitmap<PixelBgr> > VisualizeDensity(const Forest<LinearFeatureResponse2d, SemiSupervisedClassificationStatisticsAggregator>& forest, const DataPointCollection& trainingData, Size PlotSize, PointF PlotDilation)
     {
       // Generate some test samples in a grid pattern (a useful basis for creating visualization images)
       PlotCanvas plotCanvas(trainingData.GetRange(0), trainingData.GetRange(1), PlotSize, PlotDilation);
@@ -363,7 +363,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       return result;
     }
 
-    static void PaintTrainingData(DataPointCollection trainingData, PlotCanvas plotCanvas, Bitmap<PixelBgr>* result)
+    static void PaintTrainingData(const DataPointCollection& trainingData, const PlotCanvas& plotCanvas, Bitmap<PixelBgr>* result)
     {
       // same colours as those in the book.
       assert(trainingData.CountClasses()<=4);
@@ -0,0 +1,212 @@
+#include "SocketChannel.h"
+
+#include <string.h>
+
+#include <stdexcept>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+#ifdef WIN32
+  SocketChannel::SocketChannel(int socket):socket_(socket) { }
+  SocketChannel::~SocketChannel() { }
+
+  std::auto_ptr<SocketChannel> SocketChannel::Connect(const std::string& address, int timeoutSeconds)
+  {
+    throw std::runtime_error("Sockets are not supported on this platform.");
+  }
+
+  void SocketChannel::Send(const std::string& message)
+  {
+    throw std::runtime_error("Sockets are not supported on this platform.");
+  }
+
+  void SocketChannel::Receive(std::string& message)
+  {
+    throw std::runtime_error("Sockets are not supported on this platform.");
+  }
+
+  SocketListener::SocketListener(const std::string& address):socket_(-1)
+  {
+    throw std::runtime_error("Sockets are not supported on this platform.");
+  }
+
+  SocketListener::~SocketListener() { }
+
+  std::auto_ptr<SocketChannel> SocketListener::Accept()
+  {
+    throw std::runtime_error("Sockets are not supported on this platform.");
+  }
+#else
+  namespace
+  {
+    // Create a socket and the address it refers to. Returns the socket
+    // descriptor.
+    int CreateSocket(const std::string& address, sockaddr_storage& socketAddress, socklen_t& length, std::string& unixPath)
+    {
+      memset(&socketAddress, 0, sizeof(socketAddress));
+
+      if (address.substr(0, 5) == "unix:")
+      {
+        unixPath = address.substr(5);
+
+        sockaddr_un& a = (sockaddr_un&)(socketAddress);
+        if (unixPath.size() + 1 > sizeof(a.sun_path))
+          throw std::runtime_error("Socket path is too long.");
+        a.sun_family = AF_UNIX;
+        strcpy(a.sun_path, unixPath.c_str());
+        length = sizeof(sockaddr_un);
+      }
+      else
+      {
+        std::string::size_type colon = address.find_last_of(':');
+        if (colon == std::string::npos)
+          throw std::runtime_error("Socket address must be of the form unix:<path> or <host>:<port>.");
+
+        std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+        addrinfo hints, *result = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || result == 0)
+          throw std::runtime_error("Failed to resolve socket address \"" + address + "\".");
+
+        memcpy(&socketAddress, result->ai_addr, result->ai_addrlen);
+        length = result->ai_addrlen;
+        freeaddrinfo(result);
+      }
+
+      int s = socket(socketAddress.ss_family, SOCK_STREAM, 0);
+      if (s < 0)
+        throw std::runtime_error("Failed to create socket.");
+
+      if (socketAddress.ss_family == AF_INET)
+      {
+        // Messages are small and latency bound
+        int flag = 1;
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)(&flag), sizeof(flag));
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)(&flag), sizeof(flag));
+      }
+
+      return s;
+    }
+
+    void WriteAll(int s, const char* buffer, size_t length)
+    {
+      while (length > 0)
+      {
+        ssize_t n = send(s, buffer, length, 0);
+        if (n <= 0)
+          throw std::runtime_error("Failed to write to socket.");
+        buffer += n;
+        length -= n;
+      }
+    }
+
+    void ReadAll(int s, char* buffer, size_t length)
+    {
+      while (length > 0)
+      {
+        ssize_t n = recv(s, buffer, length, 0);
+        if (n <= 0)
+          throw std::runtime_error(n == 0 ? "Connection closed by peer." : "Failed to read from socket.");
+        buffer += n;
+        length -= n;
+      }
+    }
+  }
+
+  SocketChannel::SocketChannel(int socket):socket_(socket)
+  {
+  }
+
+  SocketChannel::~SocketChannel()
+  {
+    close(socket_);
+  }
+
+  std::auto_ptr<SocketChannel> SocketChannel::Connect(const std::string& address, int timeoutSeconds)
+  {
+    for (int attempt = 0; ; attempt++)
+    {
+      sockaddr_storage socketAddress;
+      socklen_t length;
+      std::string unixPath;
+      int s = CreateSocket(address, socketAddress, length, unixPath);
+
+      if (connect(s, (sockaddr*)(&socketAddress), length) == 0)
+        return std::auto_ptr<SocketChannel>(new SocketChannel(s));
+
+      close(s);
+
+      // The listener may not have started yet
+      if (attempt >= 10 * timeoutSeconds)
+        throw std::runtime_error("Failed to connect to \"" + address + "\".");
+      usleep(100000);
+    }
+  }
+
+  void SocketChannel::Send(const std::string& message)
+  {
+    // Messages are prefixed by their length in network byte order
+    uint32_t length = htonl((uint32_t)(message.size()));
+    WriteAll(socket_, (const char*)(&length), sizeof(length));
+    WriteAll(socket_, message.data(), message.size());
+  }
+
+  void SocketChannel::Receive(std::string& message)
+  {
+    uint32_t length;
+    ReadAll(socket_, (char*)(&length), sizeof(length));
+    message.resize(ntohl(length));
+    if (message.size() > 0)
+      ReadAll(socket_, &message[0], message.size());
+  }
+
+  SocketListener::SocketListener(const std::string& address)
+  {
+    sockaddr_storage socketAddress;
+    socklen_t length;
+    socket_ = CreateSocket(address, socketAddress, length, unixPath_);
+
+    if (unixPath_ != "")
+      unlink(unixPath_.c_str());   // remove any stale socket file
+
+    if (bind(socket_, (sockaddr*)(&socketAddress), length) != 0 || listen(socket_, 16) != 0)
+    {
+      close(socket_);
+      throw std::runtime_error("Failed to listen on \"" + address + "\".");
+    }
+  }
+
+  SocketListener::~SocketListener()
+  {
+    close(socket_);
+    if (unixPath_ != "")
+      unlink(unixPath_.c_str());
+  }
+
+  std::auto_ptr<SocketChannel> SocketListener::Accept()
+  {
+    int s = accept(socket_, 0, 0);
+    if (s < 0)
+      throw std::runtime_error("Failed to accept connection.");
+
+    int flag = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)(&flag), sizeof(flag));   // fails harmlessly for Unix domain sockets
+
+    return std::auto_ptr<SocketChannel>(new SocketChannel(s));
+  }
+#endif
+} } }
@@ -0,0 +1,56 @@
+#pragma once
+
+// This file declares the SocketChannel and SocketListener classes, which
+// allow distributed training coordinators and workers to communicate over
+// Unix domain or TCP sockets. Addresses are of the form "unix:<path>" or
+// "<host>:<port>" (e.g. "localhost:5000").
+
+#include <string>
+#include <memory>
+
+#include "Sherwood.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  class SocketChannel: public IMessageChannel
+  {
+    int socket_;
+
+    SocketChannel(const SocketChannel&);
+    SocketChannel& operator=(const SocketChannel&);
+
+  public:
+    SocketChannel(int socket);
+
+    ~SocketChannel();
+
+    /// <summary>
+    /// Connect to a listening socket, retrying until the listener becomes
+    /// available or the specified time has elapsed.
+    /// </summary>
+    static std::auto_ptr<SocketChannel> Connect(const std::string& address, int timeoutSeconds = 30);
+
+    void Send(const std::string& message);
+
+    void Receive(std::string& message);
+  };
+
+  class SocketListener
+  {
+    int socket_;
+    std::string unixPath_;
+
+    SocketListener(const SocketListener&);
+    SocketListener& operator=(const SocketListener&);
+
+  public:
+    SocketListener(const std::string& address);
+
+    ~SocketListener();
+
+    /// <summary>
+    /// Block until a connection is made.
+    /// </summary>
+    std::auto_ptr<SocketChannel> Accept();
+  };
+} } }
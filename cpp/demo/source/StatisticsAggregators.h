@@ -33,6 +33,8 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
     float GetProbability(int classIndex) const;
 
+    unsigned int GetCount(int classIndex) const { return bins_[classIndex]; }
+
     int BinCount() const {return binCount_; }
 
     unsigned int SampleCount() const { return sampleCount_; }
@@ -15,14 +15,19 @@
 
 #include "CommandLineParser.h"
 #include "DataPointCollection.h"
+#include "ChunkedDataPointCollection.h"
+#include "SocketChannel.h"
 
 #include "Classification.h"
 #include "DensityEstimation.h"
 #include "SemiSupervisedClassification.h"
 #include "Regression.h"
+#include "ParameterSweep.h"
 
 using namespace MicrosoftResearch::Cambridge::Sherwood;
 
+int Run(int argc, char* argv[]);
+
 void DisplayHelp();
 
 void DisplayTextFiles(const std::string& relativePath);
@@ -40,6 +45,21 @@ const std::string REGRESSION_DATA_PATH = "/data/regression";
 const std::string DENSITY_DATA_PATH = "/data/density estimation";
 
 int main(int argc, char* argv[])
+{
+  // Report errors not handled within a particular mode, e.g. training runs
+  // that would exceed the /budget.
+  try
+  {
+    return Run(argc, argv);
+  }
+  catch (std::runtime_error& e)
+  {
+    std::cout << "Failed. " << e.what() << std::endl;
+    return 1;
+  }
+}
+
+int Run(int argc, char* argv[])
 {
   if(argc<2 || std::string(argv[1])=="/?" || toLower(argv[1])=="help")
   {
@@ -51,20 +71,47 @@ int main(int argc, char* argv[])
 
   // These command line parameters are reused over several command line modes...
   StringParameter trainingDataPath("path", "Path of file containing training data.");
-  StringParameter forestOutputPath("forest", "Path of file containing forest.");
-  StringParameter forestPath("forest", "Path of file containing forest.");
+  StringParameter forestOutputPath("forest", "Path of file to which the trained forest is saved.");
+  StringParameter forestPath("forest", "Path of previously saved forest to grow with additional trees.");
   StringParameter testDataPath("data", "Path of file containing test data.");
   StringParameter outputPath("output", "Path of file containing output.");
+  StringParameter refitDataPath("path", "Path of file containing data used to refit the leaf statistics of the trained forest.");
+  StringParameter codePath("path", "Path of file to which the trained forest is written as C++ source code (see 'make forest').");
+  StringParameter pruneDataPath("path", "Path of file containing held-out data on which to measure error when pruning (with /prune).");
+  StringParameter socketAddress("address", "Socket address, e.g. unix:/tmp/sw.socket or localhost:5000.");
+  StringParameter checkpointPath("path", "Path of checkpoint file used to resume interrupted training.");
   NaturalParameter T("t", "No. of trees in the forest (default = {0}).", 10);
-  NaturalParameter D("d", "Maximum tree levels (default = {0}).", 10, 20);
+  NaturalParameter D("d", "Maximum tree levels (default = {0}).", 10);
   NaturalParameter F("f", "No. of candidate feature response functions per split node (default = {0}).", 10);
   NaturalParameter L("l", "No. of candidate thresholds per feature response function (default = {0}).", 1);
   SingleParameter a("a", "The number of 'effective' prior observations (default = {0}).", true, false, 10.0f);
   SingleParameter b("b", "The variance of the effective observations (default = {0}).", true, true, 400.0f);
+  SimpleSwitchParameter extraTreesSwitch("Use a single random threshold per candidate feature (extremely randomized trees).");
+  SimpleSwitchParameter fernsSwitch("Train random ferns (one split per level) instead of decision trees.");
+  NaturalParameter onlinePasses("passes", "Train online, streaming the training data the given number of times (default = {0}).", 10);
+  NaturalParameter inMemoryThreshold("n", "Train out of core from a chunked copy of the training data, holding at most n data points in memory (default = {0}).", 100);
+  NaturalParameter jungleWidth("w", "Train a decision jungle with at most w nodes per level instead of a forest.", 64);
+  SingleParameter boostShrinkage("shrinkage", "Train gradient-boosted trees with the given shrinkage instead of a forest (default = {0}).", true, true, 0.1f);
+  SingleParameter pruneAlpha("alpha", "Prune the trained forest, keeping only subtrees that misclassify at least alpha fewer training points per extra leaf (default = {0}).", true, false, 1.0f);
+  SingleParameter costPenalty("lambda", "Penalize the gain of each split by lambda times the expected cost of evaluating its feature (default = {0}).", true, false, 0.01f);
+  NaturalParameter threadCount("n", "Train using n threads (default = {0}).", 2);
+  SimpleSwitchParameter replicateSwitch("Give each training thread its own copy of the training data (with /threads).");
+  NaturalParameter memoryBudget("mb", "Adapt training to (or fail fast unless it fits) a budget of mb megabytes (default = {0}).", 1024);
+  NaturalParameter workerCount("n", "No. of workers (default = {0}).", 2);
+  NaturalParameter shardIndex("k", "Index of the shard of the training data held by this worker (default = {0}).", 1);
+  NaturalParameter shardCount("n", "No. of shards into which the training data is divided (default = {0}).", 1);
+  SimpleSwitchParameter leanSwitch("Omit split node statistics (needed only to prune or refit split nodes) from the saved forest.");
   SimpleSwitchParameter verboseSwitch("Enables verbose progress indication.");
   SingleParameter plotPaddingX("padx", "Pad plot horizontally (default = {0}).", true, false, 0.1f);
   SingleParameter plotPaddingY("pady", "Pad plot vertically (default = {0}).", true, false, 0.1f);
 
+  EnumParameter codeLayout(
+    "layout",
+    "Specify how generated code traverses each tree (default = {0}).",
+    "nested;flat",
+    "one if/else per split node;a loop over a switch selecting the next node",
+    "nested");
+
   EnumParameter split(
     "s",
     "Specify what kind of split function to use (default = {0}).",
@@ -89,6 +136,24 @@ int main(int argc, char* argv[])
 
     parser.AddSwitch("PADX", plotPaddingX);
     parser.AddSwitch("PADY",  plotPaddingY);
+    parser.AddSwitch("WARM", forestPath);
+    parser.AddSwitch("SAVE", forestOutputPath);
+    parser.AddSwitch("LEAN", leanSwitch);
+    parser.AddSwitch("CHECKPOINT", checkpointPath);
+    parser.AddSwitch("EXTRA", extraTreesSwitch);
+    parser.AddSwitch("FERNS", fernsSwitch);
+    parser.AddSwitch("JUNGLE", jungleWidth);
+    parser.AddSwitch("ONLINE", onlinePasses);
+    parser.AddSwitch("REFIT", refitDataPath);
+    parser.AddSwitch("PRUNE", pruneAlpha);
+    parser.AddSwitch("PRUNEDATA", pruneDataPath);
+    parser.AddSwitch("CODE", codePath);
+    parser.AddSwitch("LAYOUT", codeLayout);
+    parser.AddSwitch("OOC", inMemoryThreshold);
+    parser.AddSwitch("COST", costPenalty);
+    parser.AddSwitch("THREADS", threadCount);
+    parser.AddSwitch("REPLICATE", replicateSwitch);
+    parser.AddSwitch("BUDGET", memoryBudget);
     parser.AddSwitch("VERBOSE", verboseSwitch);
 
     if (argc == 2)
@@ -107,6 +172,16 @@ int main(int argc, char* argv[])
     trainingParameters.NumberOfCandidateThresholdsPerFeature = L.Value;
     trainingParameters.NumberOfTrees = T.Value;
     trainingParameters.Verbose = verboseSwitch.Used();
+    trainingParameters.ExtremelyRandomized = extraTreesSwitch.Used();
+    trainingParameters.CheckpointPath = checkpointPath.Value;
+    if (costPenalty.Used())
+    {
+      trainingParameters.CostMode = SplitCostMode::PenalizedGain;
+      trainingParameters.CostPenalty = costPenalty.Value;
+    }
+    trainingParameters.ReplicateTrainingData = replicateSwitch.Used();
+    if (memoryBudget.Used())
+      trainingParameters.MemoryBudget = (std::size_t)(memoryBudget.Value) * 1024 * 1024;
 
     PointF plotDilation(plotPaddingX.Value, plotPaddingY.Value);
 
@@ -123,10 +198,161 @@ int main(int argc, char* argv[])
     if (split.Value == "linear")
     {
       LinearFeatureFactory linearFeatureFactory;
+
+      if (jungleWidth.Used())
+      {
+        std::auto_ptr<Jungle<LinearFeatureResponse2d, HistogramAggregator> > jungle = ClassificationDemo<LinearFeatureResponse2d>::TrainJungle(
+          *trainingData,
+          &linearFeatureFactory,
+          trainingParameters,
+          jungleWidth.Value);
+
+        if (forestOutputPath.Used())
+          jungle->Serialize(forestOutputPath.Value);
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<LinearFeatureResponse2d>::VisualizeJungle(*jungle, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (inMemoryThreshold.Used())
+      {
+        // Make a chunked on-disk copy of the training data to stream from
+        ChunkedDataPointCollection::Write(*trainingData, "training.chunks");
+        ChunkedDataPointCollection chunkedData("training.chunks", inMemoryThreshold.Value);
+
+        std::auto_ptr<Forest<LinearFeatureResponse2d, HistogramAggregator> > forest = ClassificationDemo<LinearFeatureResponse2d>::TrainOutOfCore(
+          chunkedData,
+          &linearFeatureFactory,
+          trainingParameters,
+          inMemoryThreshold.Value);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<LinearFeatureResponse2d>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (onlinePasses.Used())
+      {
+        std::auto_ptr<Forest<LinearFeatureResponse2d, HistogramAggregator> > forest = ClassificationDemo<LinearFeatureResponse2d>::TrainOnline(
+          *trainingData,
+          &linearFeatureFactory,
+          trainingParameters,
+          onlinePasses.Value);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<LinearFeatureResponse2d>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (fernsSwitch.Used())
+      {
+        std::auto_ptr<FernEnsemble<LinearFeatureResponse2d, HistogramAggregator> > ferns = ClassificationDemo<LinearFeatureResponse2d>::TrainFerns(
+          *trainingData,
+          &linearFeatureFactory,
+          trainingParameters);
+
+        if (forestOutputPath.Used())
+          ferns->Serialize(forestOutputPath.Value);
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<LinearFeatureResponse2d>::VisualizeFerns(*ferns, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (threadCount.Used())
+      {
+        std::auto_ptr<Forest<LinearFeatureResponse2d, HistogramAggregator> > forest = ClassificationDemo<LinearFeatureResponse2d>::TrainParallel(
+          *trainingData,
+          &linearFeatureFactory,
+          trainingParameters,
+          threadCount.Value);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<LinearFeatureResponse2d>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
       std::auto_ptr<Forest<LinearFeatureResponse2d, HistogramAggregator> > forest = ClassificationDemo<LinearFeatureResponse2d>::Train(
         *trainingData,
         &linearFeatureFactory,
-        trainingParameters);
+        trainingParameters,
+        forestPath.Value);
+
+      if (refitDataPath.Used())
+      {
+        std::auto_ptr<DataPointCollection> refitData = std::auto_ptr<DataPointCollection> ( LoadTrainingData(
+          refitDataPath.Value,
+          CLAS_DATA_PATH + "/" + refitDataPath.Value,
+          2,
+          DataDescriptor::HasClassLabels ) );
+
+        if (refitData.get()==0)
+          return 0;
+
+        if (refitData->CountClasses() > trainingData->CountClasses())
+        {
+          std::cout << "Refit data must not contain more classes than the training data." << std::endl;
+          return 0;
+        }
+
+        ForestRefitter<LinearFeatureResponse2d, HistogramAggregator>::RefitForest(*forest, *refitData);
+      }
+
+      if (pruneAlpha.Used())
+      {
+        std::auto_ptr<DataPointCollection> pruneData;
+        if (pruneDataPath.Used())
+        {
+          pruneData = LoadTrainingData(
+            pruneDataPath.Value,
+            CLAS_DATA_PATH + "/" + pruneDataPath.Value,
+            2,
+            DataDescriptor::HasClassLabels );
+
+          if (pruneData.get()==0)
+            return 0;
+
+          if (pruneData->CountClasses() > trainingData->CountClasses())
+          {
+            std::cout << "Pruning data must not contain more classes than the training data." << std::endl;
+            return 0;
+          }
+        }
+
+        ClassificationTrainingContext<LinearFeatureResponse2d> classificationContext(trainingData->CountClasses(), &linearFeatureFactory);
+        ForestPruner<LinearFeatureResponse2d, HistogramAggregator>::PruneForest(*forest, classificationContext, pruneAlpha.Value, pruneData.get());
+      }
+
+      if (codePath.Used())
+        ClassificationDemo<LinearFeatureResponse2d>::WriteCode(*forest, codePath.Value, codeLayout.Value == "flat" ? CodeLayout::Flattened : CodeLayout::Nested);
+
+      if (forestOutputPath.Used())
+        forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
 
       std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
         ClassificationDemo<LinearFeatureResponse2d>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
@@ -137,10 +363,161 @@ int main(int argc, char* argv[])
     else if (split.Value == "axis")
     {
       AxisAlignedFeatureResponseFactory axisAlignedFeatureFactory;
+
+      if (jungleWidth.Used())
+      {
+        std::auto_ptr<Jungle<AxisAlignedFeatureResponse, HistogramAggregator> > jungle = ClassificationDemo<AxisAlignedFeatureResponse>::TrainJungle(
+          *trainingData,
+          &axisAlignedFeatureFactory,
+          trainingParameters,
+          jungleWidth.Value);
+
+        if (forestOutputPath.Used())
+          jungle->Serialize(forestOutputPath.Value);
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<AxisAlignedFeatureResponse>::VisualizeJungle(*jungle, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (inMemoryThreshold.Used())
+      {
+        // Make a chunked on-disk copy of the training data to stream from
+        ChunkedDataPointCollection::Write(*trainingData, "training.chunks");
+        ChunkedDataPointCollection chunkedData("training.chunks", inMemoryThreshold.Value);
+
+        std::auto_ptr<Forest<AxisAlignedFeatureResponse, HistogramAggregator> > forest = ClassificationDemo<AxisAlignedFeatureResponse>::TrainOutOfCore(
+          chunkedData,
+          &axisAlignedFeatureFactory,
+          trainingParameters,
+          inMemoryThreshold.Value);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<AxisAlignedFeatureResponse>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (onlinePasses.Used())
+      {
+        std::auto_ptr<Forest<AxisAlignedFeatureResponse, HistogramAggregator> > forest = ClassificationDemo<AxisAlignedFeatureResponse>::TrainOnline(
+          *trainingData,
+          &axisAlignedFeatureFactory,
+          trainingParameters,
+          onlinePasses.Value);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<AxisAlignedFeatureResponse>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (fernsSwitch.Used())
+      {
+        std::auto_ptr<FernEnsemble<AxisAlignedFeatureResponse, HistogramAggregator> > ferns = ClassificationDemo<AxisAlignedFeatureResponse>::TrainFerns(
+          *trainingData,
+          &axisAlignedFeatureFactory,
+          trainingParameters);
+
+        if (forestOutputPath.Used())
+          ferns->Serialize(forestOutputPath.Value);
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<AxisAlignedFeatureResponse>::VisualizeFerns(*ferns, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
+      if (threadCount.Used())
+      {
+        std::auto_ptr<Forest<AxisAlignedFeatureResponse, HistogramAggregator> > forest = ClassificationDemo<AxisAlignedFeatureResponse>::TrainParallel(
+          *trainingData,
+          &axisAlignedFeatureFactory,
+          trainingParameters,
+          threadCount.Value);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<AxisAlignedFeatureResponse>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+        return 0;
+      }
+
       std::auto_ptr<Forest<AxisAlignedFeatureResponse, HistogramAggregator> > forest = ClassificationDemo<AxisAlignedFeatureResponse>::Train (
         *trainingData,
         &axisAlignedFeatureFactory,
-        trainingParameters );
+        trainingParameters,
+        forestPath.Value );
+
+      if (refitDataPath.Used())
+      {
+        std::auto_ptr<DataPointCollection> refitData = std::auto_ptr<DataPointCollection> ( LoadTrainingData(
+          refitDataPath.Value,
+          CLAS_DATA_PATH + "/" + refitDataPath.Value,
+          2,
+          DataDescriptor::HasClassLabels ) );
+
+        if (refitData.get()==0)
+          return 0;
+
+        if (refitData->CountClasses() > trainingData->CountClasses())
+        {
+          std::cout << "Refit data must not contain more classes than the training data." << std::endl;
+          return 0;
+        }
+
+        ForestRefitter<AxisAlignedFeatureResponse, HistogramAggregator>::RefitForest(*forest, *refitData);
+      }
+
+      if (pruneAlpha.Used())
+      {
+        std::auto_ptr<DataPointCollection> pruneData;
+        if (pruneDataPath.Used())
+        {
+          pruneData = LoadTrainingData(
+            pruneDataPath.Value,
+            CLAS_DATA_PATH + "/" + pruneDataPath.Value,
+            2,
+            DataDescriptor::HasClassLabels );
+
+          if (pruneData.get()==0)
+            return 0;
+
+          if (pruneData->CountClasses() > trainingData->CountClasses())
+          {
+            std::cout << "Pruning data must not contain more classes than the training data." << std::endl;
+            return 0;
+          }
+        }
+
+        ClassificationTrainingContext<AxisAlignedFeatureResponse> classificationContext(trainingData->CountClasses(), &axisAlignedFeatureFactory);
+        ForestPruner<AxisAlignedFeatureResponse, HistogramAggregator>::PruneForest(*forest, classificationContext, pruneAlpha.Value, pruneData.get());
+      }
+
+      if (codePath.Used())
+        ClassificationDemo<AxisAlignedFeatureResponse>::WriteCode(*forest, codePath.Value, codeLayout.Value == "flat" ? CodeLayout::Flattened : CodeLayout::Nested);
+
+      if (forestOutputPath.Used())
+        forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
 
       std::auto_ptr<Bitmap <PixelBgr> > result = std::auto_ptr<Bitmap <PixelBgr> >(
         ClassificationDemo<AxisAlignedFeatureResponse>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
@@ -171,6 +548,11 @@ int main(int argc, char* argv[])
 
     parser.AddSwitch("PADX", plotPaddingX);
     parser.AddSwitch("PADY",  plotPaddingY);
+    parser.AddSwitch("WARM", forestPath);
+    parser.AddSwitch("SAVE", forestOutputPath);
+    parser.AddSwitch("LEAN", leanSwitch);
+    parser.AddSwitch("CHECKPOINT", checkpointPath);
+    parser.AddSwitch("EXTRA", extraTreesSwitch);
     parser.AddSwitch("VERBOSE", verboseSwitch);
 
     // We also override default values for command line options
@@ -197,6 +579,8 @@ int main(int argc, char* argv[])
     parameters.NumberOfCandidateThresholdsPerFeature = L.Value;
     parameters.NumberOfTrees = T.Value;
     parameters.Verbose = verboseSwitch.Used();
+    parameters.ExtremelyRandomized = extraTreesSwitch.Used();
+    parameters.CheckpointPath = checkpointPath.Value;
 
     // Load training data for a 2D density estimation problem.
     std::auto_ptr<DataPointCollection> trainingData = std::auto_ptr<DataPointCollection>(LoadTrainingData(
@@ -209,7 +593,10 @@ int main(int argc, char* argv[])
       return 0; // LoadTrainingData() generates its own progress/error messages
 
     std::auto_ptr<Forest<AxisAlignedFeatureResponse, GaussianAggregator2d> > forest = std::auto_ptr<Forest<AxisAlignedFeatureResponse, GaussianAggregator2d> >(
-      DensityEstimationExample::Train(*trainingData, parameters, a.Value, b.Value) );
+      DensityEstimationExample::Train(*trainingData, parameters, a.Value, b.Value, forestPath.Value) );
+
+    if (forestOutputPath.Used())
+      forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
 
     PointF plotDilation(plotPaddingX.Value, plotPaddingY.Value);
 
@@ -246,6 +633,10 @@ int main(int argc, char* argv[])
 
     parser.AddSwitch("PADX", plotPaddingX);
     parser.AddSwitch("PADY",  plotPaddingY);
+    parser.AddSwitch("SAVE", forestOutputPath);
+    parser.AddSwitch("LEAN", leanSwitch);
+    parser.AddSwitch("CHECKPOINT", checkpointPath);
+    parser.AddSwitch("EXTRA", extraTreesSwitch);
     parser.AddSwitch("VERBOSE", verboseSwitch);
 
     // Override default values for command line options
@@ -280,10 +671,15 @@ int main(int argc, char* argv[])
     parameters.NumberOfCandidateThresholdsPerFeature = L.Value;
     parameters.NumberOfTrees = T.Value;
     parameters.Verbose = verboseSwitch.Used();
+    parameters.ExtremelyRandomized = extraTreesSwitch.Used();
+    parameters.CheckpointPath = checkpointPath.Value;
 
     std::auto_ptr<Forest<LinearFeatureResponse2d, SemiSupervisedClassificationStatisticsAggregator> > forest
       = SemiSupervisedClassificationExample::Train(*trainingData, parameters, a.Value, b.Value );
 
+    if (forestOutputPath.Used())
+      forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
     PointF plotPadding(plotPaddingX.Value, plotPaddingY.Value);
 
     if(plotMode.Value=="labels")
@@ -316,6 +712,12 @@ int main(int argc, char* argv[])
 
     parser.AddSwitch("PADX", plotPaddingX);
     parser.AddSwitch("PADY",  plotPaddingY);
+    parser.AddSwitch("WARM", forestPath);
+    parser.AddSwitch("SAVE", forestOutputPath);
+    parser.AddSwitch("LEAN", leanSwitch);
+    parser.AddSwitch("CHECKPOINT", checkpointPath);
+    parser.AddSwitch("EXTRA", extraTreesSwitch);
+    parser.AddSwitch("BOOST", boostShrinkage);
     parser.AddSwitch("VERBOSE", verboseSwitch);
 
     // Override defaults
@@ -340,6 +742,8 @@ int main(int argc, char* argv[])
     parameters.NumberOfCandidateThresholdsPerFeature = L.Value;
     parameters.NumberOfTrees = T.Value;
     parameters.Verbose = verboseSwitch.Used();
+    parameters.ExtremelyRandomized = extraTreesSwitch.Used();
+    parameters.CheckpointPath = checkpointPath.Value;
 
     // Load training data for a 2D density estimation problem.
     std::auto_ptr<DataPointCollection> trainingData = std::auto_ptr<DataPointCollection>(LoadTrainingData(
@@ -351,8 +755,30 @@ int main(int argc, char* argv[])
     if (trainingData.get()==0)
       return 0; // LoadTrainingData() generates its own progress/error messages
 
+    if (boostShrinkage.Used())
+    {
+      BoostingParameters boostingParameters;
+      boostingParameters.Shrinkage = boostShrinkage.Value;
+
+      std::auto_ptr<Forest<AxisAlignedFeatureResponse, GradientStatistics> > forest = RegressionExample::TrainBoosted(
+        *trainingData.get(), parameters, boostingParameters);
+
+      if (forestOutputPath.Used())
+        forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+      PointF plotDilation(plotPaddingX.Value, plotPaddingY.Value);
+      std::auto_ptr<Bitmap<PixelBgr> > result = RegressionExample::VisualizeBoosted(*forest.get(), *trainingData.get(), Size(300,300), plotDilation);
+
+      std::cout << "\nSaving output image to result.dib" << std::endl;
+      result->Save("result.dib");
+      return 0;
+    }
+
     std::auto_ptr<Forest<AxisAlignedFeatureResponse, LinearFitAggregator1d> > forest = RegressionExample::Train(
-      *trainingData.get(), parameters);
+      *trainingData.get(), parameters, forestPath.Value);
+
+    if (forestOutputPath.Used())
+      forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
 
     PointF plotDilation(plotPaddingX.Value, plotPaddingY.Value);
     std::auto_ptr<Bitmap<PixelBgr> > result = RegressionExample::Visualize(*forest.get(), *trainingData.get(), Size(300,300), plotDilation);
@@ -360,6 +786,290 @@ int main(int argc, char* argv[])
     std::cout << "\nSaving output image to result.dib" << std::endl;
     result->Save("result.dib");
   }
+  else if (mode == "coordinator")
+  {
+    // Supervised classification, with training data held by worker processes
+    CommandLineParser parser;
+    parser.SetCommand("SW COORDINATOR");
+
+    parser.AddArgument(trainingDataPath);
+    parser.AddArgument(socketAddress);
+    parser.AddSwitch("WORKERS", workerCount);
+    parser.AddSwitch("T", T);
+    parser.AddSwitch("D", D);
+    parser.AddSwitch("F", F);
+    parser.AddSwitch("L", L);
+
+    parser.AddSwitch("split", split);
+
+    parser.AddSwitch("PADX", plotPaddingX);
+    parser.AddSwitch("PADY",  plotPaddingY);
+    parser.AddSwitch("SAVE", forestOutputPath);
+    parser.AddSwitch("LEAN", leanSwitch);
+    parser.AddSwitch("EXTRA", extraTreesSwitch);
+    parser.AddSwitch("COST", costPenalty);
+    parser.AddSwitch("VERBOSE", verboseSwitch);
+
+    if (argc == 2)
+    {
+      parser.PrintHelp();
+      std::cout << "The training data is used only to determine the number of classes and to plot results. Workers must be started separately using SW WORKER." << std::endl;
+      return 0;
+    }
+
+    if (parser.Parse(argc, argv, 2) == false)
+      return 0;
+
+    TrainingParameters trainingParameters;
+    trainingParameters.MaxDecisionLevels = D.Value-1;
+    trainingParameters.NumberOfCandidateFeatures = F.Value;
+    trainingParameters.NumberOfCandidateThresholdsPerFeature = L.Value;
+    trainingParameters.NumberOfTrees = T.Value;
+    trainingParameters.Verbose = verboseSwitch.Used();
+    trainingParameters.ExtremelyRandomized = extraTreesSwitch.Used();
+    if (costPenalty.Used())
+    {
+      trainingParameters.CostMode = SplitCostMode::PenalizedGain;
+      trainingParameters.CostPenalty = costPenalty.Value;
+    }
+
+    PointF plotDilation(plotPaddingX.Value, plotPaddingY.Value);
+
+    std::auto_ptr<DataPointCollection> trainingData = std::auto_ptr<DataPointCollection> ( LoadTrainingData(
+      trainingDataPath.Value,
+      CLAS_DATA_PATH + "/" + trainingDataPath.Value,
+      2,
+      DataDescriptor::HasClassLabels ) );
+
+    if (trainingData.get()==0)
+      return 0; // LoadTrainingData() generates its own progress/error messages
+
+    std::vector<SocketChannel*> workers;
+    try
+    {
+      SocketListener listener(socketAddress.Value);
+
+      std::cout << "Waiting for " << workerCount.Value << " workers to connect to " << socketAddress.Value << "..." << std::endl;
+      for (int w = 0; w < workerCount.Value; w++)
+        workers.push_back(listener.Accept().release());
+
+      std::vector<IMessageChannel*> channels(workers.begin(), workers.end());
+
+      if (split.Value == "linear")
+      {
+        LinearFeatureFactory linearFeatureFactory;
+
+        std::auto_ptr<Forest<LinearFeatureResponse2d, HistogramAggregator> > forest = ClassificationDemo<LinearFeatureResponse2d>::TrainDistributed(
+          trainingData->CountClasses(),
+          &linearFeatureFactory,
+          trainingParameters,
+          channels);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<LinearFeatureResponse2d>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+      }
+      else if (split.Value == "axis")
+      {
+        AxisAlignedFeatureResponseFactory axisAlignedFeatureFactory;
+
+        std::auto_ptr<Forest<AxisAlignedFeatureResponse, HistogramAggregator> > forest = ClassificationDemo<AxisAlignedFeatureResponse>::TrainDistributed(
+          trainingData->CountClasses(),
+          &axisAlignedFeatureFactory,
+          trainingParameters,
+          channels);
+
+        if (forestOutputPath.Used())
+          forest->Serialize(forestOutputPath.Value, leanSwitch.Used());
+
+        std::auto_ptr<Bitmap<PixelBgr> > result = std::auto_ptr<Bitmap<PixelBgr> >(
+          ClassificationDemo<AxisAlignedFeatureResponse>::Visualize(*forest, *trainingData, Size(300, 300), plotDilation));
+
+        std::cout << "\nSaving output image to result.dib" << std::endl;
+        result->Save("result.dib");
+      }
+    }
+    catch (std::runtime_error& e)
+    {
+      std::cout << "Distributed training failed. " << e.what() << std::endl;
+    }
+
+    for (unsigned int w = 0; w < workers.size(); w++)
+      delete workers[w];
+  }
+  else if (mode == "worker")
+  {
+    // Serve a shard of the training data to a coordinator
+    CommandLineParser parser;
+    parser.SetCommand("SW WORKER");
+
+    parser.AddArgument(trainingDataPath);
+    parser.AddArgument(socketAddress);
+    parser.AddSwitch("SHARD", shardIndex);
+    parser.AddSwitch("SHARDS", shardCount);
+
+    parser.AddSwitch("split", split);
+
+    if (argc == 2)
+    {
+      parser.PrintHelp();
+      std::cout << "The worker holds every n-th data point in the training data file, starting with the k-th. The split function must match the coordinator's." << std::endl;
+      DisplayTextFiles(CLAS_DATA_PATH);
+      return 0;
+    }
+
+    if (parser.Parse(argc, argv, 2) == false)
+      return 0;
+
+    if (shardIndex.Value > shardCount.Value)
+    {
+      std::cout << "Shard index must not exceed the number of shards." << std::endl;
+      return 0;
+    }
+
+    std::auto_ptr<DataPointCollection> trainingData = std::auto_ptr<DataPointCollection> ( LoadTrainingData(
+      trainingDataPath.Value,
+      CLAS_DATA_PATH + "/" + trainingDataPath.Value,
+      2,
+      DataDescriptor::HasClassLabels ) );
+
+    if (trainingData.get()==0)
+      return 0; // LoadTrainingData() generates its own progress/error messages
+
+    std::vector<unsigned int> shard;
+    for (unsigned int i = shardIndex.Value - 1; i < trainingData->Count(); i += shardCount.Value)
+      shard.push_back(i);
+
+    try
+    {
+      std::cout << "Connecting to coordinator at " << socketAddress.Value << "..." << std::endl;
+      std::auto_ptr<SocketChannel> coordinator = SocketChannel::Connect(socketAddress.Value);
+
+      if (split.Value == "linear")
+      {
+        LinearFeatureFactory linearFeatureFactory;
+        ClassificationDemo<LinearFeatureResponse2d>::ServeDistributed(*trainingData, shard, &linearFeatureFactory, *coordinator);
+      }
+      else if (split.Value == "axis")
+      {
+        AxisAlignedFeatureResponseFactory axisAlignedFeatureFactory;
+        ClassificationDemo<AxisAlignedFeatureResponse>::ServeDistributed(*trainingData, shard, &axisAlignedFeatureFactory, *coordinator);
+      }
+    }
+    catch (std::runtime_error& e)
+    {
+      std::cout << "Distributed training failed. " << e.what() << std::endl;
+    }
+  }
+  else if (mode == "sweep")
+  {
+    // Search over training parameters, training concurrently on one copy of the data
+    EnumParameter problem(
+      "problem",
+      "The kind of problem.",
+      "clas;density",
+      "supervised 2D classification (scored by validation accuracy);2D density estimation (scored by mean validation log density)");
+    StringParameter sweepT("list", "Comma-separated list of numbers of trees (default = {0}).", "10");
+    StringParameter sweepD("list", "Comma-separated list of maximum tree levels (default = {0}).", "10");
+    StringParameter sweepF("list", "Comma-separated list of numbers of candidate features (default = {0}).", "10");
+    StringParameter sweepL("list", "Comma-separated list of numbers of candidate thresholds (default = {0}).", "1");
+    StringParameter sweepA("list", "Comma-separated list of density estimation prior observation counts (default = {0}).", "0");
+    StringParameter sweepB("list", "Comma-separated list of density estimation prior variances (default = {0}).", "900");
+    NaturalParameter sampleCount("n", "Evaluate n configurations drawn at random from the grid, rather than all of them.", 10);
+    SingleParameter validationFraction("fraction", "Fraction of the data held out for validation (default = {0}).", true, true, 0.25f);
+    NaturalParameter foldCount("k", "Score configurations by k-fold cross-validation instead of a single validation split (default = {0}).", 5);
+
+    CommandLineParser parser;
+    parser.SetCommand("SW SWEEP");
+
+    parser.AddArgument(problem);
+    parser.AddArgument(trainingDataPath);
+    parser.AddSwitch("T", sweepT);
+    parser.AddSwitch("D", sweepD);
+    parser.AddSwitch("F", sweepF);
+    parser.AddSwitch("L", sweepL);
+    parser.AddSwitch("a", sweepA);
+    parser.AddSwitch("b", sweepB);
+    parser.AddSwitch("split", split);
+    parser.AddSwitch("EXTRA", extraTreesSwitch);
+    parser.AddSwitch("RANDOM", sampleCount);
+    parser.AddSwitch("VALIDATION", validationFraction);
+    parser.AddSwitch("FOLDS", foldCount);
+    parser.AddSwitch("THREADS", threadCount);
+
+    threadCount.Value = omp_get_max_threads();
+
+    if (argc == 2)
+    {
+      parser.PrintHelp();
+      std::cout << "Configurations are the Cartesian product of the lists of parameter values. The a and b lists apply to density estimation only." << std::endl;
+      return 0;
+    }
+
+    if (parser.Parse(argc, argv, 2) == false)
+      return 0;
+
+    try
+    {
+      bool density = (problem.Value == "density");
+
+      std::auto_ptr<DataPointCollection> data = std::auto_ptr<DataPointCollection>(LoadTrainingData(
+        trainingDataPath.Value,
+        (density ? DENSITY_DATA_PATH : CLAS_DATA_PATH) + "/" + trainingDataPath.Value,
+        2,
+        density ? DataDescriptor::Unadorned : DataDescriptor::HasClassLabels ) );
+
+      if (data.get()==0)
+        return 0; // LoadTrainingData() generates its own progress/error messages
+
+      Random random;
+
+      std::vector<DataPointCollection> trainingData, validationData;
+      ParameterSweep::CreateFolds(*data, foldCount.Used() ? foldCount.Value : 1, validationFraction.Value, random, trainingData, validationData);
+
+      TrainingParameters base;
+      base.ExtremelyRandomized = extraTreesSwitch.Used();
+
+      std::vector<SweepConfiguration> configurations = ParameterSweep::CreateConfigurations(
+        base,
+        ParameterSweep::ParseList(sweepT.Value),
+        ParameterSweep::ParseList(sweepD.Value),
+        ParameterSweep::ParseList(sweepF.Value),
+        ParameterSweep::ParseList(sweepL.Value),
+        ParameterSweep::ParseList(density ? sweepA.Value : "0"),
+        ParameterSweep::ParseList(density ? sweepB.Value : "0"),
+        sampleCount.Used() ? sampleCount.Value : 0,
+        random );
+
+      std::cout << "Evaluating " << configurations.size() << " configurations using " << threadCount.Value << " threads ("
+        << trainingData.size() << " fold(s) of " << trainingData[0].Count() << " training and " << validationData[0].Count() << " validation data points)." << std::endl;
+
+      std::vector<SweepResult> results;
+      if (density)
+        results = ParameterSweep::SweepDensityEstimation(trainingData, validationData, configurations, threadCount.Value, random);
+      else if (split.Value == "linear")
+      {
+        LinearFeatureFactory linearFeatureFactory;
+        results = ParameterSweep::SweepClassification(trainingData, validationData, &linearFeatureFactory, configurations, threadCount.Value, random);
+      }
+      else if (split.Value == "axis")
+      {
+        AxisAlignedFeatureResponseFactory axisAlignedFeatureFactory;
+        results = ParameterSweep::SweepClassification(trainingData, validationData, &axisAlignedFeatureFactory, configurations, threadCount.Value, random);
+      }
+
+      ParameterSweep::PrintResults(std::cout, results, density ? "log density" : "accuracy", density);
+    }
+    catch (std::runtime_error& e)
+    {
+      std::cout << "Parameter sweep failed. " << e.what() << std::endl;
+    }
+  }
   else
   {
     std::cout << "Unrecognized command line argument, try SW HELP." << std::endl;
@@ -471,8 +1181,8 @@ void DisplayHelp()
   EnumParameter mode(
     "mode",
     "Select mode of operation.",
-    "clas;density;regression;ssclas",
-    "Supervised 2D classfication;2D density estimation;1D to 1D regression;Semi-supervised 2D classification");
+    "clas;density;regression;ssclas;coordinator;worker;sweep",
+    "Supervised 2D classfication;2D density estimation;1D to 1D regression;Semi-supervised 2D classification;Distributed 2D classification (coordinator);Distributed 2D classification (worker);Training parameter search");
 
   StringParameter args("args...", "Other mode-specific arguments");
 
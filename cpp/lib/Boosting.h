@@ -0,0 +1,433 @@
+#pragma once
+
+// This file defines the BoostingTrainer class, which trains gradient-boosted
+// ensembles of decision trees, together with the statistics aggregator,
+// training context and loss functions that it uses.
+
+#include <math.h>
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "TrainingParameters.h"
+
+#include "Interfaces.h"
+#include "Node.h"
+#include "Tree.h"
+#include "Forest.h"
+#include "ForestTrainer.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Parameters for gradient boosting (in addition to TrainingParameters,
+  /// whose NumberOfTrees gives the maximum number of boosting rounds).
+  /// </summary>
+  struct BoostingParameters
+  {
+    BoostingParameters()
+    {
+      Shrinkage = 0.1;
+      Lambda = 1.0;
+      MinSplitGain = 0.0;
+      EarlyStoppingRounds = 0;
+    }
+
+    // Multiplier applied to each tree's leaf outputs (the learning rate).
+    double Shrinkage;
+
+    // L2 regularization of leaf outputs.
+    double Lambda;
+
+    // Splits with (regularized) loss reduction no greater than this are
+    // not made.
+    double MinSplitGain;
+
+    // If non-zero and validation data are supplied, training stops once the
+    // validation loss has not improved for this many rounds, and the
+    // forest is truncated to the best round.
+    int EarlyStoppingRounds;
+  };
+
+  /// <summary>
+  /// Gradient and hessian sums over a set of data points, together with the
+  /// output (i.e. the additive contribution to the prediction) of the node
+  /// at which they are stored.
+  /// </summary>
+
+  // *** NB GradientStatistics refer to per-data-point gradient and hessian
+  // arrays owned by BoostingTrainer. These pointers are only valid during
+  // training and are not serialized (see the specializations of Serialize_()
+  // and Deserialize_() below).
+
+  struct GradientStatistics
+  {
+    const double* gradients_;
+    const double* hessians_;
+
+    double SumGradients;
+    double SumHessians;
+    unsigned int SampleCount;
+
+    // Output of the node: -Shrinkage * G / (H + Lambda), plus the base
+    // score for the first tree of a forest. Set by BoostingTrainer.
+    float Output;
+
+    GradientStatistics()
+    {
+      gradients_ = hessians_ = 0;
+      Output = 0.0f;
+      Clear();
+    }
+
+    GradientStatistics(const double* gradients, const double* hessians)
+    {
+      gradients_ = gradients;
+      hessians_ = hessians;
+      Output = 0.0f;
+      Clear();
+    }
+
+    // IStatisticsAggregator implementation
+    void Clear()
+    {
+      SumGradients = SumHessians = 0.0;
+      SampleCount = 0;
+    }
+
+    void Aggregate(const IDataPointCollection& data, unsigned int index)
+    {
+      SumGradients += gradients_[index];
+      SumHessians += hessians_[index];
+      SampleCount++;
+    }
+
+    void Aggregate(const GradientStatistics& i)
+    {
+      SumGradients += i.SumGradients;
+      SumHessians += i.SumHessians;
+      SampleCount += i.SampleCount;
+    }
+
+    GradientStatistics DeepClone() const
+    {
+      return *this;
+    }
+
+    /// <summary>
+    /// The (negated, doubled) loss reduction G^2 / (H + lambda) attained by
+    /// choosing the optimal output for these data points.
+    /// </summary>
+    double Score(double lambda) const
+    {
+      return SumGradients * SumGradients / (SumHessians + lambda);
+    }
+  };
+
+  template<>
+  inline void Serialize_(std::ostream& o, const GradientStatistics& s)
+  {
+    Serialize_(o, s.SumGradients);
+    Serialize_(o, s.SumHessians);
+    Serialize_(o, s.SampleCount);
+    Serialize_(o, s.Output);
+  }
+
+  template<>
+  inline void Deserialize_(std::istream& i, GradientStatistics& s)
+  {
+    s = GradientStatistics();
+    Deserialize_(i, s.SumGradients);
+    Deserialize_(i, s.SumHessians);
+    Deserialize_(i, s.SampleCount);
+    Deserialize_(i, s.Output);
+  }
+
+  /// <summary>
+  /// A differentiable loss function, for use with BoostingTrainer.
+  /// </summary>
+  class ILossFunction
+  {
+  public:
+    virtual ~ILossFunction() {};
+
+    /// <summary>
+    /// Compute the loss for one data point.
+    /// </summary>
+    virtual double Loss(float target, double prediction) const=0;
+
+    /// <summary>
+    /// Compute the first and second derivatives of the loss with respect to
+    /// the prediction.
+    /// </summary>
+    virtual void Derivatives(float target, double prediction, double& gradient, double& hessian) const=0;
+
+    /// <summary>
+    /// The constant prediction that minimizes the loss over the specified
+    /// targets, used as the base score.
+    /// </summary>
+    virtual double BaseScore(const std::vector<float>& targets) const=0;
+  };
+
+  /// <summary>
+  /// Squared error loss, for regression.
+  /// </summary>
+  class SquaredLoss : public ILossFunction
+  {
+  public:
+    double Loss(float target, double prediction) const
+    {
+      return 0.5 * (prediction - target) * (prediction - target);
+    }
+
+    void Derivatives(float target, double prediction, double& gradient, double& hessian) const
+    {
+      gradient = prediction - target;
+      hessian = 1.0;
+    }
+
+    double BaseScore(const std::vector<float>& targets) const
+    {
+      double sum = 0.0;
+      for (unsigned int i = 0; i < targets.size(); i++)
+        sum += targets[i];
+      return targets.size() > 0 ? sum / targets.size() : 0.0;
+    }
+  };
+
+  /// <summary>
+  /// Logistic loss, for binary classification with targets 0 and 1.
+  /// Predictions are log odds.
+  /// </summary>
+  class LogisticLoss : public ILossFunction
+  {
+  public:
+    double Loss(float target, double prediction) const
+    {
+      // log(1 + exp(-y' * prediction)) with y' in {-1, +1}, computed stably
+      double z = target > 0.5f ? prediction : -prediction;
+      return z > 0.0 ? log(1.0 + exp(-z)) : -z + log(1.0 + exp(z));
+    }
+
+    void Derivatives(float target, double prediction, double& gradient, double& hessian) const
+    {
+      double p = 1.0 / (1.0 + exp(-prediction));
+      gradient = p - target;
+      hessian = std::max(p * (1.0 - p), 1e-16);
+    }
+
+    double BaseScore(const std::vector<float>& targets) const
+    {
+      double sum = 0.0;
+      for (unsigned int i = 0; i < targets.size(); i++)
+        sum += targets[i];
+      double p = targets.size() > 0 ? sum / targets.size() : 0.5;
+      p = std::min(std::max(p, 1e-6), 1.0 - 1e-6);
+      return log(p / (1.0 - p));
+    }
+  };
+
+  /// <summary>
+  /// Training context for gradient boosting. Client code derives from this
+  /// class and implements only GetRandomFeature(). Information gain is the
+  /// regularized reduction in loss due to a split.
+  /// </summary>
+  template<class F>
+  class BoostingTrainingContext : public ITrainingContext<F, GradientStatistics> // where F:IFeatureResponse
+  {
+    const double* gradients_;
+    const double* hessians_;
+
+    double lambda_;
+    double minSplitGain_;
+
+  public:
+    BoostingTrainingContext()
+    {
+      gradients_ = hessians_ = 0;
+      lambda_ = 1.0;
+      minSplitGain_ = 0.0;
+    }
+
+    // Implementation only - called by BoostingTrainer before each tree is trained
+    void SetGradients(const double* gradients, const double* hessians, const BoostingParameters& parameters)
+    {
+      gradients_ = gradients;
+      hessians_ = hessians;
+      lambda_ = parameters.Lambda;
+      minSplitGain_ = parameters.MinSplitGain;
+    }
+
+    // Implementation of ITrainingContext
+    GradientStatistics GetStatisticsAggregator()
+    {
+      return GradientStatistics(gradients_, hessians_);
+    }
+
+    double ComputeInformationGain(const GradientStatistics& parent, const GradientStatistics& leftChild, const GradientStatistics& rightChild)
+    {
+      return 0.5 * (leftChild.Score(lambda_) + rightChild.Score(lambda_) - parent.Score(lambda_));
+    }
+
+    virtual bool ShouldTerminate(const GradientStatistics& parent, const GradientStatistics& leftChild, const GradientStatistics& rightChild, double gain)
+    {
+      return gain <= minSplitGain_ || leftChild.SampleCount == 0 || rightChild.SampleCount == 0;
+    }
+  };
+
+  /// <summary>
+  /// Compute the predictions of a gradient-boosted forest, i.e. the sum over
+  /// trees of the outputs of the leaves reached.
+  /// </summary>
+  /// <param name="forest">A forest trained by BoostingTrainer.</param>
+  /// <param name="data">The data points.</param>
+  /// <param name="predictions">Receives one prediction per data point.</param>
+  template<class F>
+  void PredictAdditive(
+    const Forest<F, GradientStatistics>& forest,
+    const IDataPointCollection& data,
+    std::vector<double>& predictions )
+  {
+    predictions.assign(data.Count(), 0.0);
+
+    std::vector<int> leafNodeIndices;
+    for (int t = 0; t < forest.TreeCount(); t++)
+    {
+      forest.GetTree(t).Apply(data, leafNodeIndices);
+      for (unsigned int i = 0; i < data.Count(); i++)
+        predictions[i] += forest.GetTree(t).GetNode(leafNodeIndices[i]).TrainingDataStatistics.Output;
+    }
+  }
+
+  /// <summary>
+  /// Learns gradient-boosted forests from training data. Each tree is
+  /// trained with TreeTrainer (and so shares its split search) on the
+  /// gradients and hessians of the loss at the current predictions.
+  /// </summary>
+  template<class F>
+  class BoostingTrainer // where F:IFeatureResponse
+  {
+  public:
+    /// <summary>
+    /// Train a new gradient-boosted forest. Use PredictAdditive() to
+    /// evaluate it.
+    /// </summary>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="parameters">Training parameters. NumberOfTrees gives the
+    /// maximum number of boosting rounds and MaxDecisionLevels the depth of
+    /// each tree.</param>
+    /// <param name="boostingParameters">Boosting parameters.</param>
+    /// <param name="context">The training context.</param>
+    /// <param name="loss">The loss function.</param>
+    /// <param name="data">The training data.</param>
+    /// <param name="targets">The training targets, one per data point.</param>
+    /// <param name="validationData">Optional validation data, used for early stopping.</param>
+    /// <param name="validationTargets">Validation targets, one per validation data point.</param>
+    /// <returns>A new forest.</returns>
+    static std::auto_ptr<Forest<F, GradientStatistics> > TrainForest(
+      Random& random,
+      const TrainingParameters& parameters,
+      const BoostingParameters& boostingParameters,
+      BoostingTrainingContext<F>& context,
+      const ILossFunction& loss,
+      const IDataPointCollection& data,
+      const std::vector<float>& targets,
+      const IDataPointCollection* validationData=0,
+      const std::vector<float>* validationTargets=0,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      if (data.Count() == 0)
+        throw std::runtime_error("Can't train on an empty training set.");
+      if (targets.size() != data.Count())
+        throw std::runtime_error("There must be one training target per data point.");
+
+      bool bEarlyStopping = boostingParameters.EarlyStoppingRounds > 0 && validationData != 0;
+      if (bEarlyStopping && (validationTargets == 0 || validationTargets->size() != validationData->Count()))
+        throw std::runtime_error("There must be one validation target per validation data point.");
+
+      std::auto_ptr<Forest<F, GradientStatistics> > forest = std::auto_ptr<Forest<F, GradientStatistics> >(new Forest<F, GradientStatistics>());
+
+      double baseScore = loss.BaseScore(targets);
+
+      std::vector<double> predictions(data.Count(), baseScore);
+      std::vector<double> gradients(data.Count()), hessians(data.Count());
+
+      std::vector<double> validationPredictions(bEarlyStopping ? validationData->Count() : 0, baseScore);
+      double bestValidationLoss = std::numeric_limits<double>::infinity();
+      int bestTreeCount = 0;
+
+      std::vector<int> leafNodeIndices;
+
+      for (int t = 0; t < parameters.NumberOfTrees; t++)
+      {
+        (*progress)[Interest] << "\rTraining tree "<< t << "...";
+
+        for (unsigned int i = 0; i < data.Count(); i++)
+          loss.Derivatives(targets[i], predictions[i], gradients[i], hessians[i]);
+
+        context.SetGradients(&gradients[0], &hessians[0], boostingParameters);
+
+        std::auto_ptr<Tree<F, GradientStatistics> > tree = TreeTrainer<F, GradientStatistics>::TrainTree(random, context, parameters, data, progress);
+
+        // Set node outputs, folding the base score into the first tree
+        std::vector<Node<F, GradientStatistics> >& nodes = tree->GetNodes();
+        for (unsigned int n = 0; n < nodes.size(); n++)
+        {
+          if (nodes[n].IsNull())
+            continue;
+          GradientStatistics& s = nodes[n].TrainingDataStatistics;
+          s.gradients_ = s.hessians_ = 0;
+          s.Output = (float)(-boostingParameters.Shrinkage * s.SumGradients / (s.SumHessians + boostingParameters.Lambda) + (t == 0 ? baseScore : 0.0));
+        }
+
+        // Update predictions, removing the base score once it is part of the forest
+        tree->Apply(data, leafNodeIndices);
+        for (unsigned int i = 0; i < data.Count(); i++)
+          predictions[i] += nodes[leafNodeIndices[i]].TrainingDataStatistics.Output - (t == 0 ? baseScore : 0.0);
+
+        forest->AddTree(tree);
+
+        if (bEarlyStopping)
+        {
+          Tree<F, GradientStatistics>& added = forest->GetTree(t);
+          added.Apply(*validationData, leafNodeIndices);
+
+          double validationLoss = 0.0;
+          for (unsigned int i = 0; i < validationData->Count(); i++)
+          {
+            validationPredictions[i] += added.GetNode(leafNodeIndices[i]).TrainingDataStatistics.Output - (t == 0 ? baseScore : 0.0);
+            validationLoss += loss.Loss((*validationTargets)[i], validationPredictions[i]);
+          }
+          validationLoss /= std::max(validationData->Count(), 1u);
+
+          (*progress)[Verbose] << "Validation loss after " << t + 1 << " trees: " << validationLoss << std::endl;
+
+          if (validationLoss < bestValidationLoss)
+          {
+            bestValidationLoss = validationLoss;
+            bestTreeCount = t + 1;
+          }
+          else if (t + 1 - bestTreeCount >= boostingParameters.EarlyStoppingRounds)
+          {
+            (*progress)[Interest] << "\rStopping early, no improvement since tree " << bestTreeCount - 1 << "." << std::endl;
+            break;
+          }
+        }
+      }
+      if (bEarlyStopping && bestTreeCount < forest->TreeCount())
+        forest->Truncate(bestTreeCount);
+
+      (*progress)[Interest] << "\rTrained " << forest->TreeCount() << " trees.         " << std::endl;
+
+      return forest;
+    }
+  };
+} } }
@@ -0,0 +1,76 @@
+#pragma once
+
+// This file defines the ChooseCandidateThresholds() function, which decision
+// tree and fern trainers use to choose the thresholds at which a candidate
+// feature is evaluated.
+
+#include <vector>
+#include <algorithm>
+
+#include "Random.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Choose candidate thresholds for a feature by sampling in between
+  /// approximate quantiles of its responses. A random draw of
+  /// maxThresholds+1 response values (or all of them, if there are no more
+  /// than that) is sorted, and a threshold is drawn uniformly between each
+  /// adjacent pair.
+  /// </summary>
+  /// <param name="random">Random number generator.</param>
+  /// <param name="responses">The responses, as responses[i] for i in [i0,
+  /// i1), e.g. a std::vector<float> or a function object that computes
+  /// them on demand.</param>
+  /// <param name="i0">The index of the first response.</param>
+  /// <param name="i1">One more than the index of the last response.</param>
+  /// <param name="maxThresholds">The maximum number of thresholds, e.g.
+  /// TrainingParameters::NumberOfCandidateThresholdsPerFeature.</param>
+  /// <param name="thresholds">Receives the thresholds in ascending order
+  /// (its memory is reused for the sampled responses).</param>
+  /// <returns>The number of thresholds, or zero if the sampled responses
+  /// were all the same.</returns>
+  template<class R>
+  int ChooseCandidateThresholds(
+    Random& random,
+    const R& responses,
+    unsigned int i0,
+    unsigned int i1,
+    unsigned int maxThresholds,
+    std::vector<float>& thresholds )
+  {
+    thresholds.resize(maxThresholds + 1);
+    std::vector<float>& quantiles = thresholds; // shorthand, for code clarity - we reuse memory to avoid allocation
+
+    int nThresholds;
+    // If there are enough response values...
+    if (i1 - i0 > maxThresholds)
+    {
+      // ...make a random draw of maxThresholds+1 response values
+      nThresholds = maxThresholds;
+      for (int i = 0; i < nThresholds + 1; i++)
+        quantiles[i] = responses[random.Next(i0, i1)]; // sample randomly from all responses
+    }
+    else
+    {
+      // ...otherwise use all response values.
+      nThresholds = (int)(i1 - i0) - 1;
+      if (nThresholds <= 0)
+        return 0;
+      for (unsigned int i = i0; i < i1; i++)
+        quantiles[i - i0] = responses[i];
+    }
+
+    // Sort the response values to form approximate quantiles.
+    std::sort(quantiles.begin(), quantiles.begin() + nThresholds + 1);
+
+    if (quantiles[0] == quantiles[nThresholds])
+      return 0;   // all sampled response values were the same
+
+    // Compute n candidate thresholds by sampling in between n+1 approximate quantiles
+    for (int i = 0; i < nThresholds; i++)
+      thresholds[i] = quantiles[i] + (float)(random.NextDouble() * (quantiles[i + 1] - quantiles[i]));
+
+    return nThresholds;
+  }
+} } }
@@ -0,0 +1,657 @@
+#pragma once
+
+// This file defines the DistributedForestTrainer and DistributedTrainingWorker
+// classes, which train decision forests on data that is sharded over several
+// worker processes (possibly on different machines). Workers compute
+// statistics over their own shard of the data for the candidate features and
+// thresholds chosen by a coordinator; the coordinator merges these using
+// IStatisticsAggregator::Aggregate(const S&) and chooses splits.
+
+#include <assert.h>
+#include <string.h>
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "TrainingParameters.h"
+#include "FeatureCost.h"
+
+#include "Interfaces.h"
+#include "Random.h"
+#include "Node.h"
+#include "Tree.h"
+#include "Forest.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// A reliable, ordered, bidirectional channel for exchanging messages
+  /// between a distributed training coordinator and one of its workers, e.g.
+  /// over a socket. Implementations are responsible for message framing and
+  /// should throw std::runtime_error if communication fails.
+  /// </summary>
+  class IMessageChannel
+  {
+  public:
+    virtual ~IMessageChannel() { }
+
+    /// <summary>
+    /// Send a message.
+    /// </summary>
+    /// <param name="message">The message (arbitrary binary data).</param>
+    virtual void Send(const std::string& message) = 0;
+
+    /// <summary>
+    /// Block until a complete message has been received.
+    /// </summary>
+    /// <param name="message">The message received.</param>
+    virtual void Receive(std::string& message) = 0;
+  };
+
+  // Message types and version information shared by the coordinator and
+  // workers - used internally by DistributedForestTrainer and
+  // DistributedTrainingWorker.
+  class DistributedTrainingProtocol
+  {
+  public:
+    enum e
+    {
+      Hello = 0x1,            // header, version -> worker sample count
+      BeginTree = 0x2,
+      ResponseRanges = 0x3,   // node, features -> parent statistics, sample count, response range per feature
+      PartitionStatistics = 0x4,  // node, thresholds per feature -> statistics per feature and partition
+      SplitNode = 0x5,        // node, feature, threshold, left child node
+      EndTraining = 0x6
+    };
+
+    static const char* Header() { return "MicrosoftResearch.Cambridge.Sherwood.DistributedTraining"; }
+
+    static const int MajorVersion = 0, MinorVersion = 2;
+
+    static int ReadCommand(std::istream& i)
+    {
+      int command;
+      Deserialize_(i, command);
+      if (i.fail())
+        throw std::runtime_error("Malformed distributed training message.");
+      return command;
+    }
+  };
+
+  /// <summary>
+  /// Serves requests from a DistributedForestTrainer, computing statistics
+  /// over a shard of the training data.
+  /// </summary>
+  template<class F, class S>
+  class DistributedTrainingWorker // where F : IFeatureResponse where S : IStatisticsAggregator<S>
+  {
+    typedef typename std::vector<unsigned int>::size_type DataPointIndex;
+
+    ITrainingContext<F, S>& trainingContext_;
+    const IDataPointCollection& data_;
+
+    std::vector<unsigned int> shard_;     // indices of the data points held by this worker
+
+    std::vector<unsigned int> indices_;
+    std::vector<float> responses_;
+    std::vector<DataPointIndex> nodeRanges_;  // [i0, i1) per node, for nodes reached so far
+
+    std::vector<F> features_;   // candidate features for the current node
+
+  public:
+    /// <summary>
+    /// Create a worker holding all the data points in a collection.
+    /// </summary>
+    /// <param name="context">The training context. NB Only
+    /// GetStatisticsAggregator() is used, but this must be compatible with
+    /// the coordinator's training context.</param>
+    /// <param name="data">The data points.</param>
+    DistributedTrainingWorker(ITrainingContext<F, S>& context, const IDataPointCollection& data):
+      trainingContext_(context),
+      data_(data)
+    {
+      shard_.resize(data.Count());
+      for (unsigned int i = 0; i < data.Count(); i++)
+        shard_[i] = i;
+    }
+
+    /// <summary>
+    /// Create a worker holding a subset of the data points in a collection.
+    /// </summary>
+    /// <param name="context">The training context.</param>
+    /// <param name="data">The data point collection.</param>
+    /// <param name="shard">The indices of the data points held.</param>
+    DistributedTrainingWorker(ITrainingContext<F, S>& context, const IDataPointCollection& data, const std::vector<unsigned int>& shard):
+      trainingContext_(context),
+      data_(data),
+      shard_(shard)
+    {
+    }
+
+    /// <summary>
+    /// Serve requests from the coordinator until training is complete.
+    /// </summary>
+    /// <param name="channel">The channel connected to the coordinator.</param>
+    void Serve(IMessageChannel& channel)
+    {
+      std::string request;
+      for (;;)
+      {
+        channel.Receive(request);
+        std::istringstream i(request);
+        std::ostringstream o;
+
+        int command = DistributedTrainingProtocol::ReadCommand(i);
+        switch (command)
+        {
+        case DistributedTrainingProtocol::Hello:
+          ReadHello(i);
+          Serialize_(o, (unsigned int)(shard_.size()));
+          channel.Send(o.str());
+          break;
+        case DistributedTrainingProtocol::BeginTree:
+          BeginTree();
+          break;
+        case DistributedTrainingProtocol::ResponseRanges:
+          ComputeResponseRanges(i, o);
+          channel.Send(o.str());
+          break;
+        case DistributedTrainingProtocol::PartitionStatistics:
+          ComputePartitionStatistics(i, o);
+          channel.Send(o.str());
+          break;
+        case DistributedTrainingProtocol::SplitNode:
+          SplitNode(i);
+          break;
+        case DistributedTrainingProtocol::EndTraining:
+          return;
+        default:
+          throw std::runtime_error("Unrecognized distributed training message.");
+        }
+      }
+    }
+
+  private:
+    void ReadHello(std::istream& i)
+    {
+      const char* header = DistributedTrainingProtocol::Header();
+      std::vector<char> buffer(strlen(header)+1);
+      i.read(&buffer[0], strlen(header));
+      buffer[buffer.size()-1] = '\0';
+
+      if(strcmp(&buffer[0], header)!=0)
+        throw std::runtime_error("Unsupported distributed training protocol.");
+
+      int majorVersion = 0, minorVersion = 0;
+      Deserialize_(i, majorVersion);
+      Deserialize_(i, minorVersion);
+
+      if (majorVersion != DistributedTrainingProtocol::MajorVersion || minorVersion != DistributedTrainingProtocol::MinorVersion)
+        throw std::runtime_error("Unsupported distributed training protocol version number.");
+    }
+
+    void BeginTree()
+    {
+      indices_ = shard_;
+      responses_.resize(indices_.size());
+
+      nodeRanges_.assign(2, 0);
+      nodeRanges_[0] = 0;
+      nodeRanges_[1] = indices_.size();
+    }
+
+    void ComputeResponseRanges(std::istream& i, std::ostream& o)
+    {
+      int nodeIndex, featureCount;
+      Deserialize_(i, nodeIndex);
+      Deserialize_(i, featureCount);
+
+      features_.resize(featureCount);
+      for (int f = 0; f < featureCount; f++)
+        Deserialize_(i, features_[f]);
+
+      DataPointIndex i0 = nodeRanges_[2 * nodeIndex], i1 = nodeRanges_[2 * nodeIndex + 1];
+
+      S parentStatistics = trainingContext_.GetStatisticsAggregator();
+      for (DataPointIndex j = i0; j < i1; j++)
+        parentStatistics.Aggregate(data_, indices_[j]);
+      Serialize_(o, parentStatistics);
+      Serialize_(o, (unsigned int)(i1 - i0));
+
+      for (int f = 0; f < featureCount; f++)
+      {
+        float minResponse = std::numeric_limits<float>::infinity();
+        float maxResponse = -std::numeric_limits<float>::infinity();
+        for (DataPointIndex j = i0; j < i1; j++)
+        {
+          float response = features_[f].GetResponse(data_, indices_[j]);
+          minResponse = std::min(minResponse, response);
+          maxResponse = std::max(maxResponse, response);
+        }
+        Serialize_(o, minResponse);
+        Serialize_(o, maxResponse);
+      }
+    }
+
+    void ComputePartitionStatistics(std::istream& i, std::ostream& o)
+    {
+      int nodeIndex;
+      Deserialize_(i, nodeIndex);
+
+      DataPointIndex i0 = nodeRanges_[2 * nodeIndex], i1 = nodeRanges_[2 * nodeIndex + 1];
+
+      std::vector<float> thresholds;
+      std::vector<S> partitionStatistics;
+      for (unsigned int f = 0; f < features_.size(); f++)
+      {
+        int nThresholds;
+        Deserialize_(i, nThresholds);
+        thresholds.resize(nThresholds);
+        for (int t = 0; t < nThresholds; t++)
+          Deserialize_(i, thresholds[t]);
+
+        partitionStatistics.assign(nThresholds + 1, trainingContext_.GetStatisticsAggregator());
+
+        for (DataPointIndex j = i0; j < i1; j++)
+        {
+          float response = features_[f].GetResponse(data_, indices_[j]);
+
+          int b = 0;
+          while (b < nThresholds && response >= thresholds[b])
+            b++;
+
+          partitionStatistics[b].Aggregate(data_, indices_[j]);
+        }
+
+        for (int b = 0; b < nThresholds + 1; b++)
+          Serialize_(o, partitionStatistics[b]);
+      }
+    }
+
+    void SplitNode(std::istream& i)
+    {
+      int nodeIndex, leftChildIndex;
+      F feature;
+      float threshold;
+      Deserialize_(i, nodeIndex);
+      Deserialize_(i, feature);
+      Deserialize_(i, threshold);
+      Deserialize_(i, leftChildIndex);
+
+      DataPointIndex i0 = nodeRanges_[2 * nodeIndex], i1 = nodeRanges_[2 * nodeIndex + 1];
+
+      DataPointIndex ii = i0;
+      if (i1 > i0)
+      {
+        for (DataPointIndex j = i0; j < i1; j++)
+          responses_[j] = feature.GetResponse(data_, indices_[j]);
+        ii = Tree<F, S>::Partition(responses_, indices_, i0, i1, threshold);
+      }
+
+      if (nodeRanges_.size() < 2 * ((DataPointIndex)(leftChildIndex) + 2))
+        nodeRanges_.resize(2 * ((DataPointIndex)(leftChildIndex) + 2), 0);
+
+      nodeRanges_[2 * leftChildIndex] = i0;
+      nodeRanges_[2 * leftChildIndex + 1] = ii;
+      nodeRanges_[2 * (leftChildIndex + 1)] = ii;
+      nodeRanges_[2 * (leftChildIndex + 1) + 1] = i1;
+    }
+  };
+
+  /// <summary>
+  /// Trains a single tree on data held by distributed workers - used
+  /// internally by DistributedForestTrainer.
+  /// </summary>
+  template<class F, class S>
+  class DistributedTreeTrainingOperation // where F : IFeatureResponse where S : IStatisticsAggregator<S>
+  {
+    typedef typename std::vector<Node<F,S> >::size_type NodeIndex;
+
+    Random& random_;
+
+    ITrainingContext<F, S>& trainingContext_;
+
+    TrainingParameters parameters_;
+
+    const std::vector<IMessageChannel*>& workers_;
+    unsigned int totalCount_;
+
+    ProgressStream& progress_;
+
+    S parentStatistics_, leftChildStatistics_, rightChildStatistics_;
+
+    unsigned int sampleCount_;   // at the current node, summed over workers
+    std::vector<F> features_;
+    std::vector<float> minResponses_, maxResponses_;
+    std::vector<std::vector<float> > thresholds_;
+    std::vector<std::vector<S> > partitionStatistics_;   // per feature, merged over workers
+
+  public:
+    DistributedTreeTrainingOperation(
+      Random& random,
+      ITrainingContext<F, S>& trainingContext,
+      const TrainingParameters& parameters,
+      const std::vector<IMessageChannel*>& workers,
+      unsigned int totalCount,
+      ProgressStream& progress):
+    random_(random),
+      trainingContext_(trainingContext),
+      workers_(workers),
+      totalCount_(totalCount),
+      progress_(progress)
+    {
+      parameters_ = parameters;
+
+      parentStatistics_ = trainingContext_.GetStatisticsAggregator();
+      leftChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+      rightChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+    }
+
+    void TrainNodesRecurse(std::vector<Node<F, S> >& nodes, NodeIndex nodeIndex, int recurseDepth)
+    {
+      assert(nodeIndex < nodes.size());
+      progress_[Verbose] << Tree<F, S>::GetPrettyPrintPrefix(nodes, nodeIndex);
+
+      bool isLeaf = recurseDepth >= parameters_.MaxDecisionLevels;
+
+      // Aggregate statistics over the samples at the parent node, and (unless
+      // the node is at maximum depth) candidate feature response ranges
+      features_.resize(isLeaf ? 0 : parameters_.NumberOfCandidateFeatures);
+      for (unsigned int f = 0; f < features_.size(); f++)
+        features_[f] = trainingContext_.GetRandomFeature(random_);
+
+      RequestResponseRanges(nodeIndex);
+
+      if (isLeaf) // this is a leaf node, nothing else to do
+      {
+        nodes[nodeIndex].InitializeLeaf(parentStatistics_);
+        progress_[Verbose] << "Terminating at max depth." << std::endl;
+        return;
+      }
+
+      ChooseCandidateThresholds();
+
+      RequestPartitionStatistics(nodeIndex);
+
+      double maxGain = 0.0, maxScore = 0.0;
+      double sampleFraction = (double)(sampleCount_) / totalCount_;
+      int bestFeature = -1;
+      float bestThreshold = 0.0f;
+      int bestPartition = 0;
+
+      for (unsigned int f = 0; f < features_.size(); f++)
+      {
+        int nThresholds = thresholds_[f].size();
+        for (int t = 0; t < nThresholds; t++)
+        {
+          Partition(f, t);
+
+          double gain = trainingContext_.ComputeInformationGain(parentStatistics_, leftChildStatistics_, rightChildStatistics_);
+          double score = ComputeSplitScore(parameters_, gain, features_[f], sampleFraction);
+
+          if (score >= maxScore)
+          {
+            maxScore = score;
+            maxGain = gain;
+            bestFeature = f;
+            bestThreshold = thresholds_[f][t];
+            bestPartition = t;
+          }
+        }
+      }
+
+      if (maxGain == 0.0 || bestFeature < 0)
+      {
+        nodes[nodeIndex].InitializeLeaf(parentStatistics_);
+        progress_[Verbose] << "Terminating with zero gain." << std::endl;
+        return;
+      }
+
+      // Child statistics are given exactly by the merged partition statistics
+      Partition(bestFeature, bestPartition);
+
+      if (trainingContext_.ShouldTerminate(parentStatistics_, leftChildStatistics_, rightChildStatistics_, maxGain))
+      {
+        nodes[nodeIndex].InitializeLeaf(parentStatistics_);
+        progress_[Verbose] << "Terminating with no split." << std::endl;
+        return;
+      }
+
+      // Otherwise this is a new decision node, tell the workers and recurse for children.
+      NodeIndex leftChildIndex = Tree<F, S>::InitializeSplit(nodes, nodeIndex, features_[bestFeature], bestThreshold, parentStatistics_);
+
+      std::ostringstream o;
+      Serialize_(o, (int)(DistributedTrainingProtocol::SplitNode));
+      Serialize_(o, (int)(nodeIndex));
+      Serialize_(o, features_[bestFeature]);
+      Serialize_(o, bestThreshold);
+      Serialize_(o, (int)(leftChildIndex));
+      Broadcast(o.str());
+
+      progress_[Verbose] << " (threshold = " << bestThreshold << ", gain = "<< maxGain << ")." << std::endl;
+
+      TrainNodesRecurse(nodes, leftChildIndex, recurseDepth + 1);
+      TrainNodesRecurse(nodes, leftChildIndex + 1, recurseDepth + 1);
+    }
+
+  private:
+    void Broadcast(const std::string& message)
+    {
+      for (unsigned int w = 0; w < workers_.size(); w++)
+        workers_[w]->Send(message);
+    }
+
+    void RequestResponseRanges(NodeIndex nodeIndex)
+    {
+      std::ostringstream o;
+      Serialize_(o, (int)(DistributedTrainingProtocol::ResponseRanges));
+      Serialize_(o, (int)(nodeIndex));
+      Serialize_(o, (int)(features_.size()));
+      for (unsigned int f = 0; f < features_.size(); f++)
+        Serialize_(o, features_[f]);
+      Broadcast(o.str());
+
+      parentStatistics_.Clear();
+      sampleCount_ = 0;
+      minResponses_.assign(features_.size(), std::numeric_limits<float>::infinity());
+      maxResponses_.assign(features_.size(), -std::numeric_limits<float>::infinity());
+
+      S statistics = trainingContext_.GetStatisticsAggregator();
+      std::string reply;
+      for (unsigned int w = 0; w < workers_.size(); w++)
+      {
+        workers_[w]->Receive(reply);
+        std::istringstream i(reply);
+
+        Deserialize_(i, statistics);
+        parentStatistics_.Aggregate(statistics);
+
+        unsigned int count;
+        Deserialize_(i, count);
+        sampleCount_ += count;
+
+        for (unsigned int f = 0; f < features_.size(); f++)
+        {
+          float minResponse, maxResponse;
+          Deserialize_(i, minResponse);
+          Deserialize_(i, maxResponse);
+          minResponses_[f] = std::min(minResponses_[f], minResponse);
+          maxResponses_[f] = std::max(maxResponses_[f], maxResponse);
+        }
+
+        if (i.fail())
+          throw std::runtime_error("Malformed distributed training message.");
+      }
+    }
+
+    // Choose thresholds uniformly at random within the response range of
+    // each candidate feature. (Unlike TreeTrainingOperation, the coordinator
+    // never sees individual responses so can't sample approximate quantiles.)
+    void ChooseCandidateThresholds()
+    {
+      int nThresholds = parameters_.ExtremelyRandomized ? 1 : parameters_.NumberOfCandidateThresholdsPerFeature;
+
+      thresholds_.resize(features_.size());
+      for (unsigned int f = 0; f < features_.size(); f++)
+      {
+        thresholds_[f].clear();
+        if (!(maxResponses_[f] > minResponses_[f]))
+          continue;   // no samples, or all response values were the same
+
+        for (int t = 0; t < nThresholds; t++)
+          thresholds_[f].push_back(minResponses_[f] + (float)(random_.NextDouble() * (maxResponses_[f] - minResponses_[f])));
+        std::sort(thresholds_[f].begin(), thresholds_[f].end());
+      }
+    }
+
+    void RequestPartitionStatistics(NodeIndex nodeIndex)
+    {
+      std::ostringstream o;
+      Serialize_(o, (int)(DistributedTrainingProtocol::PartitionStatistics));
+      Serialize_(o, (int)(nodeIndex));
+      for (unsigned int f = 0; f < features_.size(); f++)
+      {
+        Serialize_(o, (int)(thresholds_[f].size()));
+        for (unsigned int t = 0; t < thresholds_[f].size(); t++)
+          Serialize_(o, thresholds_[f][t]);
+      }
+      Broadcast(o.str());
+
+      partitionStatistics_.resize(features_.size());
+      for (unsigned int f = 0; f < features_.size(); f++)
+        partitionStatistics_[f].assign(thresholds_[f].size() + 1, trainingContext_.GetStatisticsAggregator());
+
+      S statistics = trainingContext_.GetStatisticsAggregator();
+      std::string reply;
+      for (unsigned int w = 0; w < workers_.size(); w++)
+      {
+        workers_[w]->Receive(reply);
+        std::istringstream i(reply);
+
+        for (unsigned int f = 0; f < features_.size(); f++)
+        {
+          for (unsigned int b = 0; b < partitionStatistics_[f].size(); b++)
+          {
+            Deserialize_(i, statistics);
+            partitionStatistics_[f][b].Aggregate(statistics);
+          }
+        }
+
+        if (i.fail())
+          throw std::runtime_error("Malformed distributed training message.");
+      }
+    }
+
+    // Aggregate merged partition statistics either side of threshold t of feature f
+    void Partition(int f, int t)
+    {
+      leftChildStatistics_.Clear();
+      rightChildStatistics_.Clear();
+      for (unsigned int p = 0; p < partitionStatistics_[f].size(); p++)
+      {
+        if ((int)(p) <= t)
+          leftChildStatistics_.Aggregate(partitionStatistics_[f][p]);
+        else
+          rightChildStatistics_.Aggregate(partitionStatistics_[f][p]);
+      }
+    }
+  };
+
+  /// <summary>
+  /// Learns new decision forests from training data sharded over a number of
+  /// workers, each running DistributedTrainingWorker::Serve(). Only merged
+  /// statistics are exchanged, so the coordinator never needs to hold the
+  /// training data.
+  /// </summary>
+  template<class F, class S>
+  class DistributedForestTrainer // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// Train a new decision forest on training data held by workers.
+    /// </summary>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="context">An ITrainingContext instance describing
+    /// the training problem, e.g. classification, density estimation, etc. </param>
+    /// <param name="workers">Channels connected to the workers. Workers are
+    /// told to stop serving once training is complete.</param>
+    /// <returns>A new decision forest.</returns>
+    static std::auto_ptr<Forest<F,S> > TrainForest(
+      Random& random,
+      const TrainingParameters& parameters,
+      ITrainingContext<F,S>& context,
+      const std::vector<IMessageChannel*>& workers,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      if (workers.size() == 0)
+        throw std::runtime_error("Distributed training requires at least one worker.");
+
+      // Handshake
+      std::ostringstream hello;
+      Serialize_(hello, (int)(DistributedTrainingProtocol::Hello));
+      const char* header = DistributedTrainingProtocol::Header();
+      hello.write(header, strlen(header));
+      const int majorVersion = DistributedTrainingProtocol::MajorVersion, minorVersion = DistributedTrainingProtocol::MinorVersion;
+      Serialize_(hello, majorVersion);
+      Serialize_(hello, minorVersion);
+
+      unsigned int totalCount = 0;
+      std::string reply;
+      for (unsigned int w = 0; w < workers.size(); w++)
+      {
+        workers[w]->Send(hello.str());
+        workers[w]->Receive(reply);
+        std::istringstream i(reply);
+        unsigned int count;
+        Deserialize_(i, count);
+        if (i.fail())
+          throw std::runtime_error("Malformed distributed training message.");
+        totalCount += count;
+      }
+
+      (*progress)[Interest] << "Training on " << totalCount << " data points held by " << workers.size() << " workers." << std::endl;
+
+      std::auto_ptr<Forest<F,S> > forest = std::auto_ptr<Forest<F,S> >(new Forest<F,S>());
+
+      for (int t = 0; t < parameters.NumberOfTrees; t++)
+      {
+        (*progress)[Interest] << "\rTraining tree "<< t << "...";
+
+        std::ostringstream o;
+        Serialize_(o, (int)(DistributedTrainingProtocol::BeginTree));
+        for (unsigned int w = 0; w < workers.size(); w++)
+          workers[w]->Send(o.str());
+
+        std::auto_ptr<Tree<F, S> > tree = std::auto_ptr<Tree<F, S> >(new Tree<F, S>(parameters.MaxDecisionLevels));
+
+        DistributedTreeTrainingOperation<F, S> trainingOperation(random, context, parameters, workers, totalCount, *progress);
+
+        trainingOperation.TrainNodesRecurse(tree->GetNodes(), 0, 0);
+
+        tree->CheckValid();
+
+        forest->AddTree(tree);
+      }
+      (*progress)[Interest] << "\rTrained " << parameters.NumberOfTrees << " trees.         " << std::endl;
+
+      std::ostringstream end;
+      Serialize_(end, (int)(DistributedTrainingProtocol::EndTraining));
+      for (unsigned int w = 0; w < workers.size(); w++)
+        workers[w]->Send(end.str());
+
+      return forest;
+    }
+  };
+} } }
@@ -0,0 +1,48 @@
+#pragma once
+
+// This file defines the GetFeatureCost_() and ComputeSplitScore() functions,
+// which allow trainers to take the inference-time cost of evaluating
+// features into account when choosing splits.
+
+#include "TrainingParameters.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// The relative cost of evaluating a feature at inference time. All
+  /// features cost 1.0 unless this is overloaded for a particular
+  /// IFeatureResponse implementation (in the same namespace, so that it is
+  /// found by argument-dependent lookup).
+  /// </summary>
+  template<class F>
+  double GetFeatureCost_(const F& feature)
+  {
+    return 1.0;
+  }
+
+  /// <summary>
+  /// Compute the score by which a candidate split is ranked, according to
+  /// parameters.CostMode. Candidates are chosen to maximize the score, and
+  /// a node is only split if the best score is positive.
+  /// </summary>
+  /// <param name="parameters">Training parameters.</param>
+  /// <param name="gain">The information gain of the split.</param>
+  /// <param name="feature">The split's feature.</param>
+  /// <param name="sampleFraction">The fraction of the training data that
+  /// reaches the node, i.e. an estimate of the probability that the feature
+  /// is evaluated at inference time.</param>
+  /// <returns>The score.</returns>
+  template<class F>
+  double ComputeSplitScore(const TrainingParameters& parameters, double gain, const F& feature, double sampleFraction)
+  {
+    switch (parameters.CostMode)
+    {
+    case SplitCostMode::GainPerCost:
+      return gain / GetFeatureCost_(feature);
+    case SplitCostMode::PenalizedGain:
+      return gain - parameters.CostPenalty * GetFeatureCost_(feature) * sampleFraction;
+    default:
+      return gain;
+    }
+  }
+} } }
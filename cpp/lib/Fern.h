@@ -0,0 +1,352 @@
+#pragma once
+
+// This file defines the Fern class, which is used to represent random ferns,
+// and the FernEnsemble class, which represents collections of ferns.
+
+#include <assert.h>
+#include <string.h>
+
+#include <memory>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "Interfaces.h"
+#include "Node.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// A random fern, i.e. a decision tree in which all the nodes at any given
+  /// level share the same feature and threshold.
+  /// </summary>
+
+  // *** NB Because the weak learner at each level is shared, a fern with D
+  // decision levels stores only D features and thresholds, and the leaf
+  // reached by a data point is given directly by the D bits (r_d >= t_d),
+  // the first decision level providing the most significant bit. Fern
+  // evaluation therefore requires no data-dependent branching and can
+  // proceed one decision level at a time over a whole batch of data points.
+
+  template<class F, class S>
+  class Fern // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    static const char* binaryFileHeader_;
+
+    int decisionLevels_;
+
+    std::vector<F> features_;
+    std::vector<float> thresholds_;
+
+    std::vector<S> leafStatistics_;
+
+  public:
+    // Implementation only
+    Fern(int decisionLevels):decisionLevels_(decisionLevels)
+    {
+      if(decisionLevels<0)
+        throw std::runtime_error("Fern can't have less than 0 decision levels.");
+
+      if(decisionLevels>19)
+        throw std::runtime_error("Fern can't have more than 19 decision levels.");
+
+      features_.resize(decisionLevels);
+      thresholds_.resize(decisionLevels);
+      leafStatistics_.resize(1 << decisionLevels);
+    }
+
+    /// <summary>
+    /// The number of decision levels, i.e. feature/threshold pairs.
+    /// </summary>
+    int DecisionLevels() const
+    {
+      return decisionLevels_;
+    }
+
+    /// <summary>
+    /// The number of leaves (2^DecisionLevels()).
+    /// </summary>
+    int LeafCount() const
+    {
+      return leafStatistics_.size();
+    }
+
+    const F& GetFeature(int level) const { return features_[level]; }
+    F& GetFeature(int level) { return features_[level]; }
+
+    float GetThreshold(int level) const { return thresholds_[level]; }
+    float& GetThreshold(int level) { return thresholds_[level]; }
+
+    /// <summary>
+    /// Return the training data statistics stored at the specified leaf.
+    /// </summary>
+    /// <param name="leafIndex">A zero-based leaf index.</param>
+    const S& GetLeafStatistics(int leafIndex) const { return leafStatistics_[leafIndex]; }
+    S& GetLeafStatistics(int leafIndex) { return leafStatistics_[leafIndex]; }
+
+    /// <summary>
+    /// Apply the fern to a collection of test data points.
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="leafIndices">Receives the leaf index reached per data point.</param>
+    void Apply(const IDataPointCollection& data, std::vector<int>& leafIndices) const
+    {
+      leafIndices.assign(data.Count(), 0);
+
+      // One decision level at a time, so that the inner loop (over data
+      // points) is free of data-dependent branches.
+      for (int d = 0; d < decisionLevels_; d++)
+      {
+        const F& feature = features_[d];
+        const float threshold = thresholds_[d];
+
+        for (unsigned int i = 0; i < data.Count(); i++)
+          leafIndices[i] = (leafIndices[i] << 1) | (int)(feature.GetResponse(data, i) >= threshold);
+      }
+    }
+
+    /// <summary>
+    /// Compute the leaf index reached by a single data point.
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="dataIndex">The index of the data point to be evaluated.</param>
+    /// <returns>The leaf index.</returns>
+    int Apply(const IDataPointCollection& data, unsigned int dataIndex) const
+    {
+      int leafIndex = 0;
+      for (int d = 0; d < decisionLevels_; d++)
+        leafIndex = (leafIndex << 1) | (int)(features_[d].GetResponse(data, dataIndex) >= thresholds_[d]);
+      return leafIndex;
+    }
+
+    void Serialize(std::ostream& o) const
+    {
+      const int majorVersion = 0, minorVersion = 0;
+
+      o.write(binaryFileHeader_, strlen(binaryFileHeader_));
+      o.write((const char*)(&majorVersion), sizeof(majorVersion));
+      o.write((const char*)(&minorVersion), sizeof(minorVersion));
+
+      o.write((const char*)(&decisionLevels_), sizeof(decisionLevels_));
+
+      for(int d=0; d<decisionLevels_; d++)
+      {
+        Serialize_(o, features_[d]);
+        Serialize_(o, thresholds_[d]);
+      }
+
+      for(int l=0; l<LeafCount(); l++)
+        Serialize_(o, leafStatistics_[l]);
+    }
+
+    static std::auto_ptr<Fern<F,S> > Deserialize(std::istream& i)
+    {
+      std::auto_ptr<Fern<F,S> > fern;
+
+      std::vector<char> buffer(strlen(binaryFileHeader_)+1);
+      i.read(&buffer[0], strlen(binaryFileHeader_));
+      buffer[buffer.size()-1] = '\0';
+
+      if(strcmp(&buffer[0], binaryFileHeader_)!=0)
+        throw std::runtime_error("Unsupported fern format.");
+
+      int majorVersion = 0, minorVersion = 0;
+      i.read((char*)(&majorVersion), sizeof(majorVersion));
+      i.read((char*)(&minorVersion), sizeof(minorVersion));
+
+      if(majorVersion==0 && minorVersion==0)
+      {
+        int decisionLevels;
+        i.read((char*)(&decisionLevels), sizeof(decisionLevels));
+
+        if(decisionLevels<0 || i.fail())
+          throw std::runtime_error("Invalid data");
+
+        fern = std::auto_ptr<Fern<F,S> >(new Fern<F, S>(decisionLevels));
+
+        for(int d=0; d<decisionLevels; d++)
+        {
+          Deserialize_(i, fern->features_[d]);
+          Deserialize_(i, fern->thresholds_[d]);
+        }
+
+        for(int l=0; l<fern->LeafCount(); l++)
+          Deserialize_(i, fern->leafStatistics_[l]);
+      }
+      else
+        throw std::runtime_error("Unsupported file version number.");
+
+      return fern;
+    }
+  };
+
+  template<class F, class S>
+  const char* Fern<F,S>::binaryFileHeader_ = "MicrosoftResearch.Cambridge.Sherwood.Fern";
+
+  /// <summary>
+  /// A collection of random ferns.
+  /// </summary>
+  template<class F, class S>
+  class FernEnsemble // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    static const char* binaryFileHeader_;
+
+    std::vector< Fern<F,S>* > ferns_;
+
+  public:
+    typedef typename std::vector< Fern<F,S>* >::size_type FernIndex;
+
+    ~FernEnsemble()
+    {
+      for(FernIndex f=0; f<ferns_.size(); f++)
+        delete ferns_[f];
+    }
+
+    /// <summary>
+    /// Add another fern to the ensemble.
+    /// </summary>
+    /// <param name="fern">The fern.</param>
+    void AddFern(std::auto_ptr<Fern<F,S> > fern)
+    {
+      ferns_.push_back(fern.get());
+      fern.release();
+    }
+
+    /// <summary>
+    /// Deserialize a fern ensemble from a file.
+    /// </summary>
+    /// <param name="path">The file path.</param>
+    /// <returns>The fern ensemble.</returns>
+    static std::auto_ptr<FernEnsemble<F, S> > Deserialize(const std::string& path)
+    {
+      std::ifstream i(path.c_str(), std::ios_base::binary);
+
+      return FernEnsemble<F,S>::Deserialize(i);
+    }
+
+    /// <summary>
+    /// Deserialize a fern ensemble from a binary stream.
+    /// </summary>
+    /// <param name="stream">The stream.</param>
+    /// <returns>The fern ensemble.</returns>
+    static std::auto_ptr<FernEnsemble<F, S> > Deserialize(std::istream& i)
+    {
+      std::auto_ptr<FernEnsemble<F, S> > ensemble = std::auto_ptr<FernEnsemble<F, S> >(new FernEnsemble<F,S>());
+
+      std::vector<char> buffer(strlen(binaryFileHeader_)+1);
+      i.read(&buffer[0], strlen(binaryFileHeader_));
+      buffer[buffer.size()-1] = '\0';
+
+      if(strcmp(&buffer[0], binaryFileHeader_)!=0)
+        throw std::runtime_error("Unsupported fern ensemble format.");
+
+      int majorVersion = 0, minorVersion = 0;
+      i.read((char*)(&majorVersion), sizeof(majorVersion));
+      i.read((char*)(&minorVersion), sizeof(minorVersion));
+
+      if(majorVersion==0 && minorVersion==0)
+      {
+        int fernCount;
+        i.read((char*)(&fernCount), sizeof(fernCount));
+
+        for(int f=0; f<fernCount; f++)
+          ensemble->AddFern(Fern<F, S>::Deserialize(i));
+      }
+      else
+        throw std::runtime_error("Unsupported file version number.");
+
+      return ensemble;
+    }
+
+    /// <summary>
+    /// Serialize the fern ensemble to file.
+    /// </summary>
+    /// <param name="path">The file path.</param>
+    void Serialize(const std::string& path) const
+    {
+      std::ofstream o(path.c_str(), std::ios_base::binary);
+      Serialize(o);
+    }
+
+    /// <summary>
+    /// Serialize the fern ensemble to a binary stream.
+    /// </summary>
+    /// <param name="stream">The stream.</param>
+    void Serialize(std::ostream& stream) const
+    {
+      const int majorVersion = 0, minorVersion = 0;
+
+      stream.write(binaryFileHeader_, strlen(binaryFileHeader_));
+      stream.write((const char*)(&majorVersion), sizeof(majorVersion));
+      stream.write((const char*)(&minorVersion), sizeof(minorVersion));
+
+      int fernCount = FernCount();
+      stream.write((const char*)(&fernCount), sizeof(fernCount));
+
+      for(int f=0; f<FernCount(); f++)
+        GetFern(f).Serialize(stream);
+
+      if(stream.bad())
+        throw std::runtime_error("Fern ensemble serialization failed.");
+    }
+
+    /// <summary>
+    /// Access the specified fern.
+    /// </summary>
+    /// <param name="index">A zero-based integer index.</param>
+    /// <returns>The fern.</returns>
+    const Fern<F,S>& GetFern(int index) const
+    {
+      return *ferns_[index];
+    }
+
+    /// <summary>
+    /// Access the specified fern.
+    /// </summary>
+    /// <param name="index">A zero-based integer index.</param>
+    /// <returns>The fern.</returns>
+    Fern<F,S>& GetFern(int index)
+    {
+      return *ferns_[index];
+    }
+
+    /// <summary>
+    /// How many ferns in the ensemble?
+    /// </summary>
+    int FernCount() const
+    {
+      return ferns_.size();
+    }
+
+    /// <summary>
+    /// Apply all ferns to a set of data points.
+    /// </summary>
+    /// <param name="data">The data points.</param>
+    /// <param name="leafIndices">Receives the leaf index per fern per data point.</param>
+    void Apply(
+      const IDataPointCollection& data,
+      std::vector<std::vector<int> >& leafIndices,
+      ProgressStream* progress=0 ) const
+    {
+      ProgressStream defaultProgressStream(std::cout, Interest);
+      progress = (progress==0)?&defaultProgressStream:progress;
+
+      leafIndices.resize(FernCount());
+
+      for (int f = 0; f < FernCount(); f++)
+      {
+        (*progress)[Interest] << "\rApplying fern " << f << "...";
+        ferns_[f]->Apply(data, leafIndices[f]);
+      }
+
+      (*progress)[Interest] << "\rApplied " << FernCount() << " ferns.        " << std::endl;
+    }
+  };
+
+  template<class F, class S>
+  const char* FernEnsemble<F,S>::binaryFileHeader_ = "MicrosoftResearch.Cambridge.Sherwood.FernEnsemble";
+} } }
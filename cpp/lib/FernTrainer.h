@@ -0,0 +1,335 @@
+#pragma once
+
+// This file defines the FernTrainer and FernEnsembleTrainer classes, which
+// are responsible for learning random ferns (see Fern.h) from training data.
+
+#include <assert.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "TrainingParameters.h"
+#include "FeatureCost.h"
+#include "CandidateThresholds.h"
+
+#include "Interfaces.h"
+#include "Fern.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Decision fern training operation - used internally within FernTrainer
+  /// to encapsulate the training of a single fern.
+  /// </summary>
+
+  // *** NB Ferns are trained one decision level at a time. At each level
+  // the samples are divided between 2^level cells (the nodes at that level
+  // of the equivalent tree). A single feature and threshold is chosen for
+  // all of the cells, namely that which maximizes the information gain
+  // summed over the cells, each cell's contribution being weighted by the
+  // fraction of training samples that reach it.
+
+  template<class F, class S>
+  class FernTrainingOperation // where F : IFeatureResponse where S : IStatisticsAggregator<S>
+  {
+  private:
+    typedef typename std::vector<unsigned int>::size_type DataPointIndex;
+
+    Random& random_;
+
+    const IDataPointCollection& data_;
+
+    ITrainingContext<F, S>& trainingContext_;
+
+    TrainingParameters parameters_;
+
+    ProgressStream& progress_;
+
+    std::vector<int> cells_;                          // cell (i.e. partial leaf index) per sample
+    std::vector<float> responses_;
+    std::vector<float> thresholds_;
+
+    std::vector<S> cellStatistics_;
+    std::vector<unsigned int> cellCounts_;
+
+    std::vector<S> partitionStatistics_;              // per cell, per threshold bin
+    std::vector<unsigned int> partitionCounts_;
+
+    S leftChildStatistics_, rightChildStatistics_;
+
+  public:
+    FernTrainingOperation(
+      Random& random,
+      ITrainingContext<F, S>& trainingContext,
+      const TrainingParameters& parameters,
+      const IDataPointCollection& data,
+      ProgressStream& progress ):
+    random_(random),
+      data_(data),
+      trainingContext_(trainingContext),
+      progress_(progress)
+    {
+      parameters_ = parameters;
+
+      if (parameters_.NumberOfCandidateFeatures < 1)
+        throw std::runtime_error("Fern training requires at least one candidate feature.");
+
+      cells_.resize(data.Count());
+      responses_.resize(data.Count());
+
+      leftChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+      rightChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+    }
+
+    void TrainLevel(Fern<F, S>& fern, int level)
+    {
+      int nCells = 1 << level;
+
+      if (level == 0)
+        std::fill(cells_.begin(), cells_.end(), 0);
+
+      // Aggregate statistics over the samples in each cell
+      cellStatistics_.resize(nCells);
+      cellCounts_.assign(nCells, 0);
+      for (int c = 0; c < nCells; c++)
+        cellStatistics_[c] = trainingContext_.GetStatisticsAggregator();
+
+      for (DataPointIndex i = 0; i < data_.Count(); i++)
+      {
+        cellStatistics_[cells_[i]].Aggregate(data_, i);
+        cellCounts_[cells_[i]]++;
+      }
+
+      int nBins = parameters_.ExtremelyRandomized ? 2 : parameters_.NumberOfCandidateThresholdsPerFeature + 1;
+      if (partitionStatistics_.size() < (unsigned int)(nCells * nBins))
+      {
+        partitionStatistics_.resize(nCells * nBins);
+        for (unsigned int p = 0; p < partitionStatistics_.size(); p++)
+          partitionStatistics_[p] = trainingContext_.GetStatisticsAggregator();
+      }
+      partitionCounts_.resize(nCells * nBins);
+
+      double maxGain = 0.0, maxScore = 0.0;
+      bool bFound = false;
+      F bestFeature, firstFeature;
+      float bestThreshold = 0.0f;
+
+      // Iterate over candidate features
+      for (int f = 0; f < parameters_.NumberOfCandidateFeatures; f++)
+      {
+        F feature = trainingContext_.GetRandomFeature(random_);
+        if (f == 0)
+          firstFeature = feature;
+
+        // Compute feature response per sample, and their range
+        float minResponse = std::numeric_limits<float>::infinity();
+        float maxResponse = -std::numeric_limits<float>::infinity();
+        for (DataPointIndex i = 0; i < data_.Count(); i++)
+        {
+          float response = feature.GetResponse(data_, i);
+          responses_[i] = response;
+          minResponse = std::min(minResponse, response);
+          maxResponse = std::max(maxResponse, response);
+        }
+
+        int nThresholds;
+        if (parameters_.ExtremelyRandomized)
+        {
+          nThresholds = (maxResponse > minResponse) ? 1 : 0;
+          thresholds_.resize(1);
+          thresholds_[0] = minResponse + (float)(random_.NextDouble() * (maxResponse - minResponse));
+        }
+        else
+          nThresholds = ChooseCandidateThresholds(random_, responses_, 0, data_.Count(), parameters_.NumberOfCandidateThresholdsPerFeature, thresholds_);
+
+        if (nThresholds == 0)
+          continue;
+
+        int nPartitions = nThresholds + 1;
+        for (int p = 0; p < nCells * nPartitions; p++)
+        {
+          partitionStatistics_[p].Clear(); // reset statistics
+          partitionCounts_[p] = 0;
+        }
+
+        // Aggregate statistics over sample partitions within each cell
+        for (DataPointIndex i = 0; i < data_.Count(); i++)
+        {
+          int b = 0;
+          while (b < nThresholds && responses_[i] >= thresholds_[b])
+            b++;
+
+          int p = cells_[i] * nPartitions + b;
+          partitionStatistics_[p].Aggregate(data_, i);
+          partitionCounts_[p]++;
+        }
+
+        for (int t = 0; t < nThresholds; t++)
+        {
+          // Compute gain summed over cells, weighted by cell sample count
+          double gain = 0.0;
+          for (int c = 0; c < nCells; c++)
+          {
+            if (cellCounts_[c] == 0)
+              continue;
+
+            leftChildStatistics_.Clear();
+            rightChildStatistics_.Clear();
+            for (int b = 0; b < nPartitions; b++)
+            {
+              if (b <= t)
+                leftChildStatistics_.Aggregate(partitionStatistics_[c * nPartitions + b]);
+              else
+                rightChildStatistics_.Aggregate(partitionStatistics_[c * nPartitions + b]);
+            }
+
+            gain += cellCounts_[c] * trainingContext_.ComputeInformationGain(cellStatistics_[c], leftChildStatistics_, rightChildStatistics_);
+          }
+          gain /= data_.Count();
+
+          // Every sample evaluates every level of a fern
+          double score = ComputeSplitScore(parameters_, gain, feature, 1.0);
+
+          if (score >= maxScore)
+          {
+            maxScore = score;
+            maxGain = gain;
+            bFound = true;
+            bestFeature = feature;
+            bestThreshold = thresholds_[t];
+          }
+        }
+      }
+
+      if (bFound == false)
+      {
+        // No candidate feature separated any of the samples. Every level of
+        // a fern needs a weak learner, so use one that sends all samples
+        // the same way.
+        bestFeature = firstFeature;
+        bestThreshold = std::numeric_limits<float>::infinity();
+      }
+
+      fern.GetFeature(level) = bestFeature;
+      fern.GetThreshold(level) = bestThreshold;
+
+      progress_[Verbose] << "Level " << level << ": threshold = " << bestThreshold << ", gain = " << maxGain << "." << std::endl;
+
+      // Move each sample into the appropriate cell at the next level
+      for (DataPointIndex i = 0; i < data_.Count(); i++)
+        cells_[i] = (cells_[i] << 1) | (int)(bestFeature.GetResponse(data_, i) >= bestThreshold);
+    }
+
+    void TrainLeaves(Fern<F, S>& fern)
+    {
+      if (fern.DecisionLevels() == 0)
+        std::fill(cells_.begin(), cells_.end(), 0);
+
+      for (int l = 0; l < fern.LeafCount(); l++)
+      {
+        fern.GetLeafStatistics(l) = trainingContext_.GetStatisticsAggregator();
+        fern.GetLeafStatistics(l).Clear();
+      }
+
+      for (DataPointIndex i = 0; i < data_.Count(); i++)
+        fern.GetLeafStatistics(cells_[i]).Aggregate(data_, i);
+    }
+  };
+
+  /// <summary>
+  /// Used to train random ferns.
+  /// </summary>
+  template<class F, class S>
+  class FernTrainer
+  {
+  public:
+    /// <summary>
+    /// Train a new random fern given some training data and a training
+    /// problem described by an ITrainingContext instance. The fern has
+    /// parameters.MaxDecisionLevels levels. ShouldTerminate() is not used
+    /// because every level of a fern is shared by all of its branches.
+    /// </summary>
+    /// <param name="random">The single random number generator.</param>
+    /// <param name="context">The ITrainingContext instance by which
+    /// the training framework interacts with the training data.
+    /// Implemented within client code.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="data">The training data.</param>
+    /// <param name="progress">Progress reporting target.</param>
+    /// <returns>A new fern.</returns>
+    static std::auto_ptr<Fern<F, S> > TrainFern(
+      Random& random,
+      ITrainingContext<F, S>& context,
+      const TrainingParameters& parameters,
+      const IDataPointCollection& data,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      FernTrainingOperation<F, S> trainingOperation(random, context, parameters, data, *progress);
+
+      std::auto_ptr<Fern<F, S> > fern = std::auto_ptr<Fern<F, S> >(new Fern<F,S>(parameters.MaxDecisionLevels));
+
+      (*progress)[Verbose] << std::endl;
+
+      for (int level = 0; level < fern->DecisionLevels(); level++)
+        trainingOperation.TrainLevel(*fern, level);
+
+      trainingOperation.TrainLeaves(*fern);
+
+      (*progress)[Verbose] << std::endl;
+
+      return fern;
+    }
+  };
+
+  /// <summary>
+  /// Learns new ensembles of random ferns from training data.
+  /// </summary>
+  template<class F, class S>
+  class FernEnsembleTrainer // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// Train a new ensemble of parameters.NumberOfTrees random ferns given
+    /// some training data and a training problem described by an instance
+    /// of the ITrainingContext interface.
+    /// </summary>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="context">An ITrainingContext instance describing
+    /// the training problem, e.g. classification, density estimation, etc. </param>
+    /// <param name="data">The training data.</param>
+    /// <returns>A new fern ensemble.</returns>
+    static std::auto_ptr<FernEnsemble<F,S> > TrainEnsemble(
+      Random& random,
+      const TrainingParameters& parameters,
+      ITrainingContext<F,S>& context,
+      const IDataPointCollection& data,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      std::auto_ptr<FernEnsemble<F,S> > ensemble = std::auto_ptr<FernEnsemble<F,S> >(new FernEnsemble<F,S>());
+
+      for (int f = 0; f < parameters.NumberOfTrees; f++)
+      {
+        (*progress)[Interest] << "\rTraining fern "<< f << "...";
+
+        ensemble->AddFern(FernTrainer<F, S>::TrainFern(random, context, parameters, data, progress));
+      }
+      (*progress)[Interest] << "\rTrained " << parameters.NumberOfTrees << " ferns.         " << std::endl;
+
+      return ensemble;
+    }
+  };
+} } }
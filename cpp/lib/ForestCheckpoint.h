@@ -0,0 +1,208 @@
+#pragma once
+
+// This file defines the ForestCheckpoint class, which is used to save and
+// restore the state of a partially complete forest training run.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Random.h"
+#include "TrainingParameters.h"
+#include "Forest.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Reads and writes training checkpoints. A checkpoint comprises the trees
+  /// trained so far (in the usual Forest serialization format) together with
+  /// the state of the random number generator, so that an interrupted run
+  /// can be resumed from the next tree.
+  /// </summary>
+
+  // *** NB A checkpoint also records the training parameters that determine
+  // the trees (and the number of training data points), and Load() refuses
+  // a checkpoint written by a run with different ones, so a stale checkpoint
+  // can't be mistaken for a partially trained forest. The generator state
+  // is restored rather than compared, since callers commonly seed from the
+  // clock.
+  template<class F, class S>
+  class ForestCheckpoint // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    static const char* binaryFileHeader_;
+
+  public:
+    /// <summary>
+    /// Write a checkpoint file. The checkpoint is first written to a
+    /// temporary file and then moved into place, so that a crash during
+    /// writing never destroys the previous checkpoint.
+    /// </summary>
+    /// <param name="path">The checkpoint file path.</param>
+    /// <param name="parameters">The training parameters.</param>
+    /// <param name="dataCount">The number of training data points.</param>
+    /// <param name="random">The random number generator used for training.</param>
+    /// <param name="forest">The trees trained so far.</param>
+    static void Save(
+      const std::string& path,
+      const TrainingParameters& parameters,
+      unsigned int dataCount,
+      const Random& random,
+      const Forest<F,S>& forest )
+    {
+      std::string temporaryPath = path + ".tmp";
+
+      {
+        std::ofstream o(temporaryPath.c_str(), std::ios_base::binary);
+        if(o.fail())
+          throw std::runtime_error("Failed to open checkpoint file for writing.");
+
+        const int majorVersion = 1, minorVersion = 0;
+
+        o.write(binaryFileHeader_, strlen(binaryFileHeader_));
+        o.write((const char*)(&majorVersion), sizeof(majorVersion));
+        o.write((const char*)(&minorVersion), sizeof(minorVersion));
+
+        WriteParameters(o, parameters, dataCount);
+        random.Serialize(o);
+        forest.Serialize(o);
+
+        o.flush();
+        if(o.bad())
+          throw std::runtime_error("Checkpoint serialization failed.");
+      }
+
+      // rename() will not replace an existing file on all platforms
+      if(rename(temporaryPath.c_str(), path.c_str())!=0)
+      {
+        remove(path.c_str());
+        if(rename(temporaryPath.c_str(), path.c_str())!=0)
+          throw std::runtime_error("Failed to replace checkpoint file.");
+      }
+    }
+
+    /// <summary>
+    /// Read a checkpoint file, if one exists. Throws if the checkpoint was
+    /// written by a run with different training parameters or data, or
+    /// holds more than parameters.NumberOfTrees trees.
+    /// </summary>
+    /// <param name="path">The checkpoint file path.</param>
+    /// <param name="parameters">The training parameters of the resumed run.</param>
+    /// <param name="dataCount">The number of training data points.</param>
+    /// <param name="random">Receives the saved random number generator state.</param>
+    /// <param name="forest">Receives the trees trained so far.</param>
+    /// <returns>False if there was no checkpoint file to read.</returns>
+    static bool Load(
+      const std::string& path,
+      const TrainingParameters& parameters,
+      unsigned int dataCount,
+      Random& random,
+      std::auto_ptr<Forest<F,S> >& forest )
+    {
+      std::ifstream i(path.c_str(), std::ios_base::binary);
+      if(i.fail())
+        return false;
+
+      std::vector<char> buffer(strlen(binaryFileHeader_)+1);
+      i.read(&buffer[0], strlen(binaryFileHeader_));
+      buffer[buffer.size()-1] = '\0';
+
+      if(strcmp(&buffer[0], binaryFileHeader_)!=0)
+        throw std::runtime_error("Unsupported checkpoint format.");
+
+      int majorVersion = 0, minorVersion = 0;
+      i.read((char*)(&majorVersion), sizeof(majorVersion));
+      i.read((char*)(&minorVersion), sizeof(minorVersion));
+
+      if(majorVersion==0 && minorVersion==0)
+        throw std::runtime_error("Checkpoint predates recording of training parameters, so can't be validated. Delete it to start training afresh.");
+      else if(majorVersion==1 && minorVersion==0)
+      {
+        if(ReadParameters(i, parameters, dataCount)==false)
+          throw std::runtime_error("Checkpoint was written by a training run with different parameters or data. Delete it to start training afresh.");
+        random.Deserialize(i);
+        forest = Forest<F,S>::Deserialize(i);
+      }
+      else
+        throw std::runtime_error("Unsupported file version number.");
+
+      if(i.fail())
+        throw std::runtime_error("Failed to read checkpoint file.");
+
+      if(forest->TreeCount() > parameters.NumberOfTrees)
+        throw std::runtime_error("Checkpoint holds more trees than were requested.");
+
+      return true;
+    }
+
+    /// <summary>
+    /// Delete a checkpoint file, e.g. once training has completed.
+    /// </summary>
+    /// <param name="path">The checkpoint file path.</param>
+    /// <returns>False if the file exists but could not be deleted.</returns>
+    static bool Remove(const std::string& path)
+    {
+      {
+        std::ifstream i(path.c_str(), std::ios_base::binary);
+        if(i.fail())
+          return true;
+      }
+      return remove(path.c_str())==0;
+    }
+
+  private:
+    // The parameters that determine the trees, i.e. those that
+    // ForestTrainer uses (but not e.g. Verbose or CheckpointInterval)
+    static void WriteParameters(std::ostream& o, const TrainingParameters& parameters, unsigned int dataCount)
+    {
+      int costMode = parameters.CostMode;
+      char extremelyRandomized = parameters.ExtremelyRandomized ? 1 : 0;
+
+      o.write((const char*)(&parameters.NumberOfTrees), sizeof(parameters.NumberOfTrees));
+      o.write((const char*)(&parameters.NumberOfCandidateFeatures), sizeof(parameters.NumberOfCandidateFeatures));
+      o.write((const char*)(&parameters.NumberOfCandidateThresholdsPerFeature), sizeof(parameters.NumberOfCandidateThresholdsPerFeature));
+      o.write((const char*)(&parameters.MaxDecisionLevels), sizeof(parameters.MaxDecisionLevels));
+      o.write(&extremelyRandomized, sizeof(extremelyRandomized));
+      o.write((const char*)(&costMode), sizeof(costMode));
+      o.write((const char*)(&parameters.CostPenalty), sizeof(parameters.CostPenalty));
+      o.write((const char*)(&dataCount), sizeof(dataCount));
+    }
+
+    // Returns false if the saved parameters differ from those specified
+    static bool ReadParameters(std::istream& i, const TrainingParameters& parameters, unsigned int dataCount)
+    {
+      TrainingParameters saved;
+      int costMode = 0;
+      char extremelyRandomized = 0;
+      unsigned int savedDataCount = 0;
+
+      i.read((char*)(&saved.NumberOfTrees), sizeof(saved.NumberOfTrees));
+      i.read((char*)(&saved.NumberOfCandidateFeatures), sizeof(saved.NumberOfCandidateFeatures));
+      i.read((char*)(&saved.NumberOfCandidateThresholdsPerFeature), sizeof(saved.NumberOfCandidateThresholdsPerFeature));
+      i.read((char*)(&saved.MaxDecisionLevels), sizeof(saved.MaxDecisionLevels));
+      i.read(&extremelyRandomized, sizeof(extremelyRandomized));
+      i.read((char*)(&costMode), sizeof(costMode));
+      i.read((char*)(&saved.CostPenalty), sizeof(saved.CostPenalty));
+      i.read((char*)(&savedDataCount), sizeof(savedDataCount));
+
+      if(i.fail())
+        throw std::runtime_error("Failed to read checkpoint file.");
+
+      return saved.NumberOfTrees == parameters.NumberOfTrees
+        && saved.NumberOfCandidateFeatures == parameters.NumberOfCandidateFeatures
+        && saved.NumberOfCandidateThresholdsPerFeature == parameters.NumberOfCandidateThresholdsPerFeature
+        && saved.MaxDecisionLevels == parameters.MaxDecisionLevels
+        && (extremelyRandomized != 0) == parameters.ExtremelyRandomized
+        && costMode == (int)(parameters.CostMode)
+        && saved.CostPenalty == parameters.CostPenalty
+        && savedDataCount == dataCount;
+    }
+  };
+
+  template<class F, class S>
+  const char* ForestCheckpoint<F,S>::binaryFileHeader_ = "MicrosoftResearch.Cambridge.Sherwood.Checkpoint";
+} } }
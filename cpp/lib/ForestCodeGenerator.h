@@ -0,0 +1,220 @@
+#pragma once
+
+// This file defines the ForestCodeGenerator class, which writes a trained
+// forest as standalone C++ source code, and the WriteFeatureCode_()
+// function by which IFeatureResponse implementations take part.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+
+#include "Interfaces.h"
+#include "Forest.h"
+#include "PackedTree.h"
+#include "LeafPosteriors.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Write a C++ expression of type float that computes the response of a
+  /// feature for the data point pointed to by 'const float* x' (which is
+  /// how the generated code receives its input). Code generation is not
+  /// supported unless this is overloaded for a particular IFeatureResponse
+  /// implementation (in the same namespace, so that it is found by
+  /// argument-dependent lookup). The expression must compute the response
+  /// exactly as IFeatureResponse::GetResponse() does.
+  /// </summary>
+  template<class F>
+  void WriteFeatureCode_(std::ostream& o, const F& feature)
+  {
+    throw std::runtime_error("Code generation is not supported for this feature type.");
+  }
+
+  /// <summary>
+  /// How the generated code traverses each tree.
+  /// </summary>
+  class CodeLayout
+  {
+  public:
+    enum e
+    {
+      Nested = 0x0,     // one if/else per split node
+      Flattened = 0x1   // a loop over a switch that selects the next node
+    };
+  };
+
+  /// <summary>
+  /// Writes a trained forest as standalone C++ source code with a C entry
+  /// point, so that it can be compiled (e.g. into a shared object) with its
+  /// features inlined, its thresholds as immediates, and its leaf outputs as
+  /// static arrays. The generated code depends on no Sherwood headers.
+  /// </summary>
+
+  // *** NB The generated code defines two extern "C" functions (named after
+  // the given prefix):
+  //   int <prefix>_dimension();
+  //   void <prefix>_predict(const float* x, float* posterior);
+  // where the latter writes <prefix>_dimension() floats, namely the output
+  // of LeafPosteriors::Predict() for the single data point x. Leaf vectors
+  // are summed in tree order and scaled as by LeafPosteriors, and floats are
+  // written with enough digits to round trip, so the results are identical.
+  //
+  // The nested layout lets the compiler schedule each path as straight-line
+  // code but has one conditional branch per level. The flattened layout
+  // selects the next node with a conditional move, leaving one indirect
+  // jump per level, which can be cheaper for deep trees whose branches
+  // are unpredictable.
+  template<class F, class S>
+  class ForestCodeGenerator // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// Write the forest from which the specified leaf posteriors were
+    /// computed as C++ source code.
+    /// </summary>
+    /// <param name="o">The stream to which source code is written.</param>
+    /// <param name="posteriors">The leaf posteriors of a trained forest.</param>
+    /// <param name="prefix">The prefix of the names of the entry points,
+    /// which must be a valid C identifier.</param>
+    /// <param name="layout">How each tree is traversed.</param>
+    static void Generate(
+      std::ostream& o,
+      const LeafPosteriors<F,S>& posteriors,
+      const std::string& prefix = "forest",
+      CodeLayout::e layout = CodeLayout::Nested )
+    {
+      const Forest<F,S>& forest = posteriors.GetForest();
+      int dimension = posteriors.Dimension();
+
+      o << "// " << prefix << ": a decision forest of " << forest.TreeCount() << " trees, generated by Sherwood." << std::endl;
+      o << "// Compile with, e.g., g++ -O2 -shared -fPIC." << std::endl;
+      o << std::endl;
+      o << "namespace" << std::endl;
+      o << "{" << std::endl;
+
+      for (int t = 0; t < forest.TreeCount(); t++)
+      {
+        const PackedTree<F,S>& tree = forest.GetPackedTree(t);
+
+        o << "  const float leaves" << t << "[" << tree.LeafCount() << "][" << dimension << "] =" << std::endl;
+        o << "  {" << std::endl;
+        for (int l = 0; l < tree.LeafCount(); l++)
+        {
+          const float* p = posteriors.GetLeafPosterior(t, l);
+          o << "    { ";
+          for (int c = 0; c < dimension; c++)
+            o << (c > 0 ? ", " : "") << FormatFloat(p[c]);
+          o << " }" << (l + 1 < tree.LeafCount() ? "," : "") << std::endl;
+        }
+        o << "  };" << std::endl;
+        o << std::endl;
+
+        o << "  inline const float* tree" << t << "(const float* x)" << std::endl;
+        o << "  {" << std::endl;
+        if (layout == CodeLayout::Flattened)
+          WriteFlattened(o, tree, t);
+        else
+          WriteNested(o, tree, t, tree.GetRoot(), 2);
+        o << "  }" << std::endl;
+        o << std::endl;
+      }
+
+      o << "  inline void add(float* sum, const float* p)" << std::endl;
+      o << "  {" << std::endl;
+      o << "    for (int c = 0; c < " << dimension << "; c++)" << std::endl;
+      o << "      sum[c] += p[c];" << std::endl;
+      o << "  }" << std::endl;
+      o << "}" << std::endl;
+      o << std::endl;
+
+      o << "extern \"C\" int " << prefix << "_dimension()" << std::endl;
+      o << "{" << std::endl;
+      o << "  return " << dimension << ";" << std::endl;
+      o << "}" << std::endl;
+      o << std::endl;
+
+      o << "extern \"C\" void " << prefix << "_predict(const float* x, float* posterior)" << std::endl;
+      o << "{" << std::endl;
+      o << "  for (int c = 0; c < " << dimension << "; c++)" << std::endl;
+      o << "    posterior[c] = 0.0f;" << std::endl;
+      for (int t = 0; t < forest.TreeCount(); t++)
+        o << "  add(posterior, tree" << t << "(x));" << std::endl;
+      o << "  for (int c = 0; c < " << dimension << "; c++)" << std::endl;
+      o << "    posterior[c] *= " << FormatFloat(1.0f / forest.TreeCount()) << ";" << std::endl;
+      o << "}" << std::endl;
+
+      if (o.bad())
+        throw std::runtime_error("Code generation failed.");
+    }
+
+  private:
+    static std::string FormatFloat(float f)
+    {
+      // Nine significant digits identify a float uniquely, and showpoint
+      // ensures a valid literal for the 'f' suffix
+      std::ostringstream s;
+      s.precision(9);
+      s << std::showpoint << f << "f";
+      return s.str();
+    }
+
+    static void WriteCondition(std::ostream& o, const PackedSplit<F>& split)
+    {
+      WriteFeatureCode_(o, split.Feature);
+      o << " >= " << FormatFloat(split.Threshold);
+    }
+
+    static void WriteNested(std::ostream& o, const PackedTree<F,S>& tree, int treeIndex, int child, int depth)
+    {
+      std::string indent(2 * depth, ' ');
+
+      if (child < 0)
+      {
+        o << indent << "return leaves" << treeIndex << "[" << ~child << "];" << std::endl;
+        return;
+      }
+
+      const PackedSplit<F>& split = tree.GetSplit(child);
+      o << indent << "if (";
+      WriteCondition(o, split);
+      o << ")" << std::endl;
+      WriteBlock(o, tree, treeIndex, split.Children[1], depth);
+      o << indent << "else" << std::endl;
+      WriteBlock(o, tree, treeIndex, split.Children[0], depth);
+    }
+
+    static void WriteBlock(std::ostream& o, const PackedTree<F,S>& tree, int treeIndex, int child, int depth)
+    {
+      if (child < 0)
+      {
+        WriteNested(o, tree, treeIndex, child, depth + 1);
+        return;
+      }
+
+      std::string indent(2 * depth, ' ');
+      o << indent << "{" << std::endl;
+      WriteNested(o, tree, treeIndex, child, depth + 1);
+      o << indent << "}" << std::endl;
+    }
+
+    static void WriteFlattened(std::ostream& o, const PackedTree<F,S>& tree, int treeIndex)
+    {
+      o << "    int n = " << tree.GetRoot() << ";" << std::endl;
+      o << "    while (n >= 0)" << std::endl;
+      o << "    {" << std::endl;
+      o << "      switch (n)" << std::endl;
+      o << "      {" << std::endl;
+      for (int s = 0; s < tree.SplitCount(); s++)
+      {
+        const PackedSplit<F>& split = tree.GetSplit(s);
+        o << "      case " << s << ": n = (";
+        WriteCondition(o, split);
+        o << ") ? " << split.Children[1] << " : " << split.Children[0] << "; break;" << std::endl;
+      }
+      o << "      }" << std::endl;
+      o << "    }" << std::endl;
+      o << "    return leaves" << treeIndex << "[~n];" << std::endl;
+    }
+  };
+} } }
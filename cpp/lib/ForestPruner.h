@@ -0,0 +1,198 @@
+#pragma once
+
+// This file defines the ForestPruner class, which collapses those subtrees
+// of a trained forest that do not reduce risk enough to justify their size.
+
+// *** NB Trees are pruned in parallel if this header is compiled with
+// OpenMP enabled, and sequentially otherwise.
+
+#include <vector>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "Interfaces.h"
+#include "Tree.h"
+#include "Forest.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Prunes trained trees using the training data statistics stored at
+  /// their split nodes. A split node is collapsed to a leaf (keeping its
+  /// statistics) unless its subtree reduces the risk, as computed by
+  /// ITrainingContext::ComputeRisk(), by more than complexityPenalty per
+  /// additional leaf. Without validation data, risk is measured on the
+  /// training data (cost-complexity pruning for a fixed penalty); with
+  /// validation data, on those (reduced-error pruning when the penalty is
+  /// zero). Trees whose split statistics have been stripped can't be pruned.
+  /// </summary>
+
+  // *** NB Nodes are visited bottom up (children are stored after their
+  // parents), so each node's decision is made knowing the risk and leaf
+  // count of its already pruned subtree, which yields the subtree that
+  // minimizes risk + complexityPenalty * leaves. Pruned nodes are then
+  // removed, preserving the order (and so the layout) of those remaining.
+  template<class F, class S>
+  class ForestPruner // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// Prune every tree in a forest.
+    /// </summary>
+    /// <param name="forest">The forest to be pruned.</param>
+    /// <param name="context">Computes risk (see ITrainingContext::ComputeRisk()).</param>
+    /// <param name="complexityPenalty">The risk reduction required per
+    /// additional leaf for a subtree to be kept.</param>
+    /// <param name="validationData">Optional held-out data on which to
+    /// measure risk (if null, the training data statistics are used).</param>
+    /// <param name="progress">Progress reporting target.</param>
+    /// <returns>The number of nodes removed.</returns>
+    static int PruneForest(
+      Forest<F, S>& forest,
+      ITrainingContext<F, S>& context,
+      double complexityPenalty,
+      const IDataPointCollection* validationData = 0,
+      ProgressStream* progress=0 )
+    {
+      ProgressStream defaultProgressStream(std::cout, Interest);
+      progress = (progress==0)?&defaultProgressStream:progress;
+
+      // Get the trees up front (non-const Forest::GetTree() releases the
+      // forest's packed trees, so is not called concurrently)
+      std::vector<Tree<F,S>*> trees(forest.TreeCount());
+      for (int t = 0; t < forest.TreeCount(); t++)
+      {
+        trees[t] = &forest.GetTree(t);
+        if (trees[t]->HasSplitStatistics() == false)
+          throw std::runtime_error("Can't prune a forest whose split node statistics have been stripped.");
+      }
+
+      (*progress)[Interest] << "Pruning " << forest.TreeCount() << " trees..." << std::endl;
+
+      int nodesBefore = 0, nodesRemoved = 0;
+
+      // Trees are independent, so can be pruned concurrently
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:nodesBefore,nodesRemoved)
+#endif
+      for (int t = 0; t < forest.TreeCount(); t++)
+      {
+        nodesBefore += trees[t]->NodeCount();
+        nodesRemoved += PruneTree(*trees[t], context, complexityPenalty, validationData);
+      }
+
+      (*progress)[Interest] << "Pruned " << nodesRemoved << " of " << nodesBefore << " nodes." << std::endl;
+
+      return nodesRemoved;
+    }
+
+    /// <summary>
+    /// Prune a single tree (see PruneForest()).
+    /// </summary>
+    /// <param name="tree">The tree to be pruned.</param>
+    /// <param name="context">Computes risk (see ITrainingContext::ComputeRisk()).</param>
+    /// <param name="complexityPenalty">The risk reduction required per
+    /// additional leaf for a subtree to be kept.</param>
+    /// <param name="validationData">Optional held-out data on which to
+    /// measure risk (if null, the training data statistics are used).</param>
+    /// <returns>The number of nodes removed.</returns>
+    static int PruneTree(
+      Tree<F, S>& tree,
+      ITrainingContext<F, S>& context,
+      double complexityPenalty,
+      const IDataPointCollection* validationData = 0 )
+    {
+      if (tree.HasSplitStatistics() == false)
+        throw std::runtime_error("Can't prune a tree whose split node statistics have been stripped.");
+
+      tree.CheckValid();
+
+      std::vector<Node<F,S> >& nodes = tree.GetNodes();
+
+      // Statistics of the validation data reaching each node
+      std::vector<S> validationStatistics;
+      if (validationData != 0)
+      {
+        validationStatistics.resize(nodes.size(), context.GetStatisticsAggregator());
+
+        std::vector<int> leafNodeIndices;
+        tree.Apply(*validationData, leafNodeIndices);
+        for (unsigned int i = 0; i < validationData->Count(); i++)
+          validationStatistics[leafNodeIndices[i]].Aggregate(*validationData, i);
+
+        for (int n = (int)(nodes.size()) - 1; n >= 0; n--)
+        {
+          if (nodes[n].IsSplit() == false)
+            continue;
+          validationStatistics[n].Aggregate(validationStatistics[nodes[n].LeftChildIndex]);
+          validationStatistics[n].Aggregate(validationStatistics[nodes[n].LeftChildIndex + 1]);
+        }
+      }
+
+      // Risk and leaf count of the (pruned) subtree rooted at each node
+      std::vector<double> risks(nodes.size());
+      std::vector<int> leafCounts(nodes.size());
+
+      bool bPruned = false;
+      for (int n = (int)(nodes.size()) - 1; n >= 0; n--)
+      {
+        Node<F,S>& node = nodes[n];
+
+        double leafRisk = context.ComputeRisk(
+          node.TrainingDataStatistics,
+          validationData != 0 ? validationStatistics[n] : node.TrainingDataStatistics );
+
+        if (node.IsSplit())
+        {
+          double subtreeRisk = risks[node.LeftChildIndex] + risks[node.LeftChildIndex + 1];
+          int subtreeLeafCount = leafCounts[node.LeftChildIndex] + leafCounts[node.LeftChildIndex + 1];
+
+          if (leafRisk <= subtreeRisk + complexityPenalty * (subtreeLeafCount - 1))
+          {
+            node.InitializeLeaf(node.TrainingDataStatistics);
+            bPruned = true;
+          }
+          else
+          {
+            risks[n] = subtreeRisk;
+            leafCounts[n] = subtreeLeafCount;
+            continue;
+          }
+        }
+
+        risks[n] = leafRisk;
+        leafCounts[n] = 1;
+      }
+
+      if (bPruned == false)
+        return 0;
+
+      // Remove the nodes that are no longer reachable from the root
+      std::vector<bool> reached(nodes.size(), false);
+      reached[0] = true;
+      for (unsigned int n = 0; n < nodes.size(); n++)
+        if (reached[n] && nodes[n].IsSplit())
+          reached[nodes[n].LeftChildIndex] = reached[nodes[n].LeftChildIndex + 1] = true;
+
+      std::vector<int> newIndices(nodes.size(), -1);
+      std::vector<Node<F,S> > prunedNodes;
+      for (unsigned int n = 0; n < nodes.size(); n++)
+      {
+        if (reached[n] == false)
+          continue;
+        newIndices[n] = prunedNodes.size();
+        prunedNodes.push_back(nodes[n]);
+      }
+
+      for (unsigned int n = 0; n < prunedNodes.size(); n++)
+        if (prunedNodes[n].IsSplit())
+          prunedNodes[n].LeftChildIndex = newIndices[prunedNodes[n].LeftChildIndex];
+
+      int nodesRemoved = (int)(nodes.size() - prunedNodes.size());
+      nodes.swap(prunedNodes);
+
+      return nodesRemoved;
+    }
+  };
+} } }
@@ -0,0 +1,135 @@
+#pragma once
+
+// This file defines the ForestRefitter class, which updates the statistics
+// stored in the nodes of a previously trained forest using new data, without
+// changing the structure of its trees.
+
+// *** NB Trees are refitted in parallel if this header is compiled with
+// OpenMP enabled, and sequentially otherwise.
+
+#include <vector>
+
+#include "ProgressStream.h"
+
+#include "Interfaces.h"
+#include "Tree.h"
+#include "Forest.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// How refitted statistics are combined with those already stored in a
+  /// forest's nodes.
+  /// </summary>
+  class RefitMode
+  {
+  public:
+    enum e
+    {
+      Replace = 0x0,      // discard the previous statistics
+      Accumulate = 0x1    // add the new data to the previous statistics
+    };
+  };
+
+  /// <summary>
+  /// Refits a trained forest to new data, i.e. recomputes the statistics
+  /// stored in its nodes while keeping its split functions. This is much
+  /// cheaper than retraining (the cost is that of applying the forest) and is
+  /// useful when the data distribution drifts but the learned partition of
+  /// feature space remains appropriate.
+  /// </summary>
+  template<class F, class S>
+  class ForestRefitter // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// Refit every tree in a forest.
+    /// </summary>
+    /// <param name="forest">The forest to be refitted.</param>
+    /// <param name="data">The new data.</param>
+    /// <param name="mode">How to combine new and previous statistics.</param>
+    /// <param name="refitSplitNodes">Recompute split node statistics as
+    /// well as leaf node statistics.</param>
+    /// <param name="progress">Progress reporting target.</param>
+    static void RefitForest(
+      Forest<F, S>& forest,
+      const IDataPointCollection& data,
+      RefitMode::e mode = RefitMode::Replace,
+      bool refitSplitNodes = false,
+      ProgressStream* progress=0 )
+    {
+      ProgressStream defaultProgressStream(std::cout, Interest);
+      progress = (progress==0)?&defaultProgressStream:progress;
+
+      // Get the trees up front (non-const Forest::GetTree() releases the
+      // forest's packed trees, so is not called concurrently)
+      std::vector<Tree<F,S>*> trees(forest.TreeCount());
+      for (int t = 0; t < forest.TreeCount(); t++)
+        trees[t] = &forest.GetTree(t);
+
+      (*progress)[Interest] << "Refitting " << forest.TreeCount() << " trees to " << data.Count() << " data points..." << std::endl;
+
+      // Trees are independent, so can be refitted concurrently
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for (int t = 0; t < forest.TreeCount(); t++)
+        RefitTree(*trees[t], data, mode, refitSplitNodes);
+
+      (*progress)[Interest] << "Refitted " << forest.TreeCount() << " trees." << std::endl;
+    }
+
+    /// <summary>
+    /// Refit a single tree. Leaf nodes reached by none of the new data points
+    /// keep their previous statistics, even in RefitMode::Replace, so that
+    /// every leaf retains a usable distribution.
+    /// </summary>
+    /// <param name="tree">The tree to be refitted.</param>
+    /// <param name="data">The new data.</param>
+    /// <param name="mode">How to combine new and previous statistics.</param>
+    /// <param name="refitSplitNodes">Recompute split node statistics as
+    /// well as leaf node statistics.</param>
+    static void RefitTree(
+      Tree<F, S>& tree,
+      const IDataPointCollection& data,
+      RefitMode::e mode = RefitMode::Replace,
+      bool refitSplitNodes = false )
+    {
+      std::vector<int> leafNodeIndices;
+      tree.Apply(data, leafNodeIndices);
+
+      std::vector<bool> reached(tree.NodeCount(), false);
+
+      for (unsigned int i = 0; i < data.Count(); i++)
+      {
+        int nodeIndex = leafNodeIndices[i];
+        Node<F, S>& node = tree.GetNode(nodeIndex);
+
+        if (reached[nodeIndex] == false)
+        {
+          if (mode == RefitMode::Replace)
+            node.TrainingDataStatistics.Clear();
+          reached[nodeIndex] = true;
+        }
+
+        node.TrainingDataStatistics.Aggregate(data, i);
+      }
+
+      if (refitSplitNodes == false)
+        return;
+
+      // Split node statistics are the union of those of their children so
+      // can be recomputed bottom up (children are stored after parents)
+      for (int nodeIndex = tree.NodeCount() - 1; nodeIndex >= 0; nodeIndex--)
+      {
+        Node<F, S>& node = tree.GetNode(nodeIndex);
+        if (node.IsSplit() == false)
+          continue;
+
+        node.TrainingDataStatistics.Clear();
+        node.TrainingDataStatistics.Aggregate(tree.GetNode(node.LeftChildIndex).TrainingDataStatistics);
+        node.TrainingDataStatistics.Aggregate(tree.GetNode(node.LeftChildIndex + 1).TrainingDataStatistics);
+      }
+    }
+  };
+} } }
@@ -9,13 +9,18 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <limits>
 
 #include "ProgressStream.h"
 
 #include "TrainingParameters.h"
+#include "FeatureCost.h"
+#include "CandidateThresholds.h"
+#include "TrainingMemoryEstimator.h"
 
 #include "Interfaces.h"
 #include "Tree.h"
+#include "ForestCheckpoint.h"
 
 namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 {
@@ -35,6 +40,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     Random& random_;
 
     const IDataPointCollection& data_;
+    unsigned int populationCount_;   // see constructor
 
     ITrainingContext<F, S>& trainingContext_;
 
@@ -50,18 +56,24 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     ProgressStream progress_;
 
   public:
+    // If data is a subset of the training data (as for OutOfCoreForestTrainer),
+    // populationCount is the size of the whole training set, so that the
+    // fractions of samples reaching nodes (see ComputeSplitScore()) are
+    // relative to that. Zero means data.Count().
     TreeTrainingOperation(
       Random& random,
       ITrainingContext<F, S>& trainingContext,
       const TrainingParameters& parameters,
       const IDataPointCollection& data,
-      ProgressStream& progress):
+      ProgressStream& progress,
+      unsigned int populationCount = 0):
     random_(random),
       data_(data),
       trainingContext_(trainingContext),
       progress_(progress)
     {
       parameters_ = parameters;
+      populationCount_ = (populationCount == 0) ? data.Count() : populationCount;
 
       indices_ .resize(data.Count());
       for (DataPointIndex i = 0; i < indices_.size(); i++)
@@ -82,14 +94,14 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     void TrainNodesRecurse(std::vector<Node<F, S> >& nodes, NodeIndex nodeIndex, DataPointIndex i0, DataPointIndex i1, int recurseDepth)
     {
       assert(nodeIndex < nodes.size());
-      progress_[Verbose] << Tree<F, S>::GetPrettyPrintPrefix(nodeIndex) << i1 - i0 << ": ";
+      progress_[Verbose] << Tree<F, S>::GetPrettyPrintPrefix(nodes, nodeIndex) << i1 - i0 << ": ";
 
       // First aggregate statistics over the samples at the parent node
       parentStatistics_.Clear();
       for (DataPointIndex i = i0; i < i1; i++)
         parentStatistics_.Aggregate(data_, indices_[i]);
 
-      if (nodeIndex >= nodes.size() / 2) // this is a leaf node, nothing else to do
+      if (recurseDepth >= parameters_.MaxDecisionLevels) // this is a leaf node, nothing else to do
       {
         nodes[nodeIndex].InitializeLeaf(parentStatistics_);
         progress_[Verbose] << "Terminating at max depth." << std::endl;
@@ -100,6 +112,92 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       F bestFeature;
       float bestThreshold = 0.0f;
 
+      if (parameters_.ExtremelyRandomized)
+        maxGain = ChooseExtremelyRandomizedSplit(i0, i1, bestFeature, bestThreshold);
+      else
+        maxGain = ChooseSplit(i0, i1, bestFeature, bestThreshold);
+
+      if (maxGain == 0.0)
+      {
+        nodes[nodeIndex].InitializeLeaf(parentStatistics_);
+        progress_[Verbose] << "Terminating with zero gain." << std::endl;
+        return;
+      }
+
+      // Now reorder the data point indices using the winning feature and thresholds.
+      // Also recompute child node statistics so the client can decide whether
+      // to terminate training of this branch.
+      leftChildStatistics_.Clear();
+      rightChildStatistics_.Clear();
+
+      for (DataPointIndex i = i0; i < i1; i++)
+      {
+        responses_[i] = bestFeature.GetResponse(data_, indices_[i]);
+        if (responses_[i] < bestThreshold)
+          leftChildStatistics_.Aggregate(data_, indices_[i]);
+        else
+          rightChildStatistics_.Aggregate(data_, indices_[i]);
+      }
+
+      if (trainingContext_.ShouldTerminate(parentStatistics_, leftChildStatistics_, rightChildStatistics_, maxGain))
+      {
+        nodes[nodeIndex].InitializeLeaf(parentStatistics_);
+        progress_[Verbose] << "Terminating with no split." << std::endl;
+        return;
+      }
+
+      // Otherwise this is a new decision node, recurse for children.
+      NodeIndex leftChildIndex = Tree<F, S>::InitializeSplit(nodes, nodeIndex, bestFeature, bestThreshold, parentStatistics_);
+
+      // Now do partition sort - any sample with response greater goes left, otherwise right
+      DataPointIndex ii = Tree<F, S>::Partition(responses_, indices_, i0, i1, bestThreshold);
+
+      assert(ii >= i0 && i1 >= ii);
+
+      progress_[Verbose] << " (threshold = " << bestThreshold << ", gain = "<< maxGain << ")." << std::endl;
+
+      TrainNodesRecurse(nodes, leftChildIndex, i0, ii, recurseDepth + 1);
+      TrainNodesRecurse(nodes, leftChildIndex + 1, ii, i1, recurseDepth + 1);
+    }
+
+    /// <summary>
+    /// Aggregate statistics over the samples indexed by GetIndices()[i0..i1)
+    /// and search for the split of those samples that maximizes information
+    /// gain. Used by trainers for structures other than Tree (e.g. DecisionDag)
+    /// that reuse the same split search.
+    /// </summary>
+    /// <returns>The gain of the best split found (zero if none).</returns>
+    double FindBestSplit(DataPointIndex i0, DataPointIndex i1, F& bestFeature, float& bestThreshold)
+    {
+      parentStatistics_.Clear();
+      for (DataPointIndex i = i0; i < i1; i++)
+        parentStatistics_.Aggregate(data_, indices_[i]);
+
+      if (parameters_.ExtremelyRandomized)
+        return ChooseExtremelyRandomizedSplit(i0, i1, bestFeature, bestThreshold);
+      else
+        return ChooseSplit(i0, i1, bestFeature, bestThreshold);
+    }
+
+    /// <summary>
+    /// The statistics aggregated by the last call to FindBestSplit().
+    /// </summary>
+    const S& GetParentStatistics() const { return parentStatistics_; }
+
+    /// <summary>
+    /// The permutation of data point indices over which node sample ranges are defined.
+    /// </summary>
+    std::vector<unsigned int>& GetIndices() { return indices_; }
+
+  private:
+    // Search over candidate features and thresholds for the binary partition
+    // of the samples in [i0, i1) that maximizes information gain (the
+    // parent statistics must already have been aggregated).
+    double ChooseSplit(DataPointIndex i0, DataPointIndex i1, F& bestFeature, float& bestThreshold)
+    {
+      double maxGain = 0.0, maxScore = 0.0;
+      double sampleFraction = (double)(i1 - i0) / populationCount_;
+
       // Iterate over candidate features
       std::vector<float> thresholds;
       for (int f = 0; f < parameters_.NumberOfCandidateFeatures; f++)
@@ -114,7 +212,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
           responses_[i] = feature.GetResponse(data_, indices_[i]);
 
         int nThresholds;
-        if ((nThresholds = ChooseCandidateThresholds(random_, &indices_[0], i0, i1, &responses_[0], thresholds)) == 0)
+        if ((nThresholds = ChooseCandidateThresholds(random_, responses_, i0, i1, parameters_.NumberOfCandidateThresholdsPerFeature, thresholds)) == 0)
           continue;
 
         // Aggregate statistics over sample partitions
@@ -141,9 +239,11 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
           // Compute gain over sample partitions
           double gain = trainingContext_.ComputeInformationGain(parentStatistics_, leftChildStatistics_, rightChildStatistics_);
+          double score = ComputeSplitScore(parameters_, gain, feature, sampleFraction);
 
-          if (gain >= maxGain)
+          if (score >= maxScore)
           {
+            maxScore = score;
             maxGain = gain;
             bestFeature = feature;
             bestThreshold = thresholds[t];
@@ -151,88 +251,63 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
         }
       }
 
-      if (maxGain == 0.0)
-      {
-        nodes[nodeIndex].InitializeLeaf(parentStatistics_);
-        progress_[Verbose] << "Terminating with zero gain." << std::endl;
-        return;
-      }
-
-      // Now reorder the data point indices using the winning feature and thresholds.
-      // Also recompute child node statistics so the client can decide whether
-      // to terminate training of this branch.
-      leftChildStatistics_.Clear();
-      rightChildStatistics_.Clear();
+      return maxGain;
+    }
 
-      for (DataPointIndex i = i0; i < i1; i++)
-      {
-        responses_[i] = bestFeature.GetResponse(data_, indices_[i]);
-        if (responses_[i] < bestThreshold)
-          leftChildStatistics_.Aggregate(data_, indices_[i]);
-        else
-          rightChildStatistics_.Aggregate(data_, indices_[i]);
-      }
+    // As ChooseSplit() but, as in extremely randomized trees, with a single
+    // threshold per candidate feature, drawn uniformly from the range of
+    // responses at this node. The response range is computed in the same
+    // pass as the responses themselves, and the candidate is evaluated
+    // using a single left/right aggregation (rather than by aggregating
+    // statistics over several partitions).
+    double ChooseExtremelyRandomizedSplit(DataPointIndex i0, DataPointIndex i1, F& bestFeature, float& bestThreshold)
+    {
+      double maxGain = 0.0, maxScore = 0.0;
+      double sampleFraction = (double)(i1 - i0) / populationCount_;
 
-      if (trainingContext_.ShouldTerminate(parentStatistics_, leftChildStatistics_, rightChildStatistics_, maxGain))
+      for (int f = 0; f < parameters_.NumberOfCandidateFeatures; f++)
       {
-        nodes[nodeIndex].InitializeLeaf(parentStatistics_);
-        progress_[Verbose] << "Terminating with no split." << std::endl;
-        return;
-      }
-
-      // Otherwise this is a new decision node, recurse for children.
-      nodes[nodeIndex].InitializeSplit(bestFeature, bestThreshold, parentStatistics_);
+        F feature = trainingContext_.GetRandomFeature(random_);
 
-      // Now do partition sort - any sample with response greater goes left, otherwise right
-      DataPointIndex ii = Tree<F, S>::Partition(responses_, indices_, i0, i1, bestThreshold);
+        // Compute feature response per samples at this node, and their range
+        float minResponse = std::numeric_limits<float>::infinity();
+        float maxResponse = -std::numeric_limits<float>::infinity();
+        for (DataPointIndex i = i0; i < i1; i++)
+        {
+          float response = feature.GetResponse(data_, indices_[i]);
+          responses_[i] = response;
+          minResponse = std::min(minResponse, response);
+          maxResponse = std::max(maxResponse, response);
+        }
 
-      assert(ii >= i0 && i1 >= ii);
+        if (!(maxResponse > minResponse))
+          continue;   // all response values were the same
 
-      progress_[Verbose] << " (threshold = " << bestThreshold << ", gain = "<< maxGain << ")." << std::endl;
+        float threshold = minResponse + (float)(random_.NextDouble() * (maxResponse - minResponse));
 
-      TrainNodesRecurse(nodes, nodeIndex * 2 + 1, i0, ii, recurseDepth + 1);
-      TrainNodesRecurse(nodes, nodeIndex * 2 + 2, ii, i1, recurseDepth + 1);
-    }
+        leftChildStatistics_.Clear();
+        rightChildStatistics_.Clear();
+        for (DataPointIndex i = i0; i < i1; i++)
+        {
+          if (responses_[i] < threshold)
+            leftChildStatistics_.Aggregate(data_, indices_[i]);
+          else
+            rightChildStatistics_.Aggregate(data_, indices_[i]);
+        }
 
-  private:
-    int ChooseCandidateThresholds(
-      Random& random,
-      unsigned int* dataIndices,
-      DataPointIndex i0,
-      DataPointIndex i1,
-      const float* responses,
-      std::vector<float>& thresholds)
-    {
-      thresholds.resize(parameters_.NumberOfCandidateThresholdsPerFeature + 1);
-      std::vector<float>& quantiles = thresholds; // shorthand, for code clarity - we reuse memory to avoid allocation
+        double gain = trainingContext_.ComputeInformationGain(parentStatistics_, leftChildStatistics_, rightChildStatistics_);
+        double score = ComputeSplitScore(parameters_, gain, feature, sampleFraction);
 
-      int nThresholds;
-      // If there are enough response values...
-      if (i1 - i0 > parameters_.NumberOfCandidateThresholdsPerFeature)
-      {
-        // ...make a random draw of NumberOfCandidateThresholdsPerFeature+1 response values
-        nThresholds = parameters_.NumberOfCandidateThresholdsPerFeature;
-        for (int i = 0; i < nThresholds + 1; i++)
-          quantiles[i] = responses[random.Next(i0, i1)]; // sample randomly from all responses
-      }
-      else
-      {
-        // ...otherwise use all response values.
-        nThresholds = i1 - i0 - 1;
-        std::copy(&responses[i0], &responses[i1], quantiles.begin());
+        if (score >= maxScore)
+        {
+          maxScore = score;
+          maxGain = gain;
+          bestFeature = feature;
+          bestThreshold = threshold;
+        }
       }
 
-      // Sort the response values to form approximate quantiles.
-      std::sort(quantiles.begin(), quantiles.end());
-
-      if (quantiles[0] == quantiles[nThresholds])
-        return 0;   // all sampled response values were the same
-
-      // Compute n candidate thresholds by sampling in between n+1 approximate quantiles
-      for (int i = 0; i < nThresholds; i++)
-        thresholds[i] = quantiles[i] + (float)(random_.NextDouble() * (quantiles[i + 1] - quantiles[i]));
-
-      return nThresholds;
+      return maxGain;
     }
   };
 
@@ -299,6 +374,12 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// the training problem, e.g. classification, density estimation, etc. </param>
     /// <param name="data">The training data.</param>
     /// <returns>A new decision forest.</returns>
+
+    // If parameters.CheckpointPath is set, training resumes from any existing
+    // checkpoint (written by a run with the same parameters and data) and a
+    // new checkpoint is written every parameters.CheckpointInterval trees,
+    // then deleted once the forest is complete. If parameters.MemoryBudget is
+    // set, training that would exceed it fails before any tree is trained.
     static std::auto_ptr<Forest<F,S> > TrainForest(
       Random& random,
       const TrainingParameters& parameters,
@@ -310,18 +391,76 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       if(progress==0)
         progress=&defaultProgress;
 
-      std::auto_ptr<Forest<F,S> > forest = std::auto_ptr<Forest<F,S> >(new Forest<F,S>());
+      TrainingMemoryEstimator<F,S>::CheckBudget(parameters, data, *progress);
+
+      std::auto_ptr<Forest<F,S> > forest;
+
+      // Resume an interrupted training run if there is a checkpoint to resume from
+      if (parameters.CheckpointPath!="" && ForestCheckpoint<F,S>::Load(parameters.CheckpointPath, parameters, data.Count(), random, forest))
+        (*progress)[Interest] << "Resuming from checkpoint with " << forest->TreeCount() << " trees." << std::endl;
+      else
+        forest = std::auto_ptr<Forest<F,S> >(new Forest<F,S>());
 
-      for (int t = 0; t < parameters.NumberOfTrees; t++)
+      for (int t = forest->TreeCount(); t < parameters.NumberOfTrees; t++)
       {
         (*progress)[Interest] << "\rTraining tree "<< t << "...";
 
         std::auto_ptr<Tree<F, S> > tree = TreeTrainer<F, S>::TrainTree(random, context, parameters, data, progress);
         forest->AddTree(tree);
+
+        if (parameters.CheckpointPath!="" && (t + 1) % std::max(parameters.CheckpointInterval, 1) == 0 && t + 1 < parameters.NumberOfTrees)
+          ForestCheckpoint<F,S>::Save(parameters.CheckpointPath, parameters, data.Count(), random, *forest);
       }
       (*progress)[Interest] << "\rTrained " << parameters.NumberOfTrees << " trees.         " << std::endl;
 
+      // The checkpoint is of no further use, and must not be mistaken for
+      // the start of a later run
+      if (parameters.CheckpointPath!="" && ForestCheckpoint<F,S>::Remove(parameters.CheckpointPath)==false)
+        (*progress)[Warning] << "Failed to delete checkpoint file " << parameters.CheckpointPath << "." << std::endl;
+
       return forest;
     }
+
+    /// <summary>
+    /// Grow an existing decision forest (e.g. one previously trained and
+    /// then loaded using Forest::Deserialize()) by training additional
+    /// trees until the forest contains parameters.NumberOfTrees trees.
+    /// </summary>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="context">An ITrainingContext instance describing
+    /// the training problem. This should be equivalent to the one used to
+    /// train the existing trees.</param>
+    /// <param name="data">The training data.</param>
+    /// <param name="forest">The forest to which new trees are added.</param>
+    static void GrowForest(
+      Random& random,
+      const TrainingParameters& parameters,
+      ITrainingContext<F,S>& context,
+      const IDataPointCollection& data,
+      Forest<F,S>& forest,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      int initialTreeCount = forest.TreeCount();
+
+      for (int t = initialTreeCount; t < parameters.NumberOfTrees; t++)
+      {
+        (*progress)[Interest] << "\rTraining tree "<< t << "...";
+
+        // Each new tree gets its own random stream, derived from the tree
+        // index as well as from the supplied generator, so that new trees
+        // don't replicate existing ones even if the supplied generator
+        // happens to have been seeded exactly as it was for the original run.
+        Random treeRandom(random.Next() ^ (0x9E3779B9u * (unsigned int)(t + 1)));
+
+        std::auto_ptr<Tree<F, S> > tree = TreeTrainer<F, S>::TrainTree(treeRandom, context, parameters, data, progress);
+        forest.AddTree(tree);
+      }
+      (*progress)[Interest] << "\rTrained " << forest.TreeCount() - initialTreeCount << " additional trees.         " << std::endl;
+    }
   };
 } } }
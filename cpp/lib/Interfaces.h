@@ -14,6 +14,10 @@
 // typically choose NOT to derive from these abstract base classes to avoid
 // the memory and performance overhead of a virtual function table pointer.
 
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
 namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 {
   /// <summary>
@@ -27,6 +31,28 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
   public:
     virtual ~IDataPointCollection() {};
     virtual unsigned int Count() const=0;
+
+    /// <summary>
+    /// Create a deep copy of the collection, e.g. so that each thread of a
+    /// ParallelTreeTrainer can read a copy held in its local NUMA node's
+    /// memory. The copy's memory should be first touched by the calling
+    /// thread. Implementation is optional.
+    /// </summary>
+    /// <returns>The copy, or null if copying is not supported.</returns>
+    virtual std::auto_ptr<IDataPointCollection> Clone() const
+    {
+      return std::auto_ptr<IDataPointCollection>();
+    }
+
+    /// <summary>
+    /// The approximate memory occupied by the data points (and so by a
+    /// Clone()), used by TrainingMemoryEstimator. Implementation is optional.
+    /// </summary>
+    /// <returns>The size in bytes, or zero if unknown.</returns>
+    virtual std::size_t GetMemoryUsage() const
+    {
+      return 0;
+    }
   };
 
   /// <summary>
@@ -131,5 +157,21 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// within a previous call to ISampleCollection.ComputeGain().</param>
     /// <returns>True if training should be terminated, false otherwise.</returns>
     virtual bool ShouldTerminate(const S& parent, const S& leftChild, const S& rightChild, double gain) = 0;
+
+    /// <summary>
+    /// Called by ForestPruner to compute the risk (e.g. the number of
+    /// misclassified data points) incurred on a set of data points by a leaf
+    /// node with the specified training data statistics. Risks must be
+    /// additive over disjoint sets of data points. Implementation is
+    /// optional (and required only for pruning).
+    /// </summary>
+    /// <param name="leaf">Training data statistics of the leaf node.</param>
+    /// <param name="data">Statistics aggregated over the data points that
+    /// reach the leaf, e.g. the training data themselves or held-out data.</param>
+    /// <returns>The total (rather than mean) risk over the data points.</returns>
+    virtual double ComputeRisk(const S& leaf, const S& data)
+    {
+      throw std::runtime_error("This training context does not support pruning.");
+    }
   };
 } } }
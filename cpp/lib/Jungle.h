@@ -0,0 +1,370 @@
+#pragma once
+
+// This file defines the DagNode, DecisionDag and Jungle classes, which are
+// used to represent decision jungles, i.e. ensembles of rooted decision
+// directed acyclic graphs (DAGs).
+
+#include <assert.h>
+#include <string.h>
+
+#include <memory>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "Interfaces.h"
+#include "Node.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// One node in a decision DAG. Unlike tree nodes, DAG nodes may have more
+  /// than one parent, so child node indices are stored explicitly.
+  /// </summary>
+  template<class F, class S>
+  struct DagNode : public Node<F,S> // where F : IFeatureResponse where S: IStatisticsAggregator<S>
+  {
+    // Index of the right child node (see Node::LeftChildIndex). Unlike in
+    // a tree, the right child need not follow the left. Only valid for
+    // split nodes.
+    int RightChildIndex;
+
+    DagNode()
+    {
+      RightChildIndex = -1;
+    }
+
+    void Serialize(std::ostream& o) const
+    {
+      Node<F,S>::Serialize(o);
+      Serialize_(o, this->LeftChildIndex);
+      Serialize_(o, RightChildIndex);
+    }
+
+    void Deserialize(std::istream& i)
+    {
+      Node<F,S>::Deserialize(i);
+      Deserialize_(i, this->LeftChildIndex);
+      Deserialize_(i, RightChildIndex);
+    }
+  };
+
+  /// <summary>
+  /// A decision DAG, i.e. a decision tree in which nodes may be shared
+  /// between several parents.
+  /// </summary>
+
+  // *** NB Nodes are stored level by level, root first, so that every
+  // child has a larger index than any of its parents. The number of nodes
+  // per level is bounded during training (see JungleTrainer.h), so the node
+  // count grows linearly rather than exponentially with depth.
+
+  template<class F, class S>
+  class DecisionDag // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    static const char* binaryFileHeader_;
+
+    std::vector<DagNode<F,S> > nodes_;
+
+  public:
+    // Implementation only
+    std::vector<DagNode<F,S> >& GetNodes() { return nodes_; }
+
+    /// <summary>
+    /// The number of nodes in the DAG.
+    /// </summary>
+    int NodeCount() const
+    {
+      return nodes_.size();
+    }
+
+    /// <summary>
+    /// Return the specified node.
+    /// </summary>
+    /// <param name="index">A zero-based node index.</param>
+    /// <returns>The node.</returns>
+    const DagNode<F,S>& GetNode(int index) const
+    {
+      return nodes_[index];
+    }
+
+    /// <summary>
+    /// Return the specified node.
+    /// </summary>
+    /// <param name="index">A zero-based node index.</param>
+    /// <returns>The node.</returns>
+    DagNode<F,S>& GetNode(int index)
+    {
+      return nodes_[index];
+    }
+
+    /// <summary>
+    /// Apply the decision DAG to a collection of test data points.
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="leafNodeIndices">Receives the index of the leaf node reached per data point.</param>
+    void Apply(const IDataPointCollection& data, std::vector<int>& leafNodeIndices) const
+    {
+      CheckValid();
+
+      leafNodeIndices.resize(data.Count());
+
+      for (unsigned int i = 0; i < data.Count(); i++)
+      {
+        int nodeIndex = 0;
+        while (nodes_[nodeIndex].IsSplit())
+        {
+          const DagNode<F,S>& node = nodes_[nodeIndex];
+          nodeIndex = (node.Feature.GetResponse(data, i) < node.Threshold) ? node.LeftChildIndex : node.RightChildIndex;
+        }
+        leafNodeIndices[i] = nodeIndex;
+      }
+    }
+
+    void Serialize(std::ostream& o) const
+    {
+      const int majorVersion = 0, minorVersion = 0;
+
+      o.write(binaryFileHeader_, strlen(binaryFileHeader_));
+      o.write((const char*)(&majorVersion), sizeof(majorVersion));
+      o.write((const char*)(&minorVersion), sizeof(minorVersion));
+
+      int nodeCount = NodeCount();
+      o.write((const char*)(&nodeCount), sizeof(nodeCount));
+
+      for(int n=0; n<NodeCount(); n++)
+        nodes_[n].Serialize(o);
+    }
+
+    static std::auto_ptr<DecisionDag<F,S> > Deserialize(std::istream& i)
+    {
+      std::auto_ptr<DecisionDag<F,S> > dag;
+
+      std::vector<char> buffer(strlen(binaryFileHeader_)+1);
+      i.read(&buffer[0], strlen(binaryFileHeader_));
+      buffer[buffer.size()-1] = '\0';
+
+      if(strcmp(&buffer[0], binaryFileHeader_)!=0)
+        throw std::runtime_error("Unsupported DAG format.");
+
+      int majorVersion = 0, minorVersion = 0;
+      i.read((char*)(&majorVersion), sizeof(majorVersion));
+      i.read((char*)(&minorVersion), sizeof(minorVersion));
+
+      if(majorVersion==0 && minorVersion==0)
+      {
+        int nodeCount;
+        i.read((char*)(&nodeCount), sizeof(nodeCount));
+
+        if(nodeCount<=0 || i.fail())
+          throw std::runtime_error("Invalid data");
+
+        dag = std::auto_ptr<DecisionDag<F,S> >(new DecisionDag<F, S>());
+        dag->nodes_.resize(nodeCount);
+
+        for(int n=0; n<nodeCount; n++)
+          dag->nodes_[n].Deserialize(i);
+
+        dag->CheckValid();
+      }
+      else
+        throw std::runtime_error("Unsupported file version number.");
+
+      return dag;
+    }
+
+    void CheckValid() const
+    {
+      if(NodeCount()==0)
+        throw std::runtime_error("Valid DAG must have at least one node.");
+
+      for(int n=0; n<NodeCount(); n++)
+      {
+        const DagNode<F,S>& node = GetNode(n);
+
+        if(node.IsNull())
+          throw std::runtime_error("Valid DAG must not contain null nodes.");
+
+        if(node.IsSplit())
+        {
+          // Requiring children to follow their parents also rules out cycles
+          if( node.LeftChildIndex<=n || node.LeftChildIndex>=NodeCount()
+            || node.RightChildIndex<=n || node.RightChildIndex>=NodeCount() )
+            throw std::runtime_error("Valid DAG must have child nodes stored after their parents.");
+        }
+      }
+    }
+  };
+
+  template<class F, class S>
+  const char* DecisionDag<F,S>::binaryFileHeader_ = "MicrosoftResearch.Cambridge.Sherwood.Dag";
+
+  /// <summary>
+  /// A decision jungle, i.e. a collection of decision DAGs.
+  /// </summary>
+  template<class F, class S>
+  class Jungle // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    static const char* binaryFileHeader_;
+
+    std::vector< DecisionDag<F,S>* > dags_;
+
+  public:
+    typedef typename std::vector< DecisionDag<F,S>* >::size_type DagIndex;
+
+    ~Jungle()
+    {
+      for(DagIndex d=0; d<dags_.size(); d++)
+        delete dags_[d];
+    }
+
+    /// <summary>
+    /// Add another DAG to the jungle.
+    /// </summary>
+    /// <param name="dag">The DAG.</param>
+    void AddDag(std::auto_ptr<DecisionDag<F,S> > dag)
+    {
+      dag->CheckValid();
+
+      dags_.push_back(dag.get());
+      dag.release();
+    }
+
+    /// <summary>
+    /// Deserialize a jungle from a file.
+    /// </summary>
+    /// <param name="path">The file path.</param>
+    /// <returns>The jungle.</returns>
+    static std::auto_ptr<Jungle<F, S> > Deserialize(const std::string& path)
+    {
+      std::ifstream i(path.c_str(), std::ios_base::binary);
+
+      return Jungle<F,S>::Deserialize(i);
+    }
+
+    /// <summary>
+    /// Deserialize a jungle from a binary stream.
+    /// </summary>
+    /// <param name="stream">The stream.</param>
+    /// <returns>The jungle.</returns>
+    static std::auto_ptr<Jungle<F, S> > Deserialize(std::istream& i)
+    {
+      std::auto_ptr<Jungle<F, S> > jungle = std::auto_ptr<Jungle<F, S> >(new Jungle<F,S>());
+
+      std::vector<char> buffer(strlen(binaryFileHeader_)+1);
+      i.read(&buffer[0], strlen(binaryFileHeader_));
+      buffer[buffer.size()-1] = '\0';
+
+      if(strcmp(&buffer[0], binaryFileHeader_)!=0)
+        throw std::runtime_error("Unsupported jungle format.");
+
+      int majorVersion = 0, minorVersion = 0;
+      i.read((char*)(&majorVersion), sizeof(majorVersion));
+      i.read((char*)(&minorVersion), sizeof(minorVersion));
+
+      if(majorVersion==0 && minorVersion==0)
+      {
+        int dagCount;
+        i.read((char*)(&dagCount), sizeof(dagCount));
+
+        for(int d=0; d<dagCount; d++)
+          jungle->AddDag(DecisionDag<F, S>::Deserialize(i));
+      }
+      else
+        throw std::runtime_error("Unsupported file version number.");
+
+      return jungle;
+    }
+
+    /// <summary>
+    /// Serialize the jungle to file.
+    /// </summary>
+    /// <param name="path">The file path.</param>
+    void Serialize(const std::string& path) const
+    {
+      std::ofstream o(path.c_str(), std::ios_base::binary);
+      Serialize(o);
+    }
+
+    /// <summary>
+    /// Serialize the jungle to a binary stream.
+    /// </summary>
+    /// <param name="stream">The stream.</param>
+    void Serialize(std::ostream& stream) const
+    {
+      const int majorVersion = 0, minorVersion = 0;
+
+      stream.write(binaryFileHeader_, strlen(binaryFileHeader_));
+      stream.write((const char*)(&majorVersion), sizeof(majorVersion));
+      stream.write((const char*)(&minorVersion), sizeof(minorVersion));
+
+      int dagCount = DagCount();
+      stream.write((const char*)(&dagCount), sizeof(dagCount));
+
+      for(int d=0; d<DagCount(); d++)
+        GetDag(d).Serialize(stream);
+
+      if(stream.bad())
+        throw std::runtime_error("Jungle serialization failed.");
+    }
+
+    /// <summary>
+    /// Access the specified DAG.
+    /// </summary>
+    /// <param name="index">A zero-based integer index.</param>
+    /// <returns>The DAG.</returns>
+    const DecisionDag<F,S>& GetDag(int index) const
+    {
+      return *dags_[index];
+    }
+
+    /// <summary>
+    /// Access the specified DAG.
+    /// </summary>
+    /// <param name="index">A zero-based integer index.</param>
+    /// <returns>The DAG.</returns>
+    DecisionDag<F,S>& GetDag(int index)
+    {
+      return *dags_[index];
+    }
+
+    /// <summary>
+    /// How many DAGs in the jungle?
+    /// </summary>
+    int DagCount() const
+    {
+      return dags_.size();
+    }
+
+    /// <summary>
+    /// Apply all DAGs to a set of data points.
+    /// </summary>
+    /// <param name="data">The data points.</param>
+    /// <param name="leafNodeIndices">Receives the leaf node index per DAG per data point.</param>
+    void Apply(
+      const IDataPointCollection& data,
+      std::vector<std::vector<int> >& leafNodeIndices,
+      ProgressStream* progress=0 ) const
+    {
+      ProgressStream defaultProgressStream(std::cout, Interest);
+      progress = (progress==0)?&defaultProgressStream:progress;
+
+      leafNodeIndices.resize(DagCount());
+
+      for (int d = 0; d < DagCount(); d++)
+      {
+        (*progress)[Interest] << "\rApplying DAG " << d << "...";
+        dags_[d]->Apply(data, leafNodeIndices[d]);
+      }
+
+      (*progress)[Interest] << "\rApplied " << DagCount() << " DAGs.        " << std::endl;
+    }
+  };
+
+  template<class F, class S>
+  const char* Jungle<F,S>::binaryFileHeader_ = "MicrosoftResearch.Cambridge.Sherwood.Jungle";
+} } }
@@ -0,0 +1,406 @@
+#pragma once
+
+// This file defines the DagTrainer and JungleTrainer classes, which are
+// responsible for learning decision DAGs and jungles (see Jungle.h) from
+// training data.
+
+#include <assert.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "TrainingParameters.h"
+
+#include "Interfaces.h"
+#include "ForestTrainer.h"
+#include "Jungle.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Decision DAG training operation - used internally within DagTrainer to
+  /// encapsulate the training of a single DAG.
+  /// </summary>
+
+  // *** NB DAGs are trained one level at a time. The best split for each
+  // node at the current level is found exactly as in tree training (using
+  // TreeTrainingOperation). The resulting candidate child nodes are then
+  // merged greedily until no more than maxWidth remain, each time merging
+  // the pair A, B whose separation is worth least, i.e. that minimizes
+  // (|A|+|B|)/N * ComputeInformationGain(A+B, A, B). Unlike the original
+  // decision jungle formulation, split parameters are not re-optimized
+  // after merging.
+
+  template<class F, class S>
+  class DagTrainingOperation // where F : IFeatureResponse where S : IStatisticsAggregator<S>
+  {
+  private:
+    typedef typename std::vector<unsigned int>::size_type DataPointIndex;
+
+    const IDataPointCollection& data_;
+
+    ITrainingContext<F, S>& trainingContext_;
+
+    TrainingParameters parameters_;
+
+    int maxWidth_;
+
+    ProgressStream& progress_;
+
+    TreeTrainingOperation<F, S> splitSearch_;
+
+  public:
+    DagTrainingOperation(
+      Random& random,
+      ITrainingContext<F, S>& trainingContext,
+      const TrainingParameters& parameters,
+      int maxWidth,
+      const IDataPointCollection& data,
+      ProgressStream& progress ):
+    data_(data),
+      trainingContext_(trainingContext),
+      maxWidth_(maxWidth),
+      progress_(progress),
+      splitSearch_(random, trainingContext, parameters, data, progress)
+    {
+      parameters_ = parameters;
+
+      if (maxWidth_ < 1)
+        throw std::runtime_error("Maximum DAG width must be at least one.");
+    }
+
+    void Train(DecisionDag<F, S>& dag)
+    {
+      std::vector<DagNode<F, S> >& nodes = dag.GetNodes();
+      std::vector<unsigned int>& indices = splitSearch_.GetIndices();
+
+      // The nodes at the current level, and the range of (permuted) data
+      // point indices reaching each of them
+      std::vector<int> levelNodes(1, 0);
+      std::vector<DataPointIndex> levelStarts(1, 0), levelEnds(1, data_.Count());
+
+      nodes.assign(1, DagNode<F, S>());
+
+      std::vector<int> splitNodes;                  // level node positions that were split
+      std::vector<S> childStatistics;               // two candidate children per split
+      std::vector<unsigned int> childCounts;
+      std::vector<int> groups;                      // merged node per candidate child
+      std::vector<int> sampleGroups(data_.Count());
+      std::vector<unsigned int> permutedIndices(data_.Count());
+
+      S leftChildStatistics = trainingContext_.GetStatisticsAggregator();
+      S rightChildStatistics = trainingContext_.GetStatisticsAggregator();
+
+      for (int level = 0; levelNodes.size() > 0; level++)
+      {
+        splitNodes.clear();
+        childStatistics.clear();
+        childCounts.clear();
+
+        for (int k = 0; k < (int)(levelNodes.size()); k++)
+        {
+          DagNode<F, S>& node = nodes[levelNodes[k]];
+          DataPointIndex i0 = levelStarts[k], i1 = levelEnds[k];
+
+          progress_[Verbose] << "Level " << level << ", node " << levelNodes[k] << ", " << i1 - i0 << ": ";
+
+          F bestFeature;
+          float bestThreshold = 0.0f;
+          double gain = 0.0;
+
+          S parentStatistics;
+          if (level < parameters_.MaxDecisionLevels && i1 - i0 > 1)
+          {
+            gain = splitSearch_.FindBestSplit(i0, i1, bestFeature, bestThreshold);
+            parentStatistics = splitSearch_.GetParentStatistics().DeepClone();
+          }
+          else
+          {
+            parentStatistics = trainingContext_.GetStatisticsAggregator();
+            for (DataPointIndex i = i0; i < i1; i++)
+              parentStatistics.Aggregate(data_, indices[i]);
+          }
+
+          if (gain == 0.0)
+          {
+            node.InitializeLeaf(parentStatistics);
+            progress_[Verbose] << (level >= parameters_.MaxDecisionLevels ? "Terminating at max depth." : "Terminating with zero gain.") << std::endl;
+            continue;
+          }
+
+          leftChildStatistics.Clear();
+          rightChildStatistics.Clear();
+          for (DataPointIndex i = i0; i < i1; i++)
+          {
+            if (bestFeature.GetResponse(data_, indices[i]) < bestThreshold)
+              leftChildStatistics.Aggregate(data_, indices[i]);
+            else
+              rightChildStatistics.Aggregate(data_, indices[i]);
+          }
+
+          if (trainingContext_.ShouldTerminate(parentStatistics, leftChildStatistics, rightChildStatistics, gain))
+          {
+            node.InitializeLeaf(parentStatistics);
+            progress_[Verbose] << "Terminating with no split." << std::endl;
+            continue;
+          }
+
+          node.InitializeSplit(bestFeature, bestThreshold, parentStatistics, -1);   // children are assigned below
+          progress_[Verbose] << " (threshold = " << bestThreshold << ", gain = "<< gain << ")." << std::endl;
+
+          splitNodes.push_back(k);
+          childStatistics.push_back(leftChildStatistics.DeepClone());
+          childStatistics.push_back(rightChildStatistics.DeepClone());
+          childCounts.push_back(0);
+          childCounts.push_back(0);
+
+          // Remember which candidate child each sample goes to
+          for (DataPointIndex i = i0; i < i1; i++)
+          {
+            int side = (bestFeature.GetResponse(data_, indices[i]) < bestThreshold) ? 0 : 1;
+            sampleGroups[i] = 2 * (splitNodes.size() - 1) + side;
+            childCounts[sampleGroups[i]]++;
+          }
+        }
+
+        if (splitNodes.size() == 0)
+          break;
+
+        int nGroups = MergeCandidates(childStatistics, childCounts, groups);
+
+        // Create the nodes at the next level and link them to their parents
+        int firstNode = nodes.size();
+        nodes.resize(firstNode + nGroups);
+
+        for (unsigned int s = 0; s < splitNodes.size(); s++)
+        {
+          DagNode<F, S>& parent = nodes[levelNodes[splitNodes[s]]];
+          parent.LeftChildIndex = firstNode + groups[2 * s];
+          parent.RightChildIndex = firstNode + groups[2 * s + 1];
+        }
+
+        // Regroup the data point indices by node at the next level (counting
+        // sort). Samples that reached a leaf take no further part.
+        std::vector<DataPointIndex> counts(nGroups + 1, 0);
+        for (unsigned int s = 0; s < splitNodes.size(); s++)
+        {
+          int k = splitNodes[s];
+          for (DataPointIndex i = levelStarts[k]; i < levelEnds[k]; i++)
+          {
+            sampleGroups[i] = groups[sampleGroups[i]];
+            counts[sampleGroups[i] + 1]++;
+          }
+        }
+
+        for (int g = 0; g < nGroups; g++)
+          counts[g + 1] += counts[g];
+
+        std::vector<DataPointIndex> nextStarts(counts.begin(), counts.end() - 1), nextEnds(counts.begin() + 1, counts.end());
+
+        for (unsigned int s = 0; s < splitNodes.size(); s++)
+        {
+          int k = splitNodes[s];
+          for (DataPointIndex i = levelStarts[k]; i < levelEnds[k]; i++)
+            permutedIndices[counts[sampleGroups[i]]++] = indices[i];
+        }
+        std::copy(permutedIndices.begin(), permutedIndices.begin() + nextEnds[nGroups - 1], indices.begin());
+
+        levelNodes.resize(nGroups);
+        for (int g = 0; g < nGroups; g++)
+          levelNodes[g] = firstNode + g;
+        levelStarts.swap(nextStarts);
+        levelEnds.swap(nextEnds);
+      }
+    }
+
+  private:
+    // Merge candidate child nodes until there are no more than maxWidth_,
+    // returning the number of merged nodes and the merged node index per
+    // candidate.
+    int MergeCandidates(
+      const std::vector<S>& candidateStatistics,
+      const std::vector<unsigned int>& candidateCounts,
+      std::vector<int>& groups )
+    {
+      int n = candidateStatistics.size();
+
+      groups.resize(n);
+      for (int c = 0; c < n; c++)
+        groups[c] = c;
+
+      if (n <= maxWidth_)
+        return n;
+
+      std::vector<S> statistics(n);
+      std::vector<unsigned int> counts(candidateCounts);
+      std::vector<bool> alive(n, true);
+      for (int c = 0; c < n; c++)
+        statistics[c] = candidateStatistics[c].DeepClone();
+
+      // Cost of merging each pair of (alive) groups
+      std::vector<double> costs(n * n, 0.0);
+      for (int a = 0; a < n; a++)
+        for (int b = a + 1; b < n; b++)
+          costs[a * n + b] = MergeCost(statistics[a], counts[a], statistics[b], counts[b]);
+
+      for (int nAlive = n; nAlive > maxWidth_; nAlive--)
+      {
+        int bestA = -1, bestB = -1;
+        double minCost = std::numeric_limits<double>::infinity();
+        for (int a = 0; a < n; a++)
+        {
+          if (!alive[a])
+            continue;
+          for (int b = a + 1; b < n; b++)
+          {
+            if (alive[b] && costs[a * n + b] < minCost)
+            {
+              minCost = costs[a * n + b];
+              bestA = a;
+              bestB = b;
+            }
+          }
+        }
+
+        // Merge B into A
+        statistics[bestA].Aggregate(statistics[bestB]);
+        counts[bestA] += counts[bestB];
+        alive[bestB] = false;
+        for (int c = 0; c < n; c++)
+          if (groups[c] == bestB)
+            groups[c] = bestA;
+
+        for (int c = 0; c < n; c++)
+        {
+          if (!alive[c] || c == bestA)
+            continue;
+          double cost = MergeCost(statistics[bestA], counts[bestA], statistics[c], counts[c]);
+          costs[std::min(c, bestA) * n + std::max(c, bestA)] = cost;
+        }
+      }
+
+      // Renumber the surviving groups consecutively
+      std::vector<int> renumbered(n, -1);
+      int nGroups = 0;
+      for (int c = 0; c < n; c++)
+        if (alive[c])
+          renumbered[c] = nGroups++;
+      for (int c = 0; c < n; c++)
+        groups[c] = renumbered[groups[c]];
+
+      return nGroups;
+    }
+
+    double MergeCost(const S& a, unsigned int countA, const S& b, unsigned int countB)
+    {
+      if (countA + countB == 0)
+        return 0.0;
+
+      S merged = a.DeepClone();
+      merged.Aggregate(b);
+
+      return (double)(countA + countB) / data_.Count() * trainingContext_.ComputeInformationGain(merged, a, b);
+    }
+  };
+
+  /// <summary>
+  /// Used to train decision DAGs.
+  /// </summary>
+  template<class F, class S>
+  class DagTrainer
+  {
+  public:
+    /// <summary>
+    /// Train a new decision DAG given some training data and a training
+    /// problem described by an ITrainingContext instance.
+    /// </summary>
+    /// <param name="random">The single random number generator.</param>
+    /// <param name="context">The ITrainingContext instance by which
+    /// the training framework interacts with the training data.
+    /// Implemented within client code.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="maxWidth">The maximum number of nodes per DAG level.</param>
+    /// <param name="data">The training data.</param>
+    /// <param name="progress">Progress reporting target.</param>
+    /// <returns>A new decision DAG.</returns>
+    static std::auto_ptr<DecisionDag<F, S> > TrainDag(
+      Random& random,
+      ITrainingContext<F, S>& context,
+      const TrainingParameters& parameters,
+      int maxWidth,
+      const IDataPointCollection& data,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      DagTrainingOperation<F, S> trainingOperation(random, context, parameters, maxWidth, data, *progress);
+
+      std::auto_ptr<DecisionDag<F, S> > dag = std::auto_ptr<DecisionDag<F, S> >(new DecisionDag<F,S>());
+
+      (*progress)[Verbose] << std::endl;
+
+      trainingOperation.Train(*dag);
+
+      (*progress)[Verbose] << std::endl;
+
+      dag->CheckValid();
+
+      return dag;
+    }
+  };
+
+  /// <summary>
+  /// Learns new decision jungles from training data.
+  /// </summary>
+  template<class F, class S>
+  class JungleTrainer // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// Train a new decision jungle of parameters.NumberOfTrees DAGs given
+    /// some training data and a training problem described by an instance
+    /// of the ITrainingContext interface.
+    /// </summary>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="maxWidth">The maximum number of nodes per DAG level.</param>
+    /// <param name="context">An ITrainingContext instance describing
+    /// the training problem, e.g. classification, density estimation, etc. </param>
+    /// <param name="data">The training data.</param>
+    /// <returns>A new decision jungle.</returns>
+    static std::auto_ptr<Jungle<F,S> > TrainJungle(
+      Random& random,
+      const TrainingParameters& parameters,
+      int maxWidth,
+      ITrainingContext<F,S>& context,
+      const IDataPointCollection& data,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      std::auto_ptr<Jungle<F,S> > jungle = std::auto_ptr<Jungle<F,S> >(new Jungle<F,S>());
+
+      int nodeCount = 0;
+      for (int d = 0; d < parameters.NumberOfTrees; d++)
+      {
+        (*progress)[Interest] << "\rTraining DAG "<< d << "...";
+
+        std::auto_ptr<DecisionDag<F, S> > dag = DagTrainer<F, S>::TrainDag(random, context, parameters, maxWidth, data, progress);
+        nodeCount += dag->NodeCount();
+        jungle->AddDag(dag);
+      }
+      (*progress)[Interest] << "\rTrained " << parameters.NumberOfTrees << " DAGs (" << nodeCount << " nodes).         " << std::endl;
+
+      return jungle;
+    }
+  };
+} } }
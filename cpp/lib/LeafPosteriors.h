@@ -0,0 +1,186 @@
+#pragma once
+
+// This file defines the LeafPosteriors class, which precomputes a dense
+// posterior vector per leaf of a trained forest so that prediction needs
+// only to gather and add them.
+
+#include <cmath>
+
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include "Interfaces.h"
+#include "Forest.h"
+#include "PackedTree.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// A finalized form of a trained forest for prediction: the training data
+  /// statistics at each leaf are converted (once) to a dense vector of
+  /// floats, e.g. the class posterior p(c|leaf), and the prediction for a
+  /// data point is the mean of the vectors of the leaves it reaches.
+  /// </summary>
+
+  // *** NB Converting statistics up front removes all per-prediction work
+  // other than traversal and a sum of TreeCount() float vectors (no
+  // aggregation of integer histograms, and no division). Each leaf's vector
+  // is padded to a multiple of four floats so that rows are 16-byte aligned
+  // and the summation loop vectorizes. Leaves are indexed as in the
+  // forest's PackedTree copies, which are built (if necessary) by the
+  // constructor and used directly thereafter, so the forest must outlive,
+  // and not be modified during the lifetime of, this object.
+
+  template<class F, class S>
+  class LeafPosteriors // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    const Forest<F,S>& forest_;
+    std::vector<const PackedTree<F,S>*> trees_;   // the forest's packed trees
+
+    int dimension_, stride_;
+    bool logarithmic_;
+
+    std::vector<std::vector<float> > leafPosteriors_;  // per tree, stride_ floats per leaf
+
+  public:
+    /// <summary>
+    /// Finalize a trained forest.
+    /// </summary>
+    /// <param name="forest">The forest.</param>
+    /// <param name="dimension">The length of the posterior vectors.</param>
+    /// <param name="posterior">A function object, called as posterior(s, p),
+    /// that writes the posterior vector for leaf statistics s to p[0] ...
+    /// p[dimension-1].</param>
+    /// <param name="logarithmic">Store (and sum) the logarithms of the
+    /// posteriors instead, e.g. to combine trees by a product of experts.</param>
+    template<class P>
+    LeafPosteriors(const Forest<F,S>& forest, int dimension, P posterior, bool logarithmic=false):
+      forest_(forest), dimension_(dimension), logarithmic_(logarithmic)
+    {
+      if (forest.TreeCount() == 0)
+        throw std::runtime_error("Can't finalize a forest with no trees.");
+      if (dimension <= 0)
+        throw std::runtime_error("Posterior vectors must have at least one element.");
+
+      stride_ = (dimension + 3) & ~3;
+
+      leafPosteriors_.resize(forest.TreeCount());
+      for (int t = 0; t < forest.TreeCount(); t++)
+      {
+        const PackedTree<F,S>& tree = forest.GetPackedTree(t);
+        trees_.push_back(&tree);
+
+        leafPosteriors_[t].assign(tree.LeafCount() * stride_, 0.0f);
+        for (int l = 0; l < tree.LeafCount(); l++)
+        {
+          float* p = &leafPosteriors_[t][l * stride_];
+          posterior(tree.GetLeafStatistics(l), p);
+
+          if (logarithmic_)
+            for (int c = 0; c < dimension_; c++)
+              p[c] = (float)(log(std::max(p[c], 1e-30f)));
+        }
+      }
+    }
+
+    /// <summary>
+    /// The finalized forest.
+    /// </summary>
+    const Forest<F,S>& GetForest() const
+    {
+      return forest_;
+    }
+
+    /// <summary>
+    /// The length of the posterior vectors.
+    /// </summary>
+    int Dimension() const
+    {
+      return dimension_;
+    }
+
+    /// <summary>
+    /// Are the posteriors stored (and predicted) as logarithms?
+    /// </summary>
+    bool IsLogarithmic() const
+    {
+      return logarithmic_;
+    }
+
+    /// <summary>
+    /// The posterior vector of the specified leaf.
+    /// </summary>
+    /// <param name="treeIndex">A zero-based tree index.</param>
+    /// <param name="leafIndex">A zero-based leaf index (see PackedTree).</param>
+    const float* GetLeafPosterior(int treeIndex, int leafIndex) const
+    {
+      return &leafPosteriors_[treeIndex][leafIndex * stride_];
+    }
+
+    /// <summary>
+    /// Predict the posterior of a single data point (as Predict(), but
+    /// without allocating memory).
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="dataIndex">The index of the data point to be evaluated.</param>
+    /// <param name="posterior">Receives Dimension() floats.</param>
+    void PredictOne(const IDataPointCollection& data, unsigned int dataIndex, float* posterior) const
+    {
+      for (int c = 0; c < dimension_; c++)
+        posterior[c] = 0.0f;
+
+      for (unsigned int t = 0; t < trees_.size(); t++)
+      {
+        const float* p = &leafPosteriors_[t][trees_[t]->FindLeaf(data, dataIndex) * stride_];
+        for (int c = 0; c < dimension_; c++)
+          posterior[c] += p[c];
+      }
+
+      float scale = 1.0f / trees_.size();
+      for (int c = 0; c < dimension_; c++)
+        posterior[c] *= scale;
+    }
+
+    /// <summary>
+    /// Predict the posterior of each of a collection of data points, i.e. the
+    /// mean over trees of the posterior of the leaf reached.
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="posteriors">Receives Dimension() floats per data point.</param>
+    void Predict(const IDataPointCollection& data, std::vector<float>& posteriors) const
+    {
+      std::vector<float> sums(data.Count() * stride_, 0.0f);
+      if (data.Count() == 0)
+      {
+        posteriors.clear();
+        return;
+      }
+
+      std::vector<int> leafIndices(data.Count());
+
+      // One tree at a time, so that its split records and leaf table stay
+      // in cache
+      for (unsigned int t = 0; t < trees_.size(); t++)
+      {
+        const float* table = &leafPosteriors_[t][0];
+
+        trees_[t]->FindLeaves(data, 0, data.Count(), &leafIndices[0]);
+        for (unsigned int i = 0; i < data.Count(); i++)
+        {
+          const float* p = table + leafIndices[i] * stride_;
+          float* sum = &sums[i * stride_];
+          for (int c = 0; c < stride_; c++)
+            sum[c] += p[c];
+        }
+      }
+
+      float scale = 1.0f / trees_.size();
+
+      posteriors.resize(data.Count() * dimension_);
+      for (unsigned int i = 0; i < data.Count(); i++)
+        for (int c = 0; c < dimension_; c++)
+          posteriors[i * dimension_ + c] = sums[i * stride_ + c] * scale;
+    }
+  };
+} } }
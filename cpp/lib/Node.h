@@ -36,10 +36,9 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
   template<class F, class S>
   struct Node // where F : IFeatureResponse where S: IStatisticsAggregator<S>
   {
-    // NB Null nodes (i.e. uninitialized nodes corresponding to the bottom of
-    // a tree branch for which training was terminated before maximum tree
-    // depth) have bIsleaf==bIsSplit_==false. Please see IsSplit(),
-    // IsLeaf(), IsNull(), below.
+    // NB Null nodes (i.e. uninitialized nodes, e.g. the children of a split
+    // node that have not yet been trained) have bIsleaf==bIsSplit_==false.
+    // Please see IsSplit(), IsLeaf(), IsNull(), below.
 
     bool bIsLeaf_;
     bool bIsSplit_;
@@ -51,6 +50,11 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
     float Threshold;
 
+    // The index of the left child of a split node within the tree's node
+    // array. The right child immediately follows it. Children are always
+    // stored after their parent. Only valid for split nodes.
+    int LeftChildIndex;
+
     // NB We store training data statistics for all nodes, including
     // decision nodes - this way we can prune the tree subsequent to
     // training.
@@ -61,17 +65,19 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     {
       Feature = F();
       Threshold = 0.0f;
+      LeftChildIndex = -1;
       bIsLeaf_ = true;
       bIsSplit_ = false;
       TrainingDataStatistics = trainingDataStatistics.DeepClone();
     }
 
-    void InitializeSplit(F feature, float threshold, S trainingDataStatistics)
+    void InitializeSplit(F feature, float threshold, S trainingDataStatistics, int leftChildIndex)
     {
       bIsLeaf_ = false;
       bIsSplit_ = true;
       Feature = feature;
       Threshold = threshold;
+      LeftChildIndex = leftChildIndex;
       TrainingDataStatistics = trainingDataStatistics.DeepClone();
     }
 
@@ -80,24 +86,28 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       // Nodes are created null by default
       bIsLeaf_ = false;
       bIsSplit_ = false;
+      Threshold = 0.0f;
+      LeftChildIndex = -1;
     }
 
-    void Serialize(std::ostream& o) const
+    void Serialize(std::ostream& o, bool bIncludeStatistics=true) const
     {
       Serialize_(o, bIsLeaf_);
       Serialize_(o, bIsSplit_);
       Serialize_(o, Feature);
       Serialize_(o, Threshold);
-      Serialize_(o, TrainingDataStatistics);
+      if (bIncludeStatistics)
+        Serialize_(o, TrainingDataStatistics);
     }
 
-    void Deserialize(std::istream& i)
+    void Deserialize(std::istream& i, bool bIncludeStatistics=true)
     {
       Deserialize_(i, bIsLeaf_);
       Deserialize_(i, bIsSplit_);
       Deserialize_(i, Feature);
       Deserialize_(i, Threshold);
-      Deserialize_(i, TrainingDataStatistics);
+      if (bIncludeStatistics)
+        Deserialize_(i, TrainingDataStatistics);
     }
 
     /// <summary>
@@ -0,0 +1,370 @@
+#pragma once
+
+// This file defines the OnlineForestTrainer class, which grows decision
+// forests incrementally from a stream of training data points.
+
+#include <math.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "TrainingParameters.h"
+
+#include "Interfaces.h"
+#include "Random.h"
+#include "Tree.h"
+#include "Forest.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// Parameters controlling online (Hoeffding tree) training, in addition to
+  /// TrainingParameters.
+  /// </summary>
+  struct OnlineTrainingParameters
+  {
+    OnlineTrainingParameters()
+    {
+      GracePeriod = 200;
+      Delta = 1e-7;
+      TieThreshold = 0.05;
+      GainRange = 1.0;
+      Bagging = true;
+    }
+
+    // Number of data points a leaf sees between split attempts.
+    int GracePeriod;
+
+    // Probability that the split chosen differs from the one that would
+    // be chosen given infinite data.
+    double Delta;
+
+    // Split anyway once the Hoeffding bound falls below this value, i.e.
+    // when the best candidates are too close to separate.
+    double TieThreshold;
+
+    // The range of ComputeInformationGain(), e.g. log2(number of classes)
+    // for entropy gain in bits.
+    double GainRange;
+
+    // Use online bagging, i.e. present each data point to each tree k times,
+    // k ~ Poisson(1).
+    bool Bagging;
+  };
+
+  /// <summary>
+  /// Learns decision forests online, i.e. from data points that are presented
+  /// one at a time (or in small batches) and then discarded. Each leaf
+  /// accumulates statistics for a fixed set of candidate splits, and is split
+  /// once the Hoeffding bound shows (with probability 1-Delta) that the best
+  /// candidate feature beats the runner-up feature. The forest is valid, and
+  /// can be applied, at any time.
+  /// </summary>
+
+  // *** NB Candidate thresholds are the responses of the first
+  // NumberOfCandidateThresholdsPerFeature data points to reach a leaf. Because
+  // every data point seen before a threshold is added has a response equal to
+  // an existing threshold, adding a threshold never splits the data already
+  // aggregated into a bin, so bin statistics stay exact.
+
+  template<class F, class S>
+  class OnlineForestTrainer // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    struct CandidateFeature
+    {
+      F Feature;
+      std::vector<float> Thresholds;     // sorted
+      std::vector<S> BinStatistics;      // Thresholds.size()+1 bins
+    };
+
+    struct LeafState
+    {
+      std::vector<CandidateFeature> Candidates;
+      unsigned int SamplesSinceLastAttempt;
+      unsigned int SampleCount;
+      int Depth;
+    };
+
+    typedef std::map<int, LeafState> LeafStates;
+
+    Random& random_;
+
+    TrainingParameters parameters_;
+    OnlineTrainingParameters onlineParameters_;
+
+    ITrainingContext<F, S>& trainingContext_;
+
+    std::auto_ptr<Forest<F, S> > forest_;
+
+    std::vector<LeafStates> leafStates_;   // per tree
+
+    ProgressStream defaultProgress_;
+    ProgressStream* progress_;
+
+    S leftChildStatistics_, rightChildStatistics_;
+
+  public:
+    /// <summary>
+    /// Start training a new forest of parameters.NumberOfTrees trees, each
+    /// initially comprising a single leaf.
+    /// </summary>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="onlineParameters">Online training parameters.</param>
+    /// <param name="context">The training context.</param>
+    /// <param name="progress">Progress reporting target.</param>
+    OnlineForestTrainer(
+      Random& random,
+      const TrainingParameters& parameters,
+      const OnlineTrainingParameters& onlineParameters,
+      ITrainingContext<F, S>& context,
+      ProgressStream* progress=0 ):
+    random_(random),
+      trainingContext_(context),
+      defaultProgress_(std::cout, parameters.Verbose? Verbose:Interest)
+    {
+      parameters_ = parameters;
+      onlineParameters_ = onlineParameters;
+      progress_ = (progress==0) ? &defaultProgress_ : progress;
+
+      if (onlineParameters_.GracePeriod < 1)
+        throw std::runtime_error("Grace period must be at least one.");
+
+      leftChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+      rightChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+
+      forest_ = std::auto_ptr<Forest<F, S> >(new Forest<F, S>());
+      leafStates_.resize(parameters_.NumberOfTrees);
+
+      for (int t = 0; t < parameters_.NumberOfTrees; t++)
+      {
+        std::auto_ptr<Tree<F, S> > tree = std::auto_ptr<Tree<F, S> >(new Tree<F, S>(parameters_.MaxDecisionLevels));
+        tree->GetNode(0).InitializeLeaf(trainingContext_.GetStatisticsAggregator());
+        forest_->AddTree(tree);
+
+        CreateLeafState(t, 0, 0);
+      }
+    }
+
+    /// <summary>
+    /// The forest trained so far.
+    /// </summary>
+    const Forest<F, S>& GetForest() const { return *forest_; }
+
+    /// <summary>
+    /// Stop training and take ownership of the forest trained so far. The
+    /// trainer can't be updated afterwards.
+    /// </summary>
+    /// <returns>The forest.</returns>
+    std::auto_ptr<Forest<F, S> > ReleaseForest()
+    {
+      leafStates_.clear();
+      return forest_;
+    }
+
+    /// <summary>
+    /// Update the forest with a batch of data points.
+    /// </summary>
+    /// <param name="data">The data points.</param>
+    void Update(const IDataPointCollection& data)
+    {
+      for (unsigned int i = 0; i < data.Count(); i++)
+        Update(data, i);
+    }
+
+    /// <summary>
+    /// Update the forest with one data point. The data point is not
+    /// referenced once Update() returns.
+    /// </summary>
+    /// <param name="data">The data point collection.</param>
+    /// <param name="index">The index of the data point.</param>
+    void Update(const IDataPointCollection& data, unsigned int index)
+    {
+      if (forest_.get() == 0)
+        throw std::runtime_error("Can't update a forest after it has been released.");
+
+      for (int t = 0; t < forest_->TreeCount(); t++)
+      {
+        int k = onlineParameters_.Bagging ? Poisson1() : 1;
+        for (int j = 0; j < k; j++)
+          UpdateTree(t, data, index);
+      }
+    }
+
+  private:
+    void UpdateTree(int t, const IDataPointCollection& data, unsigned int index)
+    {
+      Tree<F, S>& tree = forest_->GetTree(t);
+
+      // Find the leaf reached by this data point
+      int nodeIndex = 0;
+      while (tree.GetNode(nodeIndex).IsSplit())
+      {
+        const Node<F, S>& node = tree.GetNode(nodeIndex);
+        nodeIndex = node.Feature.GetResponse(data, index) < node.Threshold ? node.LeftChildIndex : node.LeftChildIndex + 1;
+      }
+
+      tree.GetNode(nodeIndex).TrainingDataStatistics.Aggregate(data, index);
+
+      typename LeafStates::iterator it = leafStates_[t].find(nodeIndex);
+      if (it == leafStates_[t].end())
+        return;   // leaf at maximum depth
+
+      LeafState& state = it->second;
+      state.SampleCount++;
+
+      for (unsigned int c = 0; c < state.Candidates.size(); c++)
+      {
+        CandidateFeature& candidate = state.Candidates[c];
+        float response = candidate.Feature.GetResponse(data, index);
+
+        std::vector<float>::iterator p = std::lower_bound(candidate.Thresholds.begin(), candidate.Thresholds.end(), response);
+        if ((p == candidate.Thresholds.end() || *p != response) && candidate.Thresholds.size() < parameters_.NumberOfCandidateThresholdsPerFeature)
+        {
+          // Add a new threshold (and a new bin containing just this point)
+          int b = p - candidate.Thresholds.begin();
+          candidate.Thresholds.insert(p, response);
+          candidate.BinStatistics.insert(candidate.BinStatistics.begin() + b + 1, trainingContext_.GetStatisticsAggregator());
+          candidate.BinStatistics[b + 1].Aggregate(data, index);
+        }
+        else
+        {
+          int b = std::upper_bound(candidate.Thresholds.begin(), candidate.Thresholds.end(), response) - candidate.Thresholds.begin();
+          candidate.BinStatistics[b].Aggregate(data, index);
+        }
+      }
+
+      if (++state.SamplesSinceLastAttempt >= (unsigned int)(onlineParameters_.GracePeriod))
+      {
+        state.SamplesSinceLastAttempt = 0;
+        AttemptSplit(t, nodeIndex, state);
+      }
+    }
+
+    void AttemptSplit(int t, int nodeIndex, LeafState& state)
+    {
+      Tree<F, S>& tree = forest_->GetTree(t);
+      const S& parentStatistics = tree.GetNode(nodeIndex).TrainingDataStatistics;
+
+      // Find the best threshold of each candidate feature...
+      std::vector<double> gains(state.Candidates.size(), 0.0);
+      std::vector<int> thresholds(state.Candidates.size(), -1);
+      for (unsigned int c = 0; c < state.Candidates.size(); c++)
+      {
+        const CandidateFeature& candidate = state.Candidates[c];
+        for (unsigned int k = 0; k < candidate.Thresholds.size(); k++)
+        {
+          Partition(candidate, k);
+          double gain = trainingContext_.ComputeInformationGain(parentStatistics, leftChildStatistics_, rightChildStatistics_);
+
+          if (thresholds[c] < 0 || gain > gains[c])
+          {
+            gains[c] = gain;
+            thresholds[c] = k;
+          }
+        }
+      }
+
+      // ...and compare the best feature with the best other feature (as the
+      // thresholds of one feature are close in gain, comparing thresholds
+      // would almost never separate them). A candidate whose thresholds equal
+      // the winner's duplicates its feature, so is not a runner-up.
+      int bestCandidate = -1;
+      for (unsigned int c = 0; c < state.Candidates.size(); c++)
+        if (thresholds[c] >= 0 && (bestCandidate < 0 || gains[c] > gains[bestCandidate]))
+          bestCandidate = c;
+
+      if (bestCandidate < 0)
+        return;
+
+      double bestGain = gains[bestCandidate], secondBestGain = 0.0;
+      int bestThreshold = thresholds[bestCandidate];
+      for (unsigned int c = 0; c < state.Candidates.size(); c++)
+        if (thresholds[c] >= 0 && state.Candidates[c].Thresholds != state.Candidates[bestCandidate].Thresholds)
+          secondBestGain = std::max(secondBestGain, gains[c]);
+
+      if (bestGain <= 0.0)
+        return;
+
+      double R = onlineParameters_.GainRange;
+      double epsilon = sqrt(R * R * log(1.0 / onlineParameters_.Delta) / (2.0 * state.SampleCount));
+
+      if (bestGain - secondBestGain <= epsilon && epsilon >= onlineParameters_.TieThreshold)
+        return;
+
+      const CandidateFeature& winner = state.Candidates[bestCandidate];
+      Partition(winner, bestThreshold);
+
+      if (trainingContext_.ShouldTerminate(parentStatistics, leftChildStatistics_, rightChildStatistics_, bestGain))
+        return;
+
+      (*progress_)[Verbose] << "Tree " << t << ": splitting node " << nodeIndex << " after " << state.SampleCount
+        << " samples (threshold = " << winner.Thresholds[bestThreshold] << ", gain = " << bestGain << ", epsilon = " << epsilon << ")." << std::endl;
+
+      // NB Appending the children invalidates parentStatistics
+      int leftChildIndex = Tree<F, S>::InitializeSplit(tree.GetNodes(), nodeIndex, winner.Feature, winner.Thresholds[bestThreshold], parentStatistics);
+
+      // Children start out with the statistics of the data points that
+      // would have reached them
+      tree.GetNode(leftChildIndex).InitializeLeaf(leftChildStatistics_);
+      tree.GetNode(leftChildIndex + 1).InitializeLeaf(rightChildStatistics_);
+
+      int depth = state.Depth;
+      leafStates_[t].erase(nodeIndex);   // NB invalidates state
+
+      CreateLeafState(t, leftChildIndex, depth + 1);
+      CreateLeafState(t, leftChildIndex + 1, depth + 1);
+    }
+
+    // Aggregate bin statistics to the left and right of threshold k
+    void Partition(const CandidateFeature& candidate, unsigned int k)
+    {
+      leftChildStatistics_.Clear();
+      rightChildStatistics_.Clear();
+      for (unsigned int b = 0; b < candidate.BinStatistics.size(); b++)
+      {
+        if (b <= k)
+          leftChildStatistics_.Aggregate(candidate.BinStatistics[b]);
+        else
+          rightChildStatistics_.Aggregate(candidate.BinStatistics[b]);
+      }
+    }
+
+    void CreateLeafState(int t, int nodeIndex, int depth)
+    {
+      // Leaves at maximum depth are never split
+      if (depth >= parameters_.MaxDecisionLevels)
+        return;
+
+      LeafState& state = leafStates_[t][nodeIndex];
+      state.SamplesSinceLastAttempt = 0;
+      state.SampleCount = 0;
+      state.Depth = depth;
+      state.Candidates.resize(parameters_.NumberOfCandidateFeatures);
+      for (unsigned int c = 0; c < state.Candidates.size(); c++)
+      {
+        state.Candidates[c].Feature = trainingContext_.GetRandomFeature(random_);
+        state.Candidates[c].BinStatistics.assign(1, trainingContext_.GetStatisticsAggregator());
+      }
+    }
+
+    // Draw from a Poisson distribution with unit mean (Knuth's algorithm)
+    int Poisson1()
+    {
+      const double L = exp(-1.0);
+      int k = 0;
+      double p = random_.NextDouble();
+      while (p > L)
+      {
+        k++;
+        p *= random_.NextDouble();
+      }
+      return k;
+    }
+  };
+} } }
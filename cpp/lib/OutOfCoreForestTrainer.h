@@ -0,0 +1,575 @@
+#pragma once
+
+// This file defines the OutOfCoreForestTrainer class, which trains decision
+// forests on datasets that are too large to be held in memory, by streaming
+// them from chunked (e.g. disk-resident) storage.
+
+// *** NB If this header is compiled with OpenMP enabled, the next chunk is
+// loaded concurrently with the processing of the current one (double
+// buffering). Otherwise chunks are loaded and processed sequentially.
+
+#include <assert.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "TrainingParameters.h"
+#include "FeatureCost.h"
+
+#include "Interfaces.h"
+#include "Random.h"
+#include "Tree.h"
+#include "Forest.h"
+#include "ForestTrainer.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// A collection of data points that is accessed in fixed-size chunks,
+  /// e.g. because it is stored on disk and too large to be held in memory.
+  /// Chunks and subsets are returned as ordinary IDataPointCollection
+  /// instances, which must be compatible with the client's IFeatureResponse
+  /// and IStatisticsAggregator implementations.
+  /// </summary>
+  class IChunkedDataPointCollection
+  {
+  public:
+    virtual ~IChunkedDataPointCollection() { }
+
+    /// <summary>
+    /// The total number of data points.
+    /// </summary>
+    virtual unsigned int Count() const=0;
+
+    /// <summary>
+    /// The number of data points per chunk. Chunk c contains the data points
+    /// with indices c*ChunkSize() to (c+1)*ChunkSize()-1 (the last chunk may
+    /// be smaller).
+    /// </summary>
+    virtual unsigned int ChunkSize() const=0;
+
+    /// <summary>
+    /// Load a chunk. Must be safe to call while a previously loaded chunk is
+    /// being used by another thread.
+    /// </summary>
+    /// <param name="chunkIndex">The zero-based chunk index.</param>
+    /// <returns>The data points in the chunk.</returns>
+    virtual std::auto_ptr<IDataPointCollection> LoadChunk(unsigned int chunkIndex) const=0;
+
+    /// <summary>
+    /// Load a subset of the data points into memory.
+    /// </summary>
+    /// <param name="indices">The indices of the data points to be loaded.</param>
+    /// <returns>The data points, in the order given by indices.</returns>
+    virtual std::auto_ptr<IDataPointCollection> LoadSubset(const std::vector<unsigned int>& indices) const=0;
+  };
+
+  /// <summary>
+  /// An out-of-core tree training operation - used internally within
+  /// OutOfCoreForestTrainer to represent the operation of training a single
+  /// tree.
+  /// </summary>
+
+  // *** NB Nodes reached by more than inMemoryThreshold data points are
+  // trained level-wise, with two streaming passes over the data per level:
+  // the first routes data points to the nodes of the current level and
+  // samples candidate feature responses (to choose candidate thresholds); the
+  // second aggregates partition statistics. Smaller nodes are materialized in
+  // memory (in batches of at most inMemoryThreshold data points, gathered
+  // during the first pass) and their subtrees trained depth-first by
+  // TreeTrainingOperation. The only per-data point state held in memory is
+  // the index of the node each data point has reached.
+  template<class F, class S>
+  class OutOfCoreTreeTrainingOperation // where F : IFeatureResponse where S : IStatisticsAggregator<S>
+  {
+    typedef typename std::vector<unsigned int>::size_type DataPointIndex;
+
+    struct OpenNode
+    {
+      int NodeIndex;
+      int Depth;
+      unsigned int SampleCount;
+      unsigned int SamplesSeen;
+      S ParentStatistics;
+      std::vector<F> Features;
+      std::vector<float> MinResponses, MaxResponses;
+      std::vector<std::vector<float> > SampledResponses;
+      std::vector<std::vector<float> > Thresholds;
+      std::vector<std::vector<S> > PartitionStatistics;
+      std::vector<std::vector<unsigned int> > PartitionCounts;
+    };
+
+    enum Pass { SampleResponses, AggregatePartitions };
+
+    Random& random_;
+
+    const IChunkedDataPointCollection& data_;
+
+    ITrainingContext<F, S>& trainingContext_;
+
+    TrainingParameters parameters_;
+
+    unsigned int inMemoryThreshold_;
+
+    ProgressStream& progress_;
+
+    std::vector<Node<F, S> >& nodes_;
+
+    std::vector<int> nodeIndices_;      // per data point, -1 once no longer streamed
+
+    std::vector<OpenNode> openNodes_;   // nodes trained by streaming at the current level
+    std::vector<int> openSlots_;        // per node, index into openNodes_ or -1
+
+    std::vector<int> smallNodes_;       // nodes to be materialized during the next pass
+    std::vector<int> smallSlots_;       // per node, index into smallNodes_ or -1
+    std::vector<int> smallNodeDepths_;
+    std::vector<std::vector<unsigned int> > smallNodeIndices_;
+
+    S leftChildStatistics_, rightChildStatistics_;
+
+  public:
+    OutOfCoreTreeTrainingOperation(
+      Random& random,
+      ITrainingContext<F, S>& trainingContext,
+      const TrainingParameters& parameters,
+      unsigned int inMemoryThreshold,
+      const IChunkedDataPointCollection& data,
+      std::vector<Node<F, S> >& nodes,
+      ProgressStream& progress):
+    random_(random),
+      data_(data),
+      trainingContext_(trainingContext),
+      inMemoryThreshold_(inMemoryThreshold),
+      progress_(progress),
+      nodes_(nodes)
+    {
+      parameters_ = parameters;
+
+      leftChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+      rightChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+    }
+
+    void TrainTree()
+    {
+      openSlots_.assign(nodes_.size(), -1);
+      smallSlots_.assign(nodes_.size(), -1);
+
+      if (data_.Count() <= inMemoryThreshold_ || parameters_.MaxDecisionLevels == 0)
+      {
+        AddSmallNode(0, 0);
+        for (unsigned int i = 0; i < data_.Count(); i++)
+          smallNodeIndices_[0].push_back(i);
+        TrainSmallNodes();
+        return;
+      }
+
+      nodeIndices_.assign(data_.Count(), 0);
+      AddOpenNode(0, 0, data_.Count());
+
+      for (int level = 0; openNodes_.size() > 0 || smallNodes_.size() > 0; level++)
+      {
+        progress_[Verbose] << "Level " << level << ": streaming " << openNodes_.size() << " nodes, materializing " << smallNodes_.size() << " nodes." << std::endl;
+
+        for (unsigned int s = 0; s < openNodes_.size(); s++)
+          BeginNode(openNodes_[s]);
+
+        StreamChunks(SampleResponses);
+
+        TrainSmallNodes();
+
+        if (openNodes_.size() == 0)
+          break;
+
+        for (unsigned int s = 0; s < openNodes_.size(); s++)
+          ChooseCandidateThresholds(openNodes_[s]);
+
+        StreamChunks(AggregatePartitions);
+
+        // Choose splits, and decide how each child is to be trained
+        std::vector<OpenNode> openNodes;
+        openNodes.swap(openNodes_);
+        for (unsigned int s = 0; s < openNodes.size(); s++)
+          openSlots_[openNodes[s].NodeIndex] = -1;
+
+        for (unsigned int s = 0; s < openNodes.size(); s++)
+          SplitNode(openNodes[s]);
+      }
+    }
+
+  private:
+    void AddOpenNode(int nodeIndex, int depth, unsigned int sampleCount)
+    {
+      openSlots_[nodeIndex] = openNodes_.size();
+      openNodes_.push_back(OpenNode());
+      openNodes_.back().NodeIndex = nodeIndex;
+      openNodes_.back().Depth = depth;
+      openNodes_.back().SampleCount = sampleCount;
+    }
+
+    void AddSmallNode(int nodeIndex, int depth)
+    {
+      smallSlots_[nodeIndex] = smallNodes_.size();
+      smallNodes_.push_back(nodeIndex);
+      smallNodeDepths_.push_back(depth);
+      smallNodeIndices_.push_back(std::vector<unsigned int>());
+    }
+
+    void BeginNode(OpenNode& node)
+    {
+      int nFeatures = parameters_.NumberOfCandidateFeatures;
+      node.SamplesSeen = 0;
+      node.ParentStatistics = trainingContext_.GetStatisticsAggregator();
+      node.Features.resize(nFeatures);
+      for (int f = 0; f < nFeatures; f++)
+        node.Features[f] = trainingContext_.GetRandomFeature(random_);
+      node.MinResponses.assign(nFeatures, std::numeric_limits<float>::infinity());
+      node.MaxResponses.assign(nFeatures, -std::numeric_limits<float>::infinity());
+      node.SampledResponses.assign(nFeatures, std::vector<float>());
+    }
+
+    void StreamChunks(Pass pass)
+    {
+      unsigned int chunkSize = data_.ChunkSize();
+      if (chunkSize == 0)
+        throw std::runtime_error("Chunk size must be greater than zero.");
+
+      unsigned int chunkCount = (data_.Count() + chunkSize - 1) / chunkSize;
+
+      std::auto_ptr<IDataPointCollection> current = data_.LoadChunk(0), next;
+
+      for (unsigned int c = 0; c < chunkCount; c++)
+      {
+        std::string loadError, processError;
+
+        // Load the next chunk while processing this one
+#ifdef _OPENMP
+#pragma omp parallel sections num_threads(2)
+#endif
+        {
+#ifdef _OPENMP
+#pragma omp section
+#endif
+          {
+            try
+            {
+              if (c + 1 < chunkCount)
+                next = data_.LoadChunk(c + 1);
+            }
+            catch (std::exception& e)
+            {
+              loadError = e.what();
+            }
+          }
+#ifdef _OPENMP
+#pragma omp section
+#endif
+          {
+            try
+            {
+              ProcessChunk(pass, *current, c * chunkSize);
+            }
+            catch (std::exception& e)
+            {
+              processError = e.what();
+            }
+          }
+        }
+
+        if (processError != "")
+          throw std::runtime_error(processError);
+        if (loadError != "")
+          throw std::runtime_error(loadError);
+
+        current = next;
+      }
+    }
+
+    void ProcessChunk(Pass pass, const IDataPointCollection& chunk, unsigned int offset)
+    {
+      for (unsigned int j = 0; j < chunk.Count(); j++)
+      {
+        unsigned int i = offset + j;
+        int nodeIndex = nodeIndices_[i];
+        if (nodeIndex < 0)
+          continue;
+
+        if (pass == SampleResponses && nodes_[nodeIndex].IsSplit())
+        {
+          // Route data points split at the previous level
+          const Node<F, S>& node = nodes_[nodeIndex];
+          nodeIndex = node.Feature.GetResponse(chunk, j) < node.Threshold ? node.LeftChildIndex : node.LeftChildIndex + 1;
+          nodeIndices_[i] = nodeIndex;
+
+          if (smallSlots_[nodeIndex] >= 0)
+            smallNodeIndices_[smallSlots_[nodeIndex]].push_back(i);
+        }
+
+        if (openSlots_[nodeIndex] < 0)
+        {
+          nodeIndices_[i] = -1;   // reached a leaf, or a node trained in memory
+          continue;
+        }
+
+        OpenNode& node = openNodes_[openSlots_[nodeIndex]];
+
+        if (pass == SampleResponses)
+        {
+          node.ParentStatistics.Aggregate(chunk, j);
+          node.SamplesSeen++;
+
+          // Reservoir sample NumberOfCandidateThresholdsPerFeature+1
+          // responses per feature (cf. ChooseCandidateThresholds())
+          unsigned int sampleSize = parameters_.NumberOfCandidateThresholdsPerFeature + 1;
+          int r = node.SamplesSeen <= sampleSize ? -1 : random_.Next(0, node.SamplesSeen);
+
+          for (unsigned int f = 0; f < node.Features.size(); f++)
+          {
+            float response = node.Features[f].GetResponse(chunk, j);
+            node.MinResponses[f] = std::min(node.MinResponses[f], response);
+            node.MaxResponses[f] = std::max(node.MaxResponses[f], response);
+
+            if (r < 0)
+              node.SampledResponses[f].push_back(response);
+            else if ((unsigned int)(r) < sampleSize)
+              node.SampledResponses[f][r] = response;
+          }
+        }
+        else
+        {
+          for (unsigned int f = 0; f < node.Features.size(); f++)
+          {
+            const std::vector<float>& thresholds = node.Thresholds[f];
+            if (thresholds.size() == 0)
+              continue;
+
+            float response = node.Features[f].GetResponse(chunk, j);
+
+            unsigned int b = 0;
+            while (b < thresholds.size() && response >= thresholds[b])
+              b++;
+
+            node.PartitionStatistics[f][b].Aggregate(chunk, j);
+            node.PartitionCounts[f][b]++;
+          }
+        }
+      }
+    }
+
+    void ChooseCandidateThresholds(OpenNode& node)
+    {
+      node.Thresholds.resize(node.Features.size());
+      node.PartitionStatistics.resize(node.Features.size());
+      node.PartitionCounts.resize(node.Features.size());
+
+      for (unsigned int f = 0; f < node.Features.size(); f++)
+      {
+        std::vector<float>& thresholds = node.Thresholds[f];
+        thresholds.clear();
+
+        if (parameters_.ExtremelyRandomized)
+        {
+          if (node.MaxResponses[f] > node.MinResponses[f])
+            thresholds.push_back(node.MinResponses[f] + (float)(random_.NextDouble() * (node.MaxResponses[f] - node.MinResponses[f])));
+        }
+        else
+        {
+          // Compute candidate thresholds by sampling in between approximate quantiles
+          std::vector<float>& quantiles = node.SampledResponses[f];
+          std::sort(quantiles.begin(), quantiles.end());
+
+          if (quantiles.size() > 1 && quantiles.front() != quantiles.back())
+          {
+            for (unsigned int i = 0; i + 1 < quantiles.size(); i++)
+              thresholds.push_back(quantiles[i] + (float)(random_.NextDouble() * (quantiles[i + 1] - quantiles[i])));
+          }
+        }
+
+        node.PartitionStatistics[f].assign(thresholds.size() + 1, trainingContext_.GetStatisticsAggregator());
+        node.PartitionCounts[f].assign(thresholds.size() + 1, 0);
+      }
+    }
+
+    void SplitNode(OpenNode& node)
+    {
+      progress_[Verbose] << Tree<F, S>::GetPrettyPrintPrefix(nodes_, node.NodeIndex) << node.SampleCount << ": ";
+
+      double maxGain = 0.0, maxScore = 0.0;
+      double sampleFraction = (double)(node.SampleCount) / data_.Count();
+      int bestFeature = -1, bestPartition = 0;
+
+      for (unsigned int f = 0; f < node.Features.size(); f++)
+      {
+        for (unsigned int t = 0; t < node.Thresholds[f].size(); t++)
+        {
+          Partition(node, f, t);
+
+          double gain = trainingContext_.ComputeInformationGain(node.ParentStatistics, leftChildStatistics_, rightChildStatistics_);
+          double score = ComputeSplitScore(parameters_, gain, node.Features[f], sampleFraction);
+
+          if (score >= maxScore)
+          {
+            maxScore = score;
+            maxGain = gain;
+            bestFeature = f;
+            bestPartition = t;
+          }
+        }
+      }
+
+      if (maxGain == 0.0 || bestFeature < 0)
+      {
+        nodes_[node.NodeIndex].InitializeLeaf(node.ParentStatistics);
+        progress_[Verbose] << "Terminating with zero gain." << std::endl;
+        return;
+      }
+
+      unsigned int leftCount = Partition(node, bestFeature, bestPartition);
+      unsigned int rightCount = node.SampleCount - leftCount;
+
+      if (trainingContext_.ShouldTerminate(node.ParentStatistics, leftChildStatistics_, rightChildStatistics_, maxGain))
+      {
+        nodes_[node.NodeIndex].InitializeLeaf(node.ParentStatistics);
+        progress_[Verbose] << "Terminating with no split." << std::endl;
+        return;
+      }
+
+      float threshold = node.Thresholds[bestFeature][bestPartition];
+      int leftChildIndex = Tree<F, S>::InitializeSplit(nodes_, node.NodeIndex, node.Features[bestFeature], threshold, node.ParentStatistics);
+      openSlots_.resize(nodes_.size(), -1);
+      smallSlots_.resize(nodes_.size(), -1);
+
+      progress_[Verbose] << " (threshold = " << threshold << ", gain = "<< maxGain << ")." << std::endl;
+
+      InitializeChild(leftChildIndex, node.Depth + 1, leftCount, leftChildStatistics_);
+      InitializeChild(leftChildIndex + 1, node.Depth + 1, rightCount, rightChildStatistics_);
+    }
+
+    void InitializeChild(int nodeIndex, int depth, unsigned int sampleCount, const S& statistics)
+    {
+      if (depth >= parameters_.MaxDecisionLevels || sampleCount == 0)
+        nodes_[nodeIndex].InitializeLeaf(statistics);   // child statistics are known exactly, nothing to stream
+      else if (sampleCount <= inMemoryThreshold_)
+        AddSmallNode(nodeIndex, depth);
+      else
+        AddOpenNode(nodeIndex, depth, sampleCount);
+    }
+
+    // Aggregate partition statistics either side of threshold t of feature
+    // f and return the number of data points to the left
+    unsigned int Partition(const OpenNode& node, int f, int t)
+    {
+      unsigned int leftCount = 0;
+      leftChildStatistics_.Clear();
+      rightChildStatistics_.Clear();
+      for (unsigned int p = 0; p < node.PartitionStatistics[f].size(); p++)
+      {
+        if ((int)(p) <= t)
+        {
+          leftChildStatistics_.Aggregate(node.PartitionStatistics[f][p]);
+          leftCount += node.PartitionCounts[f][p];
+        }
+        else
+          rightChildStatistics_.Aggregate(node.PartitionStatistics[f][p]);
+      }
+      return leftCount;
+    }
+
+    // Materialize the data points gathered for small nodes, in batches of at
+    // most inMemoryThreshold data points, and train their subtrees in memory
+    void TrainSmallNodes()
+    {
+      unsigned int s0 = 0;
+      while (s0 < smallNodes_.size())
+      {
+        std::vector<unsigned int> batchIndices(smallNodeIndices_[s0]);
+        unsigned int s1 = s0 + 1;
+        while (s1 < smallNodes_.size() && batchIndices.size() + smallNodeIndices_[s1].size() <= inMemoryThreshold_)
+        {
+          batchIndices.insert(batchIndices.end(), smallNodeIndices_[s1].begin(), smallNodeIndices_[s1].end());
+          s1++;
+        }
+
+        std::auto_ptr<IDataPointCollection> batch = data_.LoadSubset(batchIndices);
+
+        TreeTrainingOperation<F, S> trainingOperation(random_, trainingContext_, parameters_, *batch, progress_, data_.Count());
+
+        DataPointIndex i0 = 0;
+        for (unsigned int s = s0; s < s1; s++)
+        {
+          DataPointIndex i1 = i0 + smallNodeIndices_[s].size();
+          trainingOperation.TrainNodesRecurse(nodes_, smallNodes_[s], i0, i1, smallNodeDepths_[s]);
+          i0 = i1;
+        }
+
+        s0 = s1;
+      }
+
+      for (unsigned int s = 0; s < smallNodes_.size(); s++)
+        smallSlots_[smallNodes_[s]] = -1;
+      smallNodes_.clear();
+      smallNodeDepths_.clear();
+      smallNodeIndices_.clear();
+    }
+  };
+
+  /// <summary>
+  /// Learns new decision forests from training data that is too large to be
+  /// held in memory.
+  /// </summary>
+  template<class F, class S>
+  class OutOfCoreForestTrainer // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// Train a new decision forest given chunked training data.
+    /// </summary>
+    /// <param name="random">Random number generator.</param>
+    /// <param name="parameters">Training parameters.</param>
+    /// <param name="inMemoryThreshold">The maximum number of data points
+    /// to be held in memory at once. Subtrees with no more data points than
+    /// this are trained in memory.</param>
+    /// <param name="context">An ITrainingContext instance describing
+    /// the training problem, e.g. classification, density estimation, etc. </param>
+    /// <param name="data">The training data.</param>
+    /// <returns>A new decision forest.</returns>
+    static std::auto_ptr<Forest<F,S> > TrainForest(
+      Random& random,
+      const TrainingParameters& parameters,
+      unsigned int inMemoryThreshold,
+      ITrainingContext<F,S>& context,
+      const IChunkedDataPointCollection& data,
+      ProgressStream* progress=0)
+    {
+      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      if(progress==0)
+        progress=&defaultProgress;
+
+      std::auto_ptr<Forest<F,S> > forest = std::auto_ptr<Forest<F,S> >(new Forest<F,S>());
+
+      for (int t = 0; t < parameters.NumberOfTrees; t++)
+      {
+        (*progress)[Interest] << "\rTraining tree "<< t << "...";
+
+        std::auto_ptr<Tree<F, S> > tree = std::auto_ptr<Tree<F, S> >(new Tree<F, S>(parameters.MaxDecisionLevels));
+
+        OutOfCoreTreeTrainingOperation<F, S> trainingOperation(
+          random, context, parameters, inMemoryThreshold, data, tree->GetNodes(), *progress);
+
+        trainingOperation.TrainTree();
+
+        tree->CheckValid();
+
+        forest->AddTree(tree);
+      }
+      (*progress)[Interest] << "\rTrained " << parameters.NumberOfTrees << " trees.         " << std::endl;
+
+      return forest;
+    }
+  };
+} } }
@@ -8,17 +8,32 @@
 
 // *** NOTE *** Compiling this header requires OpenMP.
 
+// *** NB On NUMA machines, memory is placed on the node of the thread that
+// first touches it. Each thread's workspace (ThreadLocalData) is therefore
+// allocated and initialized by that thread, and threads are mapped to
+// workspaces in the same way (a static schedule over maxThreads iterations)
+// in every parallel region. If TrainingParameters.ReplicateTrainingData is
+// set, each thread also evaluates candidate features on its own copy of the
+// training data (see IDataPointCollection::Clone()), so that feature
+// responses are read from local memory. Threads should be bound to cores
+// (e.g. OMP_PROC_BIND=true) for this placement to persist.
+
 #include <assert.h>
 
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <limits>
+#include <memory>
 
 #include <omp.h>
 
 #include "ProgressStream.h"
 
 #include "TrainingParameters.h"
+#include "FeatureCost.h"
+#include "CandidateThresholds.h"
+#include "TrainingMemoryEstimator.h"
 #include "Interfaces.h"
 #include "Tree.h"
 
@@ -59,7 +74,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     class ThreadLocalData
     {
     public:
-      double maxGain;
+      double maxGain, maxScore;
       F bestFeature;
       float bestThreshold;
 
@@ -71,14 +86,16 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       Random random_;
 
-      ThreadLocalData()
-      {
-
-      }
+      std::auto_ptr<IDataPointCollection> replica_;   // or null
+      const IDataPointCollection& data_;
 
-      ThreadLocalData(Random& random, ITrainingContext<F,S>& trainingContext_, const TrainingParameters& parameters, IDataPointCollection const & data):random_(random.Next())
+      ThreadLocalData(int seed, ITrainingContext<F,S>& trainingContext_, const TrainingParameters& parameters, IDataPointCollection const & data):
+        random_(seed),
+        replica_(parameters.ReplicateTrainingData ? data.Clone() : std::auto_ptr<IDataPointCollection>()),
+        data_(replica_.get() != 0 ? *replica_ : data)
       {
         maxGain = 0.0;
+        maxScore = 0.0;
         bestThreshold = 0.0;
         parentStatistics_ = trainingContext_.GetStatisticsAggregator();
 
@@ -89,19 +106,23 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
         for (unsigned int i = 0; i < parameters.NumberOfCandidateThresholdsPerFeature + 1; i++)
           partitionStatistics_[i] = trainingContext_.GetStatisticsAggregator();
 
-        responses_.resize(data.Count());
-        // thresholds_ will be resized() in ChooseCandidateThresholds()
+        if (!parameters.StreamResponses)
+          responses_.resize(data.Count());
+        // thresholds will be resized() in ChooseCandidateThresholds()
       }
 
       void Clear()
       {
         maxGain = 0.0;
+        maxScore = 0.0;
         bestFeature = F();
         bestThreshold = 0.0f;
       }
     };
 
-    std::vector<ThreadLocalData > threadLocalData_;
+    // Allocated separately (by the threads that use them) rather than
+    // contiguously, to avoid false sharing and for NUMA locality
+    std::vector<ThreadLocalData*> threadLocalData_;
 
   public:
     ParallelTreeTrainingOperation(
@@ -113,8 +134,8 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       ProgressStream& progress):
     random_(random),
     data_(data),
-    maxThreads_(maxThreads),
     trainingContext_(trainingContext),
+    maxThreads_(maxThreads),
     progress_(progress)
     {
       parameters_ = parameters;
@@ -123,16 +144,34 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       for (DataPointIndex i = 0; i < indices_.size(); i++)
         indices_[i] = i;
 
-      threadLocalData_.resize(maxThreads_);
+      responses_.resize(data.Count());
+
+      parentStatistics_ = trainingContext_.GetStatisticsAggregator();
+      leftChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+      rightChildStatistics_ = trainingContext_.GetStatisticsAggregator();
+
+      // Draw seeds serially so that training is repeatable
+      std::vector<int> seeds(maxThreads_);
+      for (int threadIndex = 0; threadIndex < maxThreads_; threadIndex++)
+        seeds[threadIndex] = random.Next();
+
+      threadLocalData_.assign(maxThreads_, (ThreadLocalData*)(0));
+
+      #pragma omp parallel for schedule(static) num_threads(maxThreads_)
       for (int threadIndex = 0; threadIndex < maxThreads_; threadIndex++)
-        // Note use of placement new operator to initialize already-allocated memory
-        new (&threadLocalData_[threadIndex]) ThreadLocalData(random, trainingContext_, parameters_, data_);
+        threadLocalData_[threadIndex] = new ThreadLocalData(seeds[threadIndex], trainingContext_, parameters_, data_);
+    }
+
+    ~ParallelTreeTrainingOperation()
+    {
+      for (int threadIndex = 0; threadIndex < maxThreads_; threadIndex++)
+        delete threadLocalData_[threadIndex];
     }
 
     void TrainNodesRecurse(std::vector<Node<F, S> >& nodes, NodeIndex nodeIndex, DataPointIndex i0, DataPointIndex i1, int recurseDepth)
     {
       assert(nodeIndex < nodes.size());
-      progress_[Verbose] << Tree<F, S>::GetPrettyPrintPrefix(nodeIndex) << i1 - i0 << ": ";
+      progress_[Verbose] << Tree<F, S>::GetPrettyPrintPrefix(nodes, nodeIndex) << i1 - i0 << ": ";
 
       // First aggregate statistics over the samples at the parent node
       parentStatistics_.Clear();
@@ -141,22 +180,30 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       // Copy parent statistics to thread local storage in case client IStatisticsAggregator implementations are not reentrant
       for (int t = 0; t < maxThreads_; t++)
-        threadLocalData_[t].parentStatistics_ = parentStatistics_.DeepClone();
+        threadLocalData_[t]->parentStatistics_ = parentStatistics_.DeepClone();
 
-      if (nodeIndex >= nodes.size() / 2) // this is a leaf node, nothing else to do
+      if (recurseDepth >= parameters_.MaxDecisionLevels) // this is a leaf node, nothing else to do
       {
         nodes[nodeIndex].InitializeLeaf(parentStatistics_);
         progress_[Verbose] << "Terminating at max depth." << std::endl;
         return;
       }
 
-      #pragma omp parallel for
+      double sampleFraction = (double)(i1 - i0) / data_.Count();
+
+      #pragma omp parallel for schedule(static) num_threads(maxThreads_)
       for(int threadIndex=0; threadIndex < maxThreads_; threadIndex++)
       {
-        ThreadLocalData& tl = threadLocalData_[threadIndex]; // shorthand
+        ThreadLocalData& tl = *threadLocalData_[threadIndex]; // shorthand
 
         tl.Clear();
 
+        if (parameters_.ExtremelyRandomized)
+        {
+          ChooseExtremelyRandomizedSplit(tl, i0, i1);
+          continue;
+        }
+
         // Iterate over candidate features
         std::vector<float> thresholds;
         for (int f = 0; f < parameters_.NumberOfCandidateFeatures/maxThreads_; f++)
@@ -167,21 +214,24 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
             tl.partitionStatistics_[b].Clear(); // reset statistics
 
           // Compute feature response per samples at this node
-          for (DataPointIndex i = i0; i < i1; i++)
-            tl.responses_[i] = feature.GetResponse(data_, indices_[i]);
+          if (!parameters_.StreamResponses)
+            for (DataPointIndex i = i0; i < i1; i++)
+              tl.responses_[i] = feature.GetResponse(tl.data_, indices_[i]);
 
           int nThresholds;
-          if ((nThresholds = ChooseCandidateThresholds(tl.random_, &indices_[0], i0, i1, &tl.responses_[0], tl.thresholds)) == 0)
+          if ((nThresholds = ChooseCandidateThresholds(tl.random_, NodeResponses(*this, tl, feature), i0, i1, parameters_.NumberOfCandidateThresholdsPerFeature, tl.thresholds)) == 0)
             continue;
 
           // Aggregate statistics over sample partitions
           for (DataPointIndex i = i0; i < i1; i++)
           {
+            float response = GetResponse(tl, feature, i);
+
             int b = 0;
-            while (b < nThresholds && tl.responses_[i] >= tl.thresholds[b])
+            while (b < nThresholds && response >= tl.thresholds[b])
               b++;
 
-            tl.partitionStatistics_[b].Aggregate(data_, indices_[i]);
+            tl.partitionStatistics_[b].Aggregate(tl.data_, indices_[i]);
           }
 
           for (int t = 0; t < nThresholds; t++)
@@ -198,9 +248,11 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
             // Compute gain over sample partitions
             double gain = trainingContext_.ComputeInformationGain(tl.parentStatistics_, tl.leftChildStatistics_,tl. rightChildStatistics_);
+            double score = ComputeSplitScore(parameters_, gain, feature, sampleFraction);
 
-            if (gain >= tl.maxGain)
+            if (score >= tl.maxScore)
             {
+              tl.maxScore = score;
               tl.maxGain = gain;
               tl.bestFeature = feature;
               tl.bestThreshold = tl.thresholds[t];
@@ -210,15 +262,16 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       }
 
       // Now merge over threads.
-      double maxGain = 0.0;
+      double maxGain = 0.0, maxScore = 0.0;
       F bestFeature;
       float bestThreshold=0.0;
 
       for (int threadIndex = 0; threadIndex < maxThreads_; threadIndex++)
       {
-        ThreadLocalData& tl = threadLocalData_[threadIndex];
-        if (tl.maxGain > maxGain)
+        ThreadLocalData& tl = *threadLocalData_[threadIndex];
+        if (tl.maxGain > 0.0 && (maxGain == 0.0 || tl.maxScore > maxScore))
         {
+          maxScore = tl.maxScore;
           maxGain = tl.maxGain;
           bestFeature = tl.bestFeature;
           bestThreshold = tl.bestThreshold;
@@ -255,7 +308,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       }
 
       // Otherwise this is a new decision node, recurse for children.
-      nodes[nodeIndex].InitializeSplit(bestFeature, bestThreshold, parentStatistics_);
+      NodeIndex leftChildIndex = Tree<F, S>::InitializeSplit(nodes, nodeIndex, bestFeature, bestThreshold, parentStatistics_);
 
       // Now do partition sort - any sample with response greater goes left, otherwise right
       DataPointIndex ii = Tree<F, S>::Partition(responses_, indices_, i0, i1, bestThreshold);
@@ -264,49 +317,86 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       progress_[Verbose] << " (threshold = " << bestThreshold << ", gain = "<< maxGain << ")." << std::endl;
 
-      TrainNodesRecurse(nodes, nodeIndex * 2 + 1, i0, ii, recurseDepth + 1);
-      TrainNodesRecurse(nodes, nodeIndex * 2 + 2, ii, i1, recurseDepth + 1);
+      TrainNodesRecurse(nodes, leftChildIndex, i0, ii, recurseDepth + 1);
+      TrainNodesRecurse(nodes, leftChildIndex + 1, ii, i1, recurseDepth + 1);
     }
 
   private:
-    int ChooseCandidateThresholds (
-      Random& random,
-      unsigned int* dataIndices, 
-      DataPointIndex i0,
-      DataPointIndex i1,
-      const float* responses,
-      std::vector<float>& thresholds )
+    // The response of the i-th sample at the current node to the feature
+    // being evaluated by this thread (recomputed if responses are streamed).
+    float GetResponse(ThreadLocalData& tl, const F& feature, DataPointIndex i)
+    {
+      return parameters_.StreamResponses ? feature.GetResponse(tl.data_, indices_[i]) : tl.responses_[i];
+    }
+
+    // The same, as responses[i] (see ChooseCandidateThresholds())
+    class NodeResponses
     {
-      thresholds.resize(parameters_.NumberOfCandidateThresholdsPerFeature + 1);
-      std::vector<float>& quantiles = thresholds; // shorthand, for code clarity - we reuse memory to avoid allocation
+      ParallelTreeTrainingOperation& operation_;
+      ThreadLocalData& tl_;
+      const F& feature_;
 
-      int nThresholds;
-      // If there are enough response values...
-      if (i1 - i0 > parameters_.NumberOfCandidateThresholdsPerFeature)
+    public:
+      NodeResponses(ParallelTreeTrainingOperation& operation, ThreadLocalData& tl, const F& feature):
+        operation_(operation), tl_(tl), feature_(feature)
       {
-        // ...make a random draw of NumberOfCandidateThresholdsPerFeature+1 response values
-        nThresholds = parameters_.NumberOfCandidateThresholdsPerFeature;
-        for (int i = 0; i < nThresholds + 1; i++)
-          quantiles[i] = responses[random.Next(i0, i1)]; // sample randomly from all responses
       }
-      else
+
+      float operator[](DataPointIndex i) const
       {
-        // ...otherwise use all response values.
-        nThresholds = i1 - i0 - 1;
-        std::copy(&responses[i0], &responses[i1], quantiles.begin());
+        return operation_.GetResponse(tl_, feature_, i);
       }
+    };
+
+    // Evaluate this thread's share of candidate features, as in extremely
+    // randomized trees, with a single threshold per feature drawn uniformly
+    // from the range of responses at this node (see TreeTrainingOperation).
+    void ChooseExtremelyRandomizedSplit(ThreadLocalData& tl, DataPointIndex i0, DataPointIndex i1)
+    {
+      double sampleFraction = (double)(i1 - i0) / data_.Count();
+
+      for (int f = 0; f < parameters_.NumberOfCandidateFeatures/maxThreads_; f++)
+      {
+        F feature = trainingContext_.GetRandomFeature(tl.random_);
 
-      // Sort the response values to form approximate quantiles.
-      std::sort(quantiles.begin(), quantiles.end());
+        // Compute feature response per samples at this node, and their range
+        float minResponse = std::numeric_limits<float>::infinity();
+        float maxResponse = -std::numeric_limits<float>::infinity();
+        for (DataPointIndex i = i0; i < i1; i++)
+        {
+          float response = feature.GetResponse(tl.data_, indices_[i]);
+          if (!parameters_.StreamResponses)
+            tl.responses_[i] = response;
+          minResponse = std::min(minResponse, response);
+          maxResponse = std::max(maxResponse, response);
+        }
 
-      if (quantiles[0] == quantiles[nThresholds])
-        return 0;   // all sampled response values were the same
+        if (!(maxResponse > minResponse))
+          continue;   // all response values were the same
 
-      // Compute n candidate thresholds by sampling in between n+1 approximate quantiles
-      for (int i = 0; i < nThresholds; i++)
-        thresholds[i] = quantiles[i] + (float)(random_.NextDouble() * (quantiles[i + 1] - quantiles[i]));
+        float threshold = minResponse + (float)(tl.random_.NextDouble() * (maxResponse - minResponse));
 
-      return nThresholds;
+        tl.leftChildStatistics_.Clear();
+        tl.rightChildStatistics_.Clear();
+        for (DataPointIndex i = i0; i < i1; i++)
+        {
+          if (GetResponse(tl, feature, i) < threshold)
+            tl.leftChildStatistics_.Aggregate(tl.data_, indices_[i]);
+          else
+            tl.rightChildStatistics_.Aggregate(tl.data_, indices_[i]);
+        }
+
+        double gain = trainingContext_.ComputeInformationGain(tl.parentStatistics_, tl.leftChildStatistics_, tl.rightChildStatistics_);
+        double score = ComputeSplitScore(parameters_, gain, feature, sampleFraction);
+
+        if (score >= tl.maxScore)
+        {
+          tl.maxScore = score;
+          tl.maxGain = gain;
+          tl.bestFeature = feature;
+          tl.bestThreshold = threshold;
+        }
+      }
     }
   };
 
@@ -378,24 +468,32 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// the training problem, e.g. classification, density estimation, etc. </param>
     /// <param name="data">The training data.</param>
     /// <returns>A new decision forest.</returns>
+
+    // If parameters.MemoryBudget is set, training is adapted to fit within
+    // it (see TrainingMemoryEstimator::FitBudget()) or fails before any tree
+    // is trained.
     static std::auto_ptr<Forest<F,S> > TrainForest(
       Random& random,
-      const TrainingParameters& parameters,
+      const TrainingParameters& budgetedParameters,
+      int maxThreads,
       ITrainingContext<F,S>& context,
       const IDataPointCollection& data,
       ProgressStream* progress=0)
     {
-      ProgressStream defaultProgress(std::cout, parameters.Verbose? Verbose:Interest);
+      ProgressStream defaultProgress(std::cout, budgetedParameters.Verbose? Verbose:Interest);
       if(progress==0)
         progress=&defaultProgress;
 
+      TrainingParameters parameters = budgetedParameters;
+      maxThreads = TrainingMemoryEstimator<F,S>::FitBudget(parameters, maxThreads, data, *progress);
+
       std::auto_ptr<Forest<F,S> > forest = std::auto_ptr<Forest<F,S> >(new Forest<F,S>());
 
       for (int t = 0; t < parameters.NumberOfTrees; t++)
       {
         (*progress)[Interest] << "\rTraining tree "<< t << "...";
 
-        std::auto_ptr<Tree<F, S> > tree = ParallelTreeTrainer<F, S>::TrainTree(random, context, parameters, data, progress);
+        std::auto_ptr<Tree<F, S> > tree = ParallelTreeTrainer<F, S>::TrainTree(random, context, parameters, maxThreads, data, progress);
         forest->AddTree(tree);
       }
       (*progress)[Interest] << "\rTrained " << parameters.NumberOfTrees << " trees.         " << std::endl;
@@ -0,0 +1,296 @@
+#pragma once
+
+// This file defines the QuickScorer class, which evaluates forests of
+// axis-aligned trees by scanning sorted thresholds and combining leaf
+// bitvectors rather than by traversing nodes, and the GetFeatureAxis_()
+// function by which IFeatureResponse implementations take part.
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Interfaces.h"
+#include "Forest.h"
+#include "PackedTree.h"
+#include "LeafPosteriors.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// The coordinate of a data point that is the response of a feature, or
+  /// -1 if the feature is not axis-aligned. All features are assumed not
+  /// to be axis-aligned unless this is overloaded for a particular
+  /// IFeatureResponse implementation (in the same namespace, so that it is
+  /// found by argument-dependent lookup). Features with the same axis must
+  /// give the same response for every data point.
+  /// </summary>
+  template<class F>
+  int GetFeatureAxis_(const F& feature)
+  {
+    return -1;
+  }
+
+  /// <summary>
+  /// Evaluates a forest of axis-aligned trees using the QuickScorer
+  /// algorithm: per axis, the thresholds of all split nodes in the forest
+  /// are sorted, and for a data point with response v every node with a
+  /// threshold at or below v (i.e. every node that sends it right) clears
+  /// the leaves of its left subtree from its tree's bitvector of candidate
+  /// exit leaves. The exit leaf is then the leftmost leaf remaining. There
+  /// is no per-node branching and each response is computed once per axis.
+  /// </summary>
+
+  // *** NB Leaves are numbered from left to right within each tree, so
+  // the leaves of any subtree are a contiguous range of bits and the exit
+  // leaf is the lowest set bit. Bitvectors have as many 64-bit words as
+  // the largest tree needs. The cost is proportional to the number of
+  // nodes sending a data point right (summed over the forest) rather than
+  // to the number of trees times their depth, so QuickScorer suits forests
+  // of many shallow trees; per-word masks make it unsuitable for deep ones.
+  template<class F, class S>
+  class QuickScorer // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+    typedef unsigned long long Word;
+
+    struct Axis
+    {
+      F Feature;                      // computes the response for this axis
+      std::vector<float> Thresholds;  // ascending
+      std::vector<int> Trees;         // the tree of each node
+      std::vector<Word> Masks;        // wordCount_ words per node
+    };
+
+    std::vector<Axis> axes_;
+
+    int treeCount_, wordCount_;
+
+    std::vector<std::vector<int> > leafIndices_; // per tree, left-to-right leaf index -> PackedTree leaf index
+    std::vector<std::vector<int> > leafNodeIndices_; // per tree, left-to-right leaf index -> Tree node index
+
+  public:
+    /// <summary>
+    /// Prepare to evaluate the specified forest, all of whose features must
+    /// be axis-aligned (see GetFeatureAxis_()). The forest can be modified
+    /// or destroyed afterwards.
+    /// </summary>
+    /// <param name="forest">The forest.</param>
+    QuickScorer(const Forest<F,S>& forest): treeCount_(forest.TreeCount())
+    {
+      if (forest.TreeCount() == 0)
+        throw std::runtime_error("Can't evaluate a forest with no trees.");
+
+      int maxLeafCount = 1;
+      for (int t = 0; t < forest.TreeCount(); t++)
+        maxLeafCount = std::max(maxLeafCount, forest.GetPackedTree(t).LeafCount());
+      wordCount_ = (maxLeafCount + 63) / 64;
+
+      // Gather the nodes of each axis, with their masks
+      std::vector<std::vector<Node_> > nodes;
+      leafIndices_.resize(forest.TreeCount());
+      leafNodeIndices_.resize(forest.TreeCount());
+      for (int t = 0; t < forest.TreeCount(); t++)
+      {
+        const PackedTree<F,S>& tree = forest.GetPackedTree(t);
+        AddNodes(tree, t, tree.GetRoot(), nodes);
+
+        for (unsigned int l = 0; l < leafIndices_[t].size(); l++)
+          leafNodeIndices_[t].push_back(tree.GetLeafNodeIndex(leafIndices_[t][l]));
+      }
+
+      axes_.resize(nodes.size());
+      for (unsigned int a = 0; a < nodes.size(); a++)
+      {
+        std::sort(nodes[a].begin(), nodes[a].end());
+
+        Axis& axis = axes_[a];
+        for (unsigned int n = 0; n < nodes[a].size(); n++)
+        {
+          axis.Feature = nodes[a][n].Feature;
+          axis.Thresholds.push_back(nodes[a][n].Threshold);
+          axis.Trees.push_back(nodes[a][n].Tree);
+          for (int w = 0; w < wordCount_; w++)
+            axis.Masks.push_back(Mask(w, nodes[a][n].FirstLeaf, nodes[a][n].EndLeaf));
+        }
+      }
+    }
+
+    /// <summary>
+    /// Find the leaf reached by a single data point in each tree.
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="dataIndex">The index of the data point to be evaluated.</param>
+    /// <param name="leafIndices">Receives TreeCount() zero-based leaf indices
+    /// (see PackedTree).</param>
+    void FindLeaves(const IDataPointCollection& data, unsigned int dataIndex, int* leafIndices) const
+    {
+      std::vector<Word> candidates;
+      FindLeaves(data, dataIndex, leafIndices, candidates);
+    }
+
+    /// <summary>
+    /// Apply the forest to a collection of test data points (see Forest::Apply()).
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="leafNodeIndices">Receives, per tree, the index of the
+    /// Tree node reached per data point.</param>
+    void Apply(const IDataPointCollection& data, std::vector<std::vector<int> >& leafNodeIndices) const
+    {
+      leafNodeIndices.resize(treeCount_);
+      for (int t = 0; t < treeCount_; t++)
+        leafNodeIndices[t].resize(data.Count());
+
+      std::vector<Word> candidates;
+      for (unsigned int i = 0; i < data.Count(); i++)
+      {
+        Scan(data, i, candidates);
+        for (int t = 0; t < treeCount_; t++)
+          leafNodeIndices[t][i] = leafNodeIndices_[t][FindExitLeaf(&candidates[t * wordCount_])];
+      }
+    }
+
+    /// <summary>
+    /// Predict the posterior of each of a collection of data points (see
+    /// LeafPosteriors::Predict()).
+    /// </summary>
+    /// <param name="posteriors">Leaf posteriors of the same forest.</param>
+    /// <param name="data">The test data.</param>
+    /// <param name="predictions">Receives posteriors.Dimension() floats per data point.</param>
+    void Predict(const LeafPosteriors<F,S>& posteriors, const IDataPointCollection& data, std::vector<float>& predictions) const
+    {
+      int dimension = posteriors.Dimension();
+      float scale = 1.0f / treeCount_;
+
+      predictions.assign(data.Count() * dimension, 0.0f);
+
+      std::vector<Word> candidates;
+      std::vector<int> leafIndices(treeCount_);
+      for (unsigned int i = 0; i < data.Count(); i++)
+      {
+        FindLeaves(data, i, &leafIndices[0], candidates);
+
+        float* prediction = &predictions[i * dimension];
+        for (int t = 0; t < treeCount_; t++)
+        {
+          const float* p = posteriors.GetLeafPosterior(t, leafIndices[t]);
+          for (int c = 0; c < dimension; c++)
+            prediction[c] += p[c];
+        }
+        for (int c = 0; c < dimension; c++)
+          prediction[c] *= scale;
+      }
+    }
+
+  private:
+    struct Node_
+    {
+      float Threshold;
+      int Tree;
+      int FirstLeaf, EndLeaf;   // the range of leaves of the left subtree
+      F Feature;
+
+      bool operator<(const Node_& other) const
+      {
+        return Threshold < other.Threshold;
+      }
+    };
+
+    // Number the leaves of a subtree from left to right and add its split
+    // nodes to the lists of their axes
+    void AddNodes(const PackedTree<F,S>& tree, int treeIndex, int child, std::vector<std::vector<Node_> >& nodes)
+    {
+      if (child < 0)
+      {
+        leafIndices_[treeIndex].push_back(~child);
+        return;
+      }
+
+      const PackedSplit<F>& split = tree.GetSplit(child);
+
+      int axis = GetFeatureAxis_(split.Feature);
+      if (axis < 0)
+        throw std::runtime_error("QuickScorer requires axis-aligned features.");
+
+      Node_ node;
+      node.Threshold = split.Threshold;
+      node.Tree = treeIndex;
+      node.Feature = split.Feature;
+      node.FirstLeaf = leafIndices_[treeIndex].size();
+      AddNodes(tree, treeIndex, split.Children[0], nodes);
+      node.EndLeaf = leafIndices_[treeIndex].size();
+      AddNodes(tree, treeIndex, split.Children[1], nodes);
+
+      if ((int)(nodes.size()) <= axis)
+        nodes.resize(axis + 1);
+      nodes[axis].push_back(node);
+    }
+
+    // Word w of the mask that clears leaves [firstLeaf, endLeaf)
+    static Word Mask(int w, int firstLeaf, int endLeaf)
+    {
+      Word mask = ~(Word)(0);
+      for (int l = std::max(firstLeaf, 64 * w); l < std::min(endLeaf, 64 * (w + 1)); l++)
+        mask &= ~((Word)(1) << (l - 64 * w));
+      return mask;
+    }
+
+    void FindLeaves(const IDataPointCollection& data, unsigned int dataIndex, int* leafIndices, std::vector<Word>& candidates) const
+    {
+      Scan(data, dataIndex, candidates);
+      for (int t = 0; t < treeCount_; t++)
+        leafIndices[t] = leafIndices_[t][FindExitLeaf(&candidates[t * wordCount_])];
+    }
+
+    // Compute the candidate exit leaves of each tree
+    void Scan(const IDataPointCollection& data, unsigned int dataIndex, std::vector<Word>& candidates) const
+    {
+      candidates.assign(treeCount_ * wordCount_, ~(Word)(0));
+
+      for (unsigned int a = 0; a < axes_.size(); a++)
+      {
+        const Axis& axis = axes_[a];
+        if (axis.Thresholds.empty())
+          continue;
+
+        float response = axis.Feature.GetResponse(data, dataIndex);
+
+        // Nodes with thresholds at or below the response send it right
+        int end = std::upper_bound(axis.Thresholds.begin(), axis.Thresholds.end(), response) - axis.Thresholds.begin();
+
+        const int* trees = &axis.Trees[0];
+        const Word* masks = &axis.Masks[0];
+        Word* c = &candidates[0];
+        if (wordCount_ == 1)
+        {
+          for (int n = 0; n < end; n++)
+            c[trees[n]] &= masks[n];
+        }
+        else
+        {
+          for (int n = 0; n < end; n++)
+            for (int w = 0; w < wordCount_; w++)
+              c[trees[n] * wordCount_ + w] &= masks[n * wordCount_ + w];
+        }
+      }
+    }
+
+    int FindExitLeaf(const Word* candidates) const
+    {
+      int w = 0;
+      while (candidates[w] == 0)
+        w++;   // a valid tree always leaves at least one candidate
+
+      Word word = candidates[w];
+#if defined(__GNUC__)
+      return 64 * w + __builtin_ctzll(word);
+#else
+      int b = 0;
+      while ((word & 1) == 0)
+      {
+        word >>= 1;
+        b++;
+      }
+      return 64 * w + b;
+#endif
+    }
+  };
+} } }
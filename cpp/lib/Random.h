@@ -6,21 +6,53 @@
 #include <time.h>
 #include <cstdlib>
 
+#include <istream>
+#include <ostream>
+
 namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 {
   /// <summary>
   /// Encapsulates random number generation - so as to facilitate
   /// overriding of standard library behaviours.
   /// </summary>
+
+  // *** NB Each Random instance carries its own generator state (rather than
+  // relying on the global state behind rand()) so that the state can be
+  // saved and restored, e.g. when checkpointing a long training run, and so
+  // that separate instances produce independent streams.
+
   class Random
   {
+    unsigned long long state_;
+
+    void Seed(unsigned long long seed)
+    {
+      // One round of SplitMix64 so that similar seeds (e.g. consecutive
+      // integers) give unrelated streams and the state is never zero.
+      unsigned long long z = seed + 0x9E3779B97F4A7C15ULL;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      state_ = z ^ (z >> 31);
+      if (state_ == 0)
+        state_ = 0x9E3779B97F4A7C15ULL;
+    }
+
+    unsigned long long NextBits()
+    {
+      // xorshift64*
+      state_ ^= state_ >> 12;
+      state_ ^= state_ << 25;
+      state_ ^= state_ >> 27;
+      return state_ * 0x2545F4914F6CDD1DULL;
+    }
+
   public:
     /// <summary>
     /// Creates a 'random number' generator using a seed derived from the system time.
     /// </summary>
     Random()
     {
-      srand ( (unsigned int)(time(NULL)) );
+      Seed((unsigned long long)(time(NULL)));
     }
 
     /// <summary>
@@ -29,14 +61,14 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// </summary>
     Random(unsigned int seed)
     {
-      srand ( seed );
+      Seed(seed);
     }
 
     /// <summary>
     /// Generate a positive random number.
     int Next()
     {
-      return rand();
+      return (int)(NextBits() >> 33);
     }
 
     /// <summary>
@@ -44,7 +76,7 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// </summary>
     double NextDouble()
     {
-      return (double)(rand())/RAND_MAX;
+      return (double)(NextBits() >> 11) * (1.0 / 9007199254740992.0);
     }
 
     /// <summary>
@@ -54,7 +86,23 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     /// <param name="maxValue">Exclusive upper bound.</param>
     int Next(int minValue, int maxValue)
     {
-      return minValue + rand()%(maxValue-minValue);
+      return minValue + Next()%(maxValue-minValue);
+    }
+
+    /// <summary>
+    /// Write the generator state to a binary stream.
+    /// </summary>
+    void Serialize(std::ostream& o) const
+    {
+      o.write((const char*)(&state_), sizeof(state_));
+    }
+
+    /// <summary>
+    /// Restore generator state previously written by Serialize().
+    /// </summary>
+    void Deserialize(std::istream& i)
+    {
+      i.read((char*)(&state_), sizeof(state_));
     }
   };
 } } }
@@ -7,8 +7,30 @@
 
 #include "Forest.h"
 #include "Tree.h"
+#include "PackedTree.h"
+#include "LeafPosteriors.h"
+#include "ForestCodeGenerator.h"
+#include "QuickScorer.h"
 #include "Node.h"
 
 #include "ForestTrainer.h"
+#include "ForestCheckpoint.h"
+#include "FeatureCost.h"
+#include "CandidateThresholds.h"
+#include "TrainingMemoryEstimator.h"
+
+#include "Fern.h"
+#include "FernTrainer.h"
+
+#include "Jungle.h"
+#include "JungleTrainer.h"
+
+#include "Boosting.h"
+
+#include "OnlineForestTrainer.h"
+#include "ForestRefitter.h"
+#include "ForestPruner.h"
+#include "DistributedForestTrainer.h"
+#include "OutOfCoreForestTrainer.h"
 
 #include "Interfaces.h"
@@ -0,0 +1,213 @@
+#pragma once
+
+// This file defines the TrainingMemoryEstimator class, which predicts the
+// peak memory requirement of forest training, and adapts training to (or
+// rejects training that would exceed) TrainingParameters.MemoryBudget.
+
+#include <cstddef>
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ProgressStream.h"
+
+#include "TrainingParameters.h"
+#include "Interfaces.h"
+#include "Node.h"
+
+namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
+{
+  /// <summary>
+  /// The memory (in bytes) required by a forest training run.
+  /// </summary>
+  struct TrainingMemoryEstimate
+  {
+    TrainingMemoryEstimate()
+    {
+      ForestBytes = 0;
+      SharedWorkspaceBytes = 0;
+      ThreadWorkspaceBytes = 0;
+      ReplicaBytes = 0;
+      Threads = 1;
+    }
+
+    std::size_t ForestBytes;            // trained trees (upper bound)
+    std::size_t SharedWorkspaceBytes;   // data point indices, responses and statistics
+    std::size_t ThreadWorkspaceBytes;   // per thread (ParallelForestTrainer only)
+    std::size_t ReplicaBytes;           // per thread, if ReplicateTrainingData is set
+    int Threads;
+
+    /// <summary>
+    /// The peak memory requirement, excluding the training data itself.
+    /// </summary>
+    std::size_t PeakBytes() const
+    {
+      return ForestBytes + SharedWorkspaceBytes + Threads * (ThreadWorkspaceBytes + ReplicaBytes);
+    }
+
+    std::string ToString() const
+    {
+      std::stringstream s;
+      s << std::fixed << std::setprecision(1) << MegaBytes(PeakBytes()) << " MB (forest "
+        << MegaBytes(ForestBytes) << " MB, workspace " << MegaBytes(SharedWorkspaceBytes + Threads * ThreadWorkspaceBytes) << " MB";
+      if (ReplicaBytes != 0)
+        s << ", data replicas " << MegaBytes(Threads * ReplicaBytes) << " MB";
+      s << ")";
+      return s.str();
+    }
+
+    static double MegaBytes(std::size_t bytes)
+    {
+      return bytes / (1024.0 * 1024.0);
+    }
+  };
+
+  /// <summary>
+  /// Predicts the memory used by ForestTrainer and ParallelForestTrainer
+  /// from the training parameters, the number of training data points and
+  /// sizeof(Node&lt;F,S&gt;).
+  /// </summary>
+
+  // *** NB The estimates assume that IFeatureResponse and
+  // IStatisticsAggregator implementations are value types (see Node.h) so
+  // that sizeof() accounts for all of their memory. The training data
+  // itself is excluded (except for per-thread replicas, which are sized
+  // using IDataPointCollection::GetMemoryUsage()).
+  template<class F, class S>
+  class TrainingMemoryEstimator // where F:IFeatureResponse where S:IStatisticsAggregator<S>
+  {
+  public:
+    /// <summary>
+    /// An upper bound on the memory occupied by a Tree with the specified
+    /// number of decision levels, trained on the specified number of data
+    /// points. Trees only store the nodes they use, so a tree has at most
+    /// 2^(decisionLevels+1)-1 nodes and (if no split sends all data points
+    /// the same way) at most 2*dataCount-1 nodes.
+    /// </summary>
+    static std::size_t GetTreeBytes(int decisionLevels, unsigned int dataCount)
+    {
+      std::size_t nodeCount = 2 * (std::size_t)(dataCount > 0 ? dataCount : 1) - 1;
+      if (decisionLevels + 1 < (int)(8 * sizeof(std::size_t)) - 1)
+        nodeCount = std::min(nodeCount, ((std::size_t)(1) << (decisionLevels + 1)) - 1);
+      return nodeCount * sizeof(Node<F,S>);
+    }
+
+    /// <summary>
+    /// Estimate the peak memory requirement of ForestTrainer::TrainForest().
+    /// </summary>
+    static TrainingMemoryEstimate EstimateForestTrainer(
+      const TrainingParameters& parameters,
+      const IDataPointCollection& data )
+    {
+      TrainingMemoryEstimate estimate;
+      estimate.ForestBytes = parameters.NumberOfTrees * GetTreeBytes(parameters.MaxDecisionLevels, data.Count());
+
+      // TreeTrainingOperation: indices and responses per data point, parent
+      // and child statistics, partition statistics and thresholds
+      std::size_t nBins = parameters.NumberOfCandidateThresholdsPerFeature + 1;
+      estimate.SharedWorkspaceBytes = data.Count() * (sizeof(unsigned int) + sizeof(float))
+        + (3 + nBins) * sizeof(S) + nBins * sizeof(float);
+
+      return estimate;
+    }
+
+    /// <summary>
+    /// Estimate the peak memory requirement of ParallelForestTrainer::TrainForest().
+    /// </summary>
+    static TrainingMemoryEstimate EstimateParallelForestTrainer(
+      const TrainingParameters& parameters,
+      int threads,
+      const IDataPointCollection& data )
+    {
+      TrainingMemoryEstimate estimate;
+      estimate.Threads = threads;
+      estimate.ForestBytes = parameters.NumberOfTrees * GetTreeBytes(parameters.MaxDecisionLevels, data.Count());
+      estimate.SharedWorkspaceBytes = data.Count() * (sizeof(unsigned int) + sizeof(float)) + 3 * sizeof(S);
+
+      std::size_t nBins = parameters.NumberOfCandidateThresholdsPerFeature + 1;
+      estimate.ThreadWorkspaceBytes = (3 + nBins) * sizeof(S) + nBins * sizeof(float);
+      if (!parameters.StreamResponses)
+        estimate.ThreadWorkspaceBytes += data.Count() * sizeof(float);
+
+      if (parameters.ReplicateTrainingData)
+        estimate.ReplicaBytes = data.GetMemoryUsage();
+
+      return estimate;
+    }
+
+    /// <summary>
+    /// Check that ForestTrainer::TrainForest() fits within
+    /// parameters.MemoryBudget (if non-zero).
+    /// </summary>
+    static void CheckBudget(const TrainingParameters& parameters, const IDataPointCollection& data, ProgressStream& progress)
+    {
+      if (parameters.MemoryBudget == 0)
+        return;
+
+      TrainingMemoryEstimate estimate = EstimateForestTrainer(parameters, data);
+      progress[Interest] << "Estimated peak training memory " << estimate.ToString() << "." << std::endl;
+
+      if (estimate.PeakBytes() > parameters.MemoryBudget)
+        throw std::runtime_error(ExceededMessage(estimate, parameters));
+    }
+
+    /// <summary>
+    /// Adapt ParallelForestTrainer::TrainForest() to fit within
+    /// parameters.MemoryBudget (if non-zero) by, in turn, discarding
+    /// per-thread replicas of the training data, streaming feature
+    /// responses and reducing the number of threads.
+    /// </summary>
+    /// <param name="parameters">Training parameters (modified).</param>
+    /// <param name="maxThreads">The maximum number of threads.</param>
+    /// <param name="data">The training data.</param>
+    /// <returns>The number of threads to use.</returns>
+    static int FitBudget(TrainingParameters& parameters, int maxThreads, const IDataPointCollection& data, ProgressStream& progress)
+    {
+      if (parameters.MemoryBudget == 0)
+        return maxThreads;
+
+      int threads = maxThreads;
+      TrainingMemoryEstimate estimate = EstimateParallelForestTrainer(parameters, threads, data);
+
+      if (estimate.PeakBytes() > parameters.MemoryBudget && parameters.ReplicateTrainingData)
+      {
+        parameters.ReplicateTrainingData = false;
+        estimate = EstimateParallelForestTrainer(parameters, threads, data);
+        progress[Interest] << "Not replicating training data to fit memory budget." << std::endl;
+      }
+
+      if (estimate.PeakBytes() > parameters.MemoryBudget && !parameters.StreamResponses)
+      {
+        parameters.StreamResponses = true;
+        estimate = EstimateParallelForestTrainer(parameters, threads, data);
+        progress[Interest] << "Streaming feature responses to fit memory budget." << std::endl;
+      }
+
+      while (estimate.PeakBytes() > parameters.MemoryBudget && threads > 1)
+        estimate = EstimateParallelForestTrainer(parameters, --threads, data);
+
+      if (threads < maxThreads)
+        progress[Interest] << "Training with " << threads << " threads to fit memory budget." << std::endl;
+
+      progress[Interest] << "Estimated peak training memory " << estimate.ToString() << "." << std::endl;
+
+      if (estimate.PeakBytes() > parameters.MemoryBudget)
+        throw std::runtime_error(ExceededMessage(estimate, parameters));
+
+      return threads;
+    }
+
+  private:
+    static std::string ExceededMessage(const TrainingMemoryEstimate& estimate, const TrainingParameters& parameters)
+    {
+      std::stringstream s;
+      s << std::fixed << std::setprecision(1) << "Estimated peak training memory ("
+        << TrainingMemoryEstimate::MegaBytes(estimate.PeakBytes()) << " MB) exceeds budget ("
+        << TrainingMemoryEstimate::MegaBytes(parameters.MemoryBudget) << " MB).";
+      return s.str();
+    }
+  };
+} } }
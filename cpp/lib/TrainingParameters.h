@@ -5,12 +5,29 @@
 
 #include <assert.h>
 
+#include <cstddef>
+
 #include <vector>
 #include <string>
 #include <algorithm>
 
 namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 {
+  /// <summary>
+  /// How (if at all) the inference-time cost of evaluating features is
+  /// traded off against information gain when choosing splits.
+  /// </summary>
+  class SplitCostMode
+  {
+  public:
+    enum e
+    {
+      None = 0x0,           // maximize gain
+      GainPerCost = 0x1,    // maximize gain / feature cost
+      PenalizedGain = 0x2   // maximize gain - CostPenalty * feature cost * fraction of samples reaching the node
+    };
+  };
+
   /// <summary>
   /// Decision tree training parameters.
   /// </summary>
@@ -24,6 +41,13 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       NumberOfCandidateThresholdsPerFeature = 10;
       MaxDecisionLevels = 5;
       Verbose = false;
+      ExtremelyRandomized = false;
+      CheckpointInterval = 1;
+      CostMode = SplitCostMode::None;
+      CostPenalty = 0.0;
+      ReplicateTrainingData = false;
+      StreamResponses = false;
+      MemoryBudget = 0;
     }
 
     int NumberOfTrees;
@@ -31,5 +55,44 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     unsigned int NumberOfCandidateThresholdsPerFeature;
     int MaxDecisionLevels;
     bool Verbose;
+
+    // If ExtremelyRandomized is true, each candidate feature is evaluated at
+    // a single threshold drawn uniformly from the range of responses at the
+    // node (as in extremely randomized trees), rather than at
+    // NumberOfCandidateThresholdsPerFeature thresholds chosen from sampled
+    // response quantiles.
+    bool ExtremelyRandomized;
+
+    // If CheckpointPath is non-empty, ForestTrainer writes the trees
+    // trained so far (and the random number generator state) to this file
+    // every CheckpointInterval trees, resumes from it if it exists (and was
+    // written with the same parameters), and deletes it when training is
+    // complete.
+    std::string CheckpointPath;
+    int CheckpointInterval;
+
+    // Feature costs are given by GetFeatureCost_(). With
+    // SplitCostMode::PenalizedGain, the penalty summed over the split nodes
+    // of a tree is CostPenalty times the expected cost of evaluating the
+    // tree, so a node is only split if the gain justifies the additional
+    // inference cost.
+    SplitCostMode::e CostMode;
+    double CostPenalty;
+
+    // ParallelForestTrainer only: give each thread its own copy of the
+    // training data (if IDataPointCollection::Clone() is implemented).
+    bool ReplicateTrainingData;
+
+    // ParallelForestTrainer only: rather than buffering each thread's
+    // feature responses (4 bytes per data point per thread), recompute them
+    // as needed (at the cost of additional feature evaluations).
+    bool StreamResponses;
+
+    // If MemoryBudget is non-zero, ForestTrainer fails fast (and
+    // ParallelForestTrainer first adapts by clearing ReplicateTrainingData,
+    // setting StreamResponses and using fewer threads) if training is
+    // estimated to need more than MemoryBudget bytes (see
+    // TrainingMemoryEstimator).
+    std::size_t MemoryBudget;
   };
 } } }
\ No newline at end of file
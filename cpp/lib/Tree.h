@@ -26,39 +26,64 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
   {
     static const char* binaryFileHeader_;
 
+    static const int NoSplitStatistics = 0x1;   // serialization flags
+
     typedef typename std::vector<unsigned int>::size_type DataPointIndex;
+    typedef typename std::vector<Node<F,S> >::size_type NodeIndex;
 
     int decisionLevels_;
 
+    // Only split and leaf nodes are stored (so memory is proportional to
+    // the actual size of the tree rather than to 2^decisionLevels_). The
+    // root is nodes_[0] and each split node stores the index of its
+    // children (see Node::LeftChildIndex), which are added as a pair when
+    // the node is split, i.e. in depth-first order for trees trained
+    // recursively and breadth-first order for trees trained level-wise.
     std::vector<Node<F,S> > nodes_;
 
+    bool hasSplitStatistics_;   // false once StripSplitStatistics() is called
+
   public:
     // Implementation only
-    Tree(int decisionLevels):decisionLevels_(decisionLevels)
+    Tree(int decisionLevels):decisionLevels_(decisionLevels), hasSplitStatistics_(true)
     {
       if(decisionLevels<0)
         throw std::runtime_error("Tree can't have less than 0 decision levels.");
 
-      if(decisionLevels>19)
-        throw std::runtime_error("Tree can't have more than 19 decision levels.");
-
-      // This full allocation of node storage may be wasteful of memory
-      // if trees are unbalanced but is efficient otherwise. Because child
-      // node indices can determined directly from the parent node's index
-      // it isn't necessary to store parent-child references within the
-      // nodes.
-      nodes_.resize((1 << (decisionLevels + 1)) - 1);
+      nodes_.resize(1); // a null root node, to be initialized by training
     }
 
     std::vector<Node<F,S> > & GetNodes() { return nodes_;}
 
+    /// <summary>
+    /// Implementation only: make the specified node a split node and add
+    /// its two (null) child nodes to the end of the node array.
+    /// </summary>
+    /// <returns>The index of the left child node.</returns>
+    static NodeIndex InitializeSplit(std::vector<Node<F,S> >& nodes, NodeIndex nodeIndex, F feature, float threshold, S trainingDataStatistics)
+    {
+      NodeIndex leftChildIndex = nodes.size();
+      nodes[nodeIndex].InitializeSplit(feature, threshold, trainingDataStatistics, (int)(leftChildIndex));
+      nodes.resize(leftChildIndex + 2);
+      return leftChildIndex;
+    }
+
+    /// <summary>
+    /// The maximum number of decision levels (the depth of the deepest
+    /// possible leaf node).
+    /// </summary>
+    int DecisionLevels() const
+    {
+      return decisionLevels_;
+    }
+
   public:
     /// <summary>
     /// Apply the decision tree to a collection of test data points.
     /// </summary>
     /// <param name="data">The test data.</param>
     /// <returns>An array of leaf node indices per data point.</returns>
-    void Apply(const IDataPointCollection& data, std::vector<int>& leafNodeIndices)
+    void Apply(const IDataPointCollection& data, std::vector<int>& leafNodeIndices) const
     {
       CheckValid();
 
@@ -74,9 +99,72 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       ApplyNode(0, data, dataIndices_, 0, data.Count(), leafNodeIndices, responses_);
     }
 
-    void Serialize(std::ostream& o) const
+    /// <summary>
+    /// Apply the decision tree to a single data point. Unlike Apply(), this
+    /// neither allocates memory nor checks the tree's validity.
+    /// </summary>
+    /// <param name="data">The test data.</param>
+    /// <param name="dataIndex">The index of the data point to be evaluated.</param>
+    /// <returns>The index of the leaf node reached.</returns>
+    int ApplyOne(const IDataPointCollection& data, unsigned int dataIndex) const
     {
-      const int majorVersion = 0, minorVersion = 0;
+      int nodeIndex = 0;
+      while (nodes_[nodeIndex].IsSplit())
+      {
+        const Node<F,S>& node = nodes_[nodeIndex];
+        nodeIndex = node.LeftChildIndex + (int)(node.Feature.GetResponse(data, dataIndex) >= node.Threshold);
+      }
+      assert(nodes_[nodeIndex].IsLeaf());
+      return nodeIndex;
+    }
+
+    /// <summary>
+    /// Discard the training data statistics of split nodes, which are
+    /// needed to prune or to continue training the tree but not for
+    /// inference. Split nodes are left with default-constructed statistics.
+    /// </summary>
+    void StripSplitStatistics()
+    {
+      // Rebuild the node array, so that any memory owned by the discarded
+      // statistics (and any spare capacity) is released
+      std::vector<Node<F,S> > nodes(nodes_.size());
+      for(int n=0; n<NodeCount(); n++)
+      {
+        const Node<F,S>& node = nodes_[n];
+        if(node.IsSplit())
+        {
+          nodes[n].bIsLeaf_ = node.bIsLeaf_;
+          nodes[n].bIsSplit_ = node.bIsSplit_;
+          nodes[n].Feature = node.Feature;
+          nodes[n].Threshold = node.Threshold;
+          nodes[n].LeftChildIndex = node.LeftChildIndex;
+        }
+        else
+          nodes[n] = node;
+      }
+      nodes_.swap(nodes);
+      hasSplitStatistics_ = false;
+    }
+
+    /// <summary>
+    /// Do split nodes store their training data statistics, i.e. have they
+    /// not been stripped (see StripSplitStatistics())?
+    /// </summary>
+    bool HasSplitStatistics() const
+    {
+      return hasSplitStatistics_;
+    }
+
+    /// <summary>
+    /// Serialize the tree to a binary stream.
+    /// </summary>
+    /// <param name="o">The stream.</param>
+    /// <param name="stripSplitStatistics">Omit the training data statistics
+    /// of split nodes (see StripSplitStatistics()). They are always omitted
+    /// if already stripped.</param>
+    void Serialize(std::ostream& o, bool stripSplitStatistics=false) const
+    {
+      const int majorVersion = 1, minorVersion = 1;
 
       o.write(binaryFileHeader_, strlen(binaryFileHeader_));
       o.write((const char*)(&majorVersion), sizeof(majorVersion));
@@ -89,8 +177,18 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       o.write((const char*)(&decisionLevels_), sizeof(decisionLevels_));
 
+      int nodeCount = NodeCount();
+      o.write((const char*)(&nodeCount), sizeof(nodeCount));
+
+      bool omitSplitStatistics = stripSplitStatistics || !hasSplitStatistics_;
+      int flags = omitSplitStatistics ? NoSplitStatistics : 0;
+      o.write((const char*)(&flags), sizeof(flags));
+
       for(int n=0; n<NodeCount(); n++)
-        nodes_[n].Serialize(o);
+      {
+        nodes_[n].Serialize(o, !(omitSplitStatistics && nodes_[n].IsSplit()));
+        o.write((const char*)(&nodes_[n].LeftChildIndex), sizeof(nodes_[n].LeftChildIndex));
+      }
     }
 
     static std::auto_ptr<Tree<F,S> > Deserialize(std::istream& i)
@@ -110,16 +208,52 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
 
       if(majorVersion==0 && minorVersion==0)
       {
+        // Nodes were stored in full, in breadth-first order (the children
+        // of node i being nodes 2i+1 and 2i+2)
         int decisionLevels;
         i.read((char*)(&decisionLevels), sizeof(decisionLevels));
 
-        if(decisionLevels<=0)
+        if(decisionLevels<=0 || decisionLevels>19)
           throw std::runtime_error("Invalid data");
 
+        std::vector<Node<F,S> > nodes((1 << (decisionLevels + 1)) - 1);
+        for(unsigned int n=0; n<nodes.size(); n++)
+          nodes[n].Deserialize(i);
+
         tree = std::auto_ptr<Tree<F,S> >(new Tree<F, S>(decisionLevels));
+        tree->nodes_.clear();
+        tree->nodes_.push_back(nodes[0]);
+        CompactRecurse(nodes, 0, tree->nodes_, 0);
 
-        for(int n=0; n<tree->NodeCount(); n++)
-          tree->nodes_[n].Deserialize(i);
+        tree->CheckValid();
+      }
+      else if(majorVersion==1 && (minorVersion==0 || minorVersion==1))
+      {
+        int decisionLevels, nodeCount, flags = 0;
+        i.read((char*)(&decisionLevels), sizeof(decisionLevels));
+        i.read((char*)(&nodeCount), sizeof(nodeCount));
+        if(minorVersion>=1)
+          i.read((char*)(&flags), sizeof(flags));
+
+        if(decisionLevels<0 || nodeCount<=0 || !i)
+          throw std::runtime_error("Invalid data");
+
+        tree = std::auto_ptr<Tree<F,S> >(new Tree<F, S>(decisionLevels));
+        tree->nodes_.resize(nodeCount);
+        tree->hasSplitStatistics_ = (flags & NoSplitStatistics) == 0;
+
+        for(int n=0; n<nodeCount; n++)
+        {
+          // Read the node type first, to see whether statistics follow
+          Node<F,S>& node = tree->nodes_[n];
+          node.Deserialize(i, false);
+          if((flags & NoSplitStatistics)==0 || !node.IsSplit())
+            Deserialize_(i, node.TrainingDataStatistics);
+          i.read((char*)(&node.LeftChildIndex), sizeof(node.LeftChildIndex));
+        }
+
+        if(!i)
+          throw std::runtime_error("Invalid data");
 
         tree->CheckValid();
       }
@@ -130,7 +264,8 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
     }
 
     /// <summary>
-    /// The number of nodes in the tree, including decision, leaf, and null nodes.
+    /// The number of nodes in the tree, i.e. decision and leaf nodes (and,
+    /// during training, null nodes not yet trained).
     /// </summary>
     int NodeCount() const
     {
@@ -197,52 +332,79 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       if(GetNode(0).IsNull()==true)
         throw std::runtime_error("A valid tree must have non-null root node.");
 
-      CheckValidRecurse(0);
+      std::vector<bool> reached(NodeCount(), false);
+      CheckValidRecurse(0, 0, reached);
+
+      for(int n=0; n<NodeCount(); n++)
+        if(reached[n]==false)
+          throw std::runtime_error("Valid tree must not have nodes that are unreachable from the root node.");
     }
 
   private:
-    void CheckValidRecurse(int index, bool bHaveReachedLeaf=false) const
+    void CheckValidRecurse(int index, int depth, std::vector<bool>& reached) const
     {
-      if (bHaveReachedLeaf==false && GetNode(index).IsLeaf())
-      {
-        // First time I have encountered a leaf node
-        bHaveReachedLeaf = true;
-      }
-      else
-      {
-        if (bHaveReachedLeaf)
-        {
-          // Have encountered a leaf node already, this node had better be null
-          if (GetNode(index).IsNull() == false)
-            throw std::runtime_error("Valid tree must have all descendents of leaf nodes set as null nodes.");
-        }
-        else
-        {
-          // Have not encountered a leaf node yet, this node had better be a split node
-          if (GetNode(index).IsSplit() == false)
-            throw std::runtime_error("Valid tree must have all antecents of leaf nodes set as split nodes.");
-        }
-      }
+      const Node<F,S>& node = GetNode(index);
 
-      if (index >= (NodeCount() - 1) / 2)
-      {
-        // At maximum depth, this node had better be a leaf
-        if (bHaveReachedLeaf == false)
-          throw std::runtime_error("Valid tree must have all branches terminated by leaf nodes.");
-      }
-      else
-      {
-        CheckValidRecurse(2 * index + 1, bHaveReachedLeaf);
-        CheckValidRecurse(2 * index + 2, bHaveReachedLeaf);
-      }
+      if (reached[index])
+        throw std::runtime_error("Valid tree must not have nodes reachable by more than one path.");
+      reached[index] = true;
+
+      if (node.IsNull())
+        throw std::runtime_error("Valid tree must have all branches terminated by leaf nodes.");
+
+      if (node.IsLeaf())
+        return;
+
+      if (depth >= decisionLevels_)
+        throw std::runtime_error("Valid tree must not have split nodes at maximum depth.");
+
+      if (node.LeftChildIndex <= index || node.LeftChildIndex + 1 >= NodeCount())
+        throw std::runtime_error("Valid tree must store child nodes after their parents.");
+
+      CheckValidRecurse(node.LeftChildIndex, depth + 1, reached);
+      CheckValidRecurse(node.LeftChildIndex + 1, depth + 1, reached);
+    }
+
+    // Copy the subtree rooted at node heapIndex of a tree stored in full in
+    // breadth-first order (as by serialization format 0.0) to nodes[nodeIndex].
+    static void CompactRecurse(const std::vector<Node<F,S> >& heap, int heapIndex, std::vector<Node<F,S> >& nodes, NodeIndex nodeIndex)
+    {
+      const Node<F,S>& node = heap[heapIndex];
+      if (node.IsSplit() == false || 2 * heapIndex + 2 >= (int)(heap.size()))
+        return;   // CheckValid() will reject a split node without children
+
+      NodeIndex leftChildIndex = InitializeSplit(nodes, nodeIndex, node.Feature, node.Threshold, node.TrainingDataStatistics);
+      nodes[leftChildIndex] = heap[2 * heapIndex + 1];
+      nodes[leftChildIndex + 1] = heap[2 * heapIndex + 2];
+
+      CompactRecurse(heap, 2 * heapIndex + 1, nodes, leftChildIndex);
+      CompactRecurse(heap, 2 * heapIndex + 2, nodes, leftChildIndex + 1);
     }
 
   public:
-    static std::string GetPrettyPrintPrefix(int nodeIndex)
+    /// <summary>
+    /// Get a prefix for the progress output of the specified node that
+    /// draws its position within the tree (used for verbose progress only,
+    /// this takes time linear in the number of nodes preceding it).
+    /// </summary>
+    static std::string GetPrettyPrintPrefix(const std::vector<Node<F,S> >& nodes, int nodeIndex)
     {
-      std::string prefix = nodeIndex > 0 ? (nodeIndex % 2 == 1 ? "|-o " : "+-o ") : "o ";
-      for (int l = (nodeIndex - 1) / 2; l > 0; l = (l - 1) / 2)
-        prefix = (l % 2 == 1 ? "| " : "  ") + prefix;
+      // Find the node's ancestors, which are stored before it
+      std::string prefix = "o ";
+      int child = nodeIndex;
+      for (int n = nodeIndex - 1; n >= 0; n--)
+      {
+        if (nodes[n].IsSplit() == false || (nodes[n].LeftChildIndex != child && nodes[n].LeftChildIndex + 1 != child))
+          continue;
+
+        bool bIsLeftChild = nodes[n].LeftChildIndex == child;
+        if (child == nodeIndex)
+          prefix = bIsLeftChild ? "|-o " : "+-o ";
+        else
+          prefix = (bIsLeftChild ? "| " : "  ") + prefix;
+
+        child = n;
+      }
       return prefix;
     }
 
@@ -254,11 +416,11 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       int i0,
       int i1,
       std::vector<int>& leafNodeIndices,
-      std::vector<float>& responses_)
+      std::vector<float>& responses_) const
     {
       assert(nodes_[nodeIndex].IsNull()==false);
 
-      Node<F,S>& node = nodes_[nodeIndex];
+      const Node<F,S>& node = nodes_[nodeIndex];
 
       if (node.IsLeaf())
       {
@@ -276,8 +438,8 @@ namespace MicrosoftResearch { namespace Cambridge { namespace Sherwood
       int ii = Partition(responses_, dataIndices, i0, i1, node.Threshold);
 
       // Recurse for child nodes.
-      ApplyNode(nodeIndex * 2 + 1, data, dataIndices, i0, ii, leafNodeIndices, responses_);
-      ApplyNode(nodeIndex * 2 + 2, data, dataIndices, ii, i1, leafNodeIndices, responses_);
+      ApplyNode(node.LeftChildIndex, data, dataIndices, i0, ii, leafNodeIndices, responses_);
+      ApplyNode(node.LeftChildIndex + 1, data, dataIndices, ii, i1, leafNodeIndices, responses_);
     }
   };
 
@@ -0,0 +1,630 @@
+// Round-trip and equivalence checks of the decision forest library, run by
+// 'make test'. Each check compares the output of an optimized or persisted
+// representation of a forest against that of the trees it was built from.
+//
+// The program takes the directory in which to write its temporary files,
+// including C++ source code generated by ForestCodeGenerator, which the
+// Makefile then compiles and runs (each generated program checks its own
+// predictions and exits with a non-zero status on a mismatch).
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "Sherwood.h"
+
+#include "../demo/source/DataPointCollection.h"
+#include "../demo/source/Classification.h"
+
+using namespace MicrosoftResearch::Cambridge::Sherwood;
+
+namespace
+{
+  typedef AxisAlignedFeatureResponse F;
+  typedef HistogramAggregator S;
+
+  const int ClassCount = 4;
+
+  int checkCount = 0, failureCount = 0;
+
+  ProgressStream silent(std::cout, Silent);
+
+  void Check(bool condition, const std::string& description)
+  {
+    checkCount++;
+    if (condition == false)
+    {
+      std::cout << "FAILED: " << description << std::endl;
+      failureCount++;
+    }
+  }
+
+  template<class E>
+  bool Throws(E e)
+  {
+    try
+    {
+      e();
+    }
+    catch (const std::runtime_error&)
+    {
+      return true;
+    }
+    return false;
+  }
+
+  /// <summary>
+  /// Generate 2D data points, uniformly distributed in the unit square, each
+  /// labelled by its quadrant (with some label noise).
+  /// </summary>
+  std::auto_ptr<DataPointCollection> CreateData(Random& random, int count, bool labelled=true)
+  {
+    std::ostringstream o;
+    for (int i = 0; i < count; i++)
+    {
+      float x = (float)(random.NextDouble()), y = (float)(random.NextDouble());
+      int label = random.NextDouble() < 0.1 ? random.Next(0, ClassCount) : (x < 0.5f ? 0 : 1) + (y < 0.5f ? 0 : 2);
+      if (labelled)
+        o << "c" << label << "\t";
+      o << std::setprecision(9) << x << "\t" << y << std::endl;
+    }
+
+    std::istringstream i(o.str());
+    return DataPointCollection::Load(i, 2, labelled ? DataDescriptor::HasClassLabels : DataDescriptor::Unadorned);
+  }
+
+  TrainingParameters CreateParameters()
+  {
+    TrainingParameters parameters;
+    parameters.NumberOfTrees = 5;
+    parameters.NumberOfCandidateFeatures = 2;
+    parameters.NumberOfCandidateThresholdsPerFeature = 10;
+    parameters.MaxDecisionLevels = 6;
+    return parameters;
+  }
+
+  std::auto_ptr<Forest<F,S> > TrainForest(unsigned int seed, const TrainingParameters& parameters, const DataPointCollection& data)
+  {
+    Random random(seed);
+    AxisAlignedFeatureResponseFactory featureFactory;
+    ClassificationTrainingContext<F> context(ClassCount, &featureFactory);
+    return ForestTrainer<F,S>::TrainForest(random, parameters, context, data, &silent);
+  }
+
+  /// <summary>
+  /// Build a tree of random axis-aligned splits that is complete to the
+  /// specified depth, e.g. to exercise traversal of trees too large for the
+  /// cache.
+  /// </summary>
+  std::auto_ptr<Tree<F,S> > CreateCompleteTree(Random& random, int decisionLevels)
+  {
+    std::auto_ptr<Tree<F,S> > tree(new Tree<F,S>(decisionLevels));
+    std::vector<Node<F,S> >& nodes = tree->GetNodes();
+
+    // Nodes are initialized breadth first, so those of the deepest level are last
+    int firstLeaf = (1 << decisionLevels) - 1;
+    for (int n = 0; n < firstLeaf; n++)
+      Tree<F,S>::InitializeSplit(nodes, n, F(random.Next(0, 2)), (float)(random.NextDouble()), S(ClassCount));
+    for (int n = firstLeaf; n < (int)(nodes.size()); n++)
+      nodes[n].InitializeLeaf(S(ClassCount));
+
+    return tree;
+  }
+
+  std::string Serialized(const Forest<F,S>& forest, bool stripSplitStatistics=false)
+  {
+    std::ostringstream o(std::ios_base::binary);
+    forest.Serialize(o, stripSplitStatistics);
+    return o.str();
+  }
+
+  std::auto_ptr<Forest<F,S> > Copy(const Forest<F,S>& forest)
+  {
+    std::istringstream i(Serialized(forest), std::ios_base::binary);
+    return Forest<F,S>::Deserialize(i);
+  }
+
+  /// <summary>
+  /// The leaf node indices reached in each tree, found by Tree::Apply(), to
+  /// which those of other methods are compared.
+  /// </summary>
+  std::vector<std::vector<int> > ApplyTrees(const Forest<F,S>& forest, const IDataPointCollection& data)
+  {
+    std::vector<std::vector<int> > leafNodeIndices(forest.TreeCount());
+    for (int t = 0; t < forest.TreeCount(); t++)
+      forest.GetTree(t).Apply(data, leafNodeIndices[t]);
+    return leafNodeIndices;
+  }
+
+  bool Near(const std::vector<float>& a, const std::vector<float>& b)
+  {
+    if (a.size() != b.size())
+      return false;
+    for (std::vector<float>::size_type i = 0; i < a.size(); i++)
+      if (std::abs(a[i] - b[i]) > 1e-6f)
+        return false;
+    return true;
+  }
+
+  void TestRandomSerialization()
+  {
+    Random random(7);
+    random.Next();
+
+    std::stringstream s(std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    random.Serialize(s);
+    int next = random.Next();
+    double nextDouble = random.NextDouble();
+
+    Random restored(99);
+    restored.Deserialize(s);
+    Check(restored.Next() == next && restored.NextDouble() == nextDouble, "Random::Deserialize() restores the generator state");
+  }
+
+  void TestForestSerialization(const Forest<F,S>& forest, const DataPointCollection& data)
+  {
+    std::vector<std::vector<int> > expected = ApplyTrees(forest, data);
+
+    std::auto_ptr<Forest<F,S> > copy = Copy(forest);
+    Check(Serialized(*copy) == Serialized(forest), "a deserialized forest serializes identically");
+    Check(ApplyTrees(*copy, data) == expected, "a deserialized forest reaches the same leaves");
+
+    std::istringstream i(Serialized(forest, true), std::ios_base::binary);
+    std::auto_ptr<Forest<F,S> > stripped = Forest<F,S>::Deserialize(i);
+    Check(stripped->GetTree(0).HasSplitStatistics() == false, "a forest serialized without split statistics is deserialized without them");
+    Check(ApplyTrees(*stripped, data) == expected, "a forest serialized without split statistics reaches the same leaves");
+    for (int t = 0; t < forest.TreeCount(); t++)
+      for (int n = 0; n < forest.GetTree(t).NodeCount(); n++)
+        if (forest.GetTree(t).GetNode(n).IsLeaf())
+          Check(stripped->GetTree(t).GetNode(n).TrainingDataStatistics.SampleCount() == forest.GetTree(t).GetNode(n).TrainingDataStatistics.SampleCount(),
+            "a forest serialized without split statistics keeps its leaf statistics");
+
+    // A forest that has no split statistics to write must not claim to
+    // have written them, however it is serialized
+    Check(Serialized(*stripped) == Serialized(forest, true), "a forest deserialized without split statistics serializes without them");
+    std::auto_ptr<Forest<F,S> > copyStripped = Copy(forest);
+    copyStripped->StripSplitStatistics();
+    Check(Serialized(*copyStripped) == Serialized(forest, true), "a forest whose split statistics were stripped serializes without them");
+    Check(ApplyTrees(*Copy(*copyStripped), data) == expected, "a forest whose split statistics were stripped round trips");
+  }
+
+  void TestTreeFormat_1_0(const Tree<F,S>& tree, const DataPointCollection& data)
+  {
+    // Format 1.0 is format 1.1 without the flags that follow the node count
+    std::ostringstream o(std::ios_base::binary);
+    tree.Serialize(o);
+    std::string s = o.str();
+
+    const std::string header = "MicrosoftResearch.Cambridge.Sherwood.Tree";
+    const std::string::size_type minorVersionOffset = header.size() + sizeof(int);
+    const std::string::size_type flagsOffset = header.size() + 4 * sizeof(int);
+
+    Check(s.compare(0, header.size(), header) == 0, "Tree::Serialize() writes the tree header");
+    const int minorVersion = 0;
+    s.replace(minorVersionOffset, sizeof(int), (const char*)(&minorVersion), sizeof(int));
+    s.erase(flagsOffset, sizeof(int));
+
+    std::istringstream i(s, std::ios_base::binary);
+    std::auto_ptr<Tree<F,S> > converted = Tree<F,S>::Deserialize(i);
+
+    std::vector<int> expected, actual;
+    tree.Apply(data, expected);
+    converted->Apply(data, actual);
+    Check(actual == expected && converted->NodeCount() == tree.NodeCount(), "a tree in format 1.0 is deserialized");
+  }
+
+  void TestTreeFormat_0_0(const DataPointCollection& data)
+  {
+    // Format 0.0 stores nodes breadth first, the children of node i being
+    // nodes 2i+1 and 2i+2, with null nodes where the tree is incomplete.
+    // This one splits on x and then (on the left only) on y.
+    std::vector<Node<F,S> > full(7);
+    full[0].InitializeSplit(F(0), 0.5f, S(ClassCount), -1);
+    full[1].InitializeSplit(F(1), 0.25f, S(ClassCount), -1);
+    full[2].InitializeLeaf(S(ClassCount));
+    full[3].InitializeLeaf(S(ClassCount));
+    full[4].InitializeLeaf(S(ClassCount));
+
+    std::ostringstream o(std::ios_base::binary);
+    const std::string header = "MicrosoftResearch.Cambridge.Sherwood.Tree";
+    const int majorVersion = 0, minorVersion = 0, decisionLevels = 2;
+    o.write(header.c_str(), header.size());
+    o.write((const char*)(&majorVersion), sizeof(majorVersion));
+    o.write((const char*)(&minorVersion), sizeof(minorVersion));
+    o.write((const char*)(&decisionLevels), sizeof(decisionLevels));
+    for (unsigned int n = 0; n < full.size(); n++)
+      full[n].Serialize(o);
+
+    std::istringstream i(o.str(), std::ios_base::binary);
+    std::auto_ptr<Tree<F,S> > converted = Tree<F,S>::Deserialize(i);
+
+    // The same tree, with its nodes stored as if trained
+    Tree<F,S> tree(decisionLevels);
+    std::vector<Node<F,S> >& nodes = tree.GetNodes();
+    int left = Tree<F,S>::InitializeSplit(nodes, 0, F(0), 0.5f, S(ClassCount));
+    int leftLeft = Tree<F,S>::InitializeSplit(nodes, left, F(1), 0.25f, S(ClassCount));
+    nodes[left + 1].InitializeLeaf(S(ClassCount));
+    nodes[leftLeft].InitializeLeaf(S(ClassCount));
+    nodes[leftLeft + 1].InitializeLeaf(S(ClassCount));
+
+    std::vector<int> expected, actual;
+    tree.Apply(data, expected);
+    converted->Apply(data, actual);
+    Check(converted->NodeCount() == 5 && actual == expected, "a tree in format 0.0 is converted to compact form");
+  }
+
+  struct LoadCheckpoint
+  {
+    const std::string& path;
+    TrainingParameters parameters;
+    unsigned int dataCount;
+
+    LoadCheckpoint(const std::string& path, const TrainingParameters& parameters, unsigned int dataCount):
+      path(path), parameters(parameters), dataCount(dataCount)
+    {
+    }
+
+    void operator()() const
+    {
+      Random random;
+      std::auto_ptr<Forest<F,S> > forest;
+      ForestCheckpoint<F,S>::Load(path, parameters, dataCount, random, forest);
+    }
+  };
+
+  void TestCheckpoint(const std::string& directory, const DataPointCollection& data)
+  {
+    const std::string path = directory + "/test_checkpoint.bin";
+    ForestCheckpoint<F,S>::Remove(path);
+
+    TrainingParameters parameters = CreateParameters();
+    std::auto_ptr<Forest<F,S> > expected = TrainForest(1, parameters, data);
+
+    // Interrupt a training run after two trees...
+    Random random(1);
+    AxisAlignedFeatureResponseFactory featureFactory;
+    ClassificationTrainingContext<F> context(ClassCount, &featureFactory);
+    Forest<F,S> partial;
+    for (int t = 0; t < 2; t++)
+      partial.AddTree(TreeTrainer<F,S>::TrainTree(random, context, parameters, data, &silent));
+    ForestCheckpoint<F,S>::Save(path, parameters, data.Count(), random, partial);
+
+    // ...check that it can't be resumed with different parameters or data...
+    TrainingParameters different = parameters;
+    different.NumberOfCandidateFeatures++;
+    Check(Throws(LoadCheckpoint(path, different, data.Count())), "a checkpoint is rejected if the training parameters differ");
+    Check(Throws(LoadCheckpoint(path, parameters, data.Count() + 1)), "a checkpoint is rejected if the training data differ");
+    different = parameters;
+    different.NumberOfTrees = 1;
+    Check(Throws(LoadCheckpoint(path, different, data.Count())), "a checkpoint is rejected if it holds more trees than requested");
+
+    // ...and resume it (with a different seed, which the checkpoint overrides)
+    parameters.CheckpointPath = path;
+    std::auto_ptr<Forest<F,S> > resumed = TrainForest(2, parameters, data);
+    Check(Serialized(*resumed) == Serialized(*expected), "a resumed training run trains the same forest as an uninterrupted one");
+    Check(std::ifstream(path.c_str()).fail(), "the checkpoint is deleted once training is complete");
+  }
+
+  struct TruncateForest
+  {
+    Forest<F,S>& forest;
+    int treeCount;
+
+    TruncateForest(Forest<F,S>& forest, int treeCount): forest(forest), treeCount(treeCount)
+    {
+    }
+
+    void operator()() const
+    {
+      forest.Truncate(treeCount);
+    }
+  };
+
+  void TestOnlineTraining()
+  {
+    // Data labelled by x alone, so the x feature should win by a clear
+    // margin as soon as a leaf first attempts a split (though its own
+    // thresholds, which are many, are close in gain)
+    Random random(3);
+    std::ostringstream o;
+    for (int i = 0; i < 1000; i++)
+    {
+      float x = (float)(random.NextDouble()), y = (float)(random.NextDouble());
+      o << (x < 0.5f ? "c0" : "c1") << "\t" << std::setprecision(9) << x << "\t" << y << std::endl;
+    }
+    std::istringstream i(o.str());
+    std::auto_ptr<DataPointCollection> data = DataPointCollection::Load(i, 2, DataDescriptor::HasClassLabels);
+
+    TrainingParameters parameters = CreateParameters();
+    parameters.NumberOfTrees = 1;
+    parameters.NumberOfCandidateFeatures = 4;
+    parameters.NumberOfCandidateThresholdsPerFeature = 100;
+    OnlineTrainingParameters onlineParameters;
+    onlineParameters.Bagging = false;
+
+    AxisAlignedFeatureResponseFactory featureFactory;
+    ClassificationTrainingContext<F> context(ClassCount, &featureFactory);
+    OnlineForestTrainer<F,S> trainer(random, parameters, onlineParameters, context, &silent);
+
+    // The Hoeffding bound only falls below TieThreshold after some 3.2k data points
+    trainer.Update(*data);
+    Check(trainer.GetForest().GetTree(0).GetNode(0).IsSplit(), "OnlineForestTrainer splits once the best feature beats the others by the Hoeffding bound");
+  }
+
+  void TestTruncation(const Forest<F,S>& forest)
+  {
+    std::auto_ptr<Forest<F,S> > truncated = Copy(forest);
+    Check(Throws(TruncateForest(*truncated, -1)), "Forest::Truncate() rejects a negative tree count");
+    Check(Throws(TruncateForest(*truncated, forest.TreeCount() + 1)), "Forest::Truncate() rejects a tree count greater than TreeCount()");
+
+    truncated->Truncate(2);
+    Check(truncated->TreeCount() == 2 && truncated->GetTree(1).NodeCount() == forest.GetTree(1).NodeCount(), "Forest::Truncate() removes trees from the end");
+  }
+
+  void TestViews(const Forest<F,S>& forest, const DataPointCollection& data)
+  {
+    std::vector<unsigned int> indices;
+    for (unsigned int i = 0; i < data.Count(); i += 3)
+      indices.push_back(data.Count() - 1 - i);
+    indices.push_back(indices[0]);
+
+    std::auto_ptr<DataPointCollection> view = data.View(indices), copy = data.Subset(indices);
+    Check(view->IsView() && view->Count() == copy->Count() && view->GetMemoryUsage() < copy->GetMemoryUsage(), "a view holds only the indices of its data points");
+
+    bool same = true;
+    for (unsigned int i = 0; i < view->Count(); i++)
+      same = same && view->GetDataPoint(i) == data.GetDataPoint(indices[i]) && view->GetIntegerLabel(i) == copy->GetIntegerLabel(i);
+    Check(same, "a view refers to the data points of the underlying collection");
+
+    std::vector<std::vector<int> > leafNodeIndices;
+    forest.Apply(*view, leafNodeIndices, &silent);
+    Check(leafNodeIndices == ApplyTrees(forest, *copy), "Forest::Apply() to a view reaches the same leaves as to a copy");
+
+    // Training on a view should be indistinguishable from training on a copy
+    TrainingParameters parameters = CreateParameters();
+    parameters.NumberOfTrees = 2;
+    Check(Serialized(*TrainForest(5, parameters, *view)) == Serialized(*TrainForest(5, parameters, *copy)), "training on a view trains the same forest as training on a copy");
+
+    // A view of a view, a strided view and a copy of a view
+    std::auto_ptr<DataPointCollection> viewOfView = view->View(1, 2, view->Count() / 2);
+    same = viewOfView->IsView();
+    for (unsigned int i = 0; i < viewOfView->Count(); i++)
+      same = same && viewOfView->GetDataPoint(i) == data.GetDataPoint(indices[1 + 2 * i]);
+    Check(same, "a view of a view refers to the data points of the underlying collection");
+
+    std::auto_ptr<IDataPointCollection> clone = view->Clone();
+    const DataPointCollection& cloned = dynamic_cast<const DataPointCollection&>(*clone);
+    Check(cloned.IsView() == false && cloned.Count() == view->Count() && ApplyTrees(forest, cloned) == leafNodeIndices, "a copy of a view copies its data points");
+  }
+
+  void TestPackedTrees(Forest<F,S>& forest, const DataPointCollection& data)
+  {
+    // NB Non-const Forest::GetTree() would release the packed trees
+    const Forest<F,S>& constForest = forest;
+    std::vector<std::vector<int> > expected = ApplyTrees(forest, data);
+
+    const PackedLayout::e layouts[] = { PackedLayout::NodeOrder, PackedLayout::DepthFirst, PackedLayout::BreadthFirst, PackedLayout::VanEmdeBoas };
+    const ApplyMode::e modes[] = { ApplyMode::Auto, ApplyMode::PerSample, ApplyMode::Partition };
+
+    for (int l = 0; l < 4; l++)
+    {
+      forest.SetPackedLayout(layouts[l]);
+
+      for (int m = 0; m < 3; m++)
+      {
+        forest.SetApplyMode(modes[m]);
+        std::vector<std::vector<int> > leafNodeIndices;
+        forest.Apply(data, leafNodeIndices, &silent);
+        Check(leafNodeIndices == expected, "Forest::Apply() reaches the same leaves as Tree::Apply()");
+      }
+
+      std::vector<int> leafNodeIndices(forest.TreeCount());
+      bool same = true;
+      for (unsigned int i = 0; i < data.Count(); i++)
+      {
+        forest.ApplyOne(data, i, &leafNodeIndices[0]);
+        for (int t = 0; t < forest.TreeCount(); t++)
+          same = same && leafNodeIndices[t] == expected[t][i] && constForest.GetTree(t).ApplyOne(data, i) == expected[t][i];
+      }
+      Check(same, "Forest::ApplyOne() and Tree::ApplyOne() reach the same leaves as Tree::Apply()");
+
+      LeafPosteriors<F,S> posteriors(constForest, ClassCount, ClassPosterior());
+      std::vector<float> predictions;
+      posteriors.Predict(data, predictions);
+
+      std::vector<float> predictionsOne(predictions.size()), expectedPredictions(predictions.size(), 0.0f);
+      for (unsigned int i = 0; i < data.Count(); i++)
+      {
+        posteriors.PredictOne(data, i, &predictionsOne[i * ClassCount]);
+
+        for (int t = 0; t < forest.TreeCount(); t++)
+        {
+          float p[ClassCount];
+          ClassPosterior()(constForest.GetTree(t).GetNode(expected[t][i]).TrainingDataStatistics, p);
+          for (int c = 0; c < ClassCount; c++)
+            expectedPredictions[i * ClassCount + c] += p[c] / forest.TreeCount();
+        }
+      }
+      Check(predictionsOne == predictions, "LeafPosteriors::PredictOne() agrees with LeafPosteriors::Predict()");
+      Check(Near(predictions, expectedPredictions), "LeafPosteriors::Predict() averages the posteriors of the leaves reached");
+    }
+
+    forest.SetPackedLayout(PackedLayout::NodeOrder);
+    forest.SetApplyMode(ApplyMode::Auto);
+  }
+
+  void TestQuickScorer(const Forest<F,S>& forest, const DataPointCollection& data)
+  {
+    QuickScorer<F,S> scorer(forest);
+
+    std::vector<std::vector<int> > leafNodeIndices;
+    scorer.Apply(data, leafNodeIndices);
+    Check(leafNodeIndices == ApplyTrees(forest, data), "QuickScorer::Apply() reaches the same leaves as Tree::Apply()");
+
+    LeafPosteriors<F,S> posteriors(forest, ClassCount, ClassPosterior());
+    std::vector<float> expected, predictions;
+    posteriors.Predict(data, expected);
+    scorer.Predict(posteriors, data, predictions);
+    Check(Near(predictions, expected), "QuickScorer::Predict() agrees with LeafPosteriors::Predict()");
+  }
+
+  void WriteCodeGeneratorTest(const std::string& path, const Forest<F,S>& forest, const DataPointCollection& data, CodeLayout::e layout)
+  {
+    LeafPosteriors<F,S> posteriors(forest, ClassCount, ClassPosterior());
+    std::vector<float> expected;
+    posteriors.Predict(data, expected);
+
+    std::ofstream o(path.c_str());
+    ForestCodeGenerator<F,S>::Generate(o, posteriors, "forest", layout);
+
+    // Append a main() that compares the generated forest's predictions with
+    // those of LeafPosteriors, which should be identical
+    o << std::endl;
+    o << "#include <stdio.h>" << std::endl;
+    o << std::endl;
+    o << "const float points[" << data.Count() << "][2] =" << std::endl;
+    o << "{" << std::endl;
+    for (unsigned int i = 0; i < data.Count(); i++)
+      o << "  { " << std::setprecision(9) << std::showpoint << data.GetDataPoint(i)[0] << "f, " << data.GetDataPoint(i)[1] << "f }," << std::endl;
+    o << "};" << std::endl;
+    o << std::endl;
+    o << "const float expected[" << data.Count() << "][" << ClassCount << "] =" << std::endl;
+    o << "{" << std::endl;
+    for (unsigned int i = 0; i < data.Count(); i++)
+    {
+      o << "  { ";
+      for (int c = 0; c < ClassCount; c++)
+        o << (c > 0 ? ", " : "") << std::setprecision(9) << std::showpoint << expected[i * ClassCount + c] << "f";
+      o << " }," << std::endl;
+    }
+    o << "};" << std::endl;
+    o << std::endl;
+    o << "int main()" << std::endl;
+    o << "{" << std::endl;
+    o << "  for (int i = 0; i < " << data.Count() << "; i++)" << std::endl;
+    o << "  {" << std::endl;
+    o << "    float posterior[" << ClassCount << "];" << std::endl;
+    o << "    forest_predict(points[i], posterior);" << std::endl;
+    o << "    for (int c = 0; c < " << ClassCount << "; c++)" << std::endl;
+    o << "      if (posterior[c] != expected[i][c])" << std::endl;
+    o << "      {" << std::endl;
+    o << "        printf(\"FAILED: generated code disagrees with LeafPosteriors::Predict() for data point %d\\n\", i);" << std::endl;
+    o << "        return 1;" << std::endl;
+    o << "      }" << std::endl;
+    o << "  }" << std::endl;
+    o << "  return 0;" << std::endl;
+    o << "}" << std::endl;
+
+    Check(o.good(), "generated code is written to " + path);
+  }
+
+  void TestPruning(const Forest<F,S>& forest, const DataPointCollection& data)
+  {
+    AxisAlignedFeatureResponseFactory featureFactory;
+    ClassificationTrainingContext<F> context(ClassCount, &featureFactory);
+
+    std::auto_ptr<Forest<F,S> > pruned = Copy(forest);
+    int removed = ForestPruner<F,S>::PruneForest(*pruned, context, 0.0, 0, &silent);
+
+    // Every leaf of a pruned tree should hold the statistics of the
+    // training data that reach it
+    std::vector<std::vector<int> > leafNodeIndices = ApplyTrees(*pruned, data);
+    bool consistent = true;
+    int nodeCount = 0;
+    for (int t = 0; t < pruned->TreeCount(); t++)
+    {
+      const Tree<F,S>& tree = pruned->GetTree(t);
+      std::vector<unsigned int> counts(tree.NodeCount(), 0);
+      for (unsigned int i = 0; i < data.Count(); i++)
+        counts[leafNodeIndices[t][i]]++;
+      for (int n = 0; n < tree.NodeCount(); n++)
+        if (tree.GetNode(n).IsLeaf())
+          consistent = consistent && counts[n] == tree.GetNode(n).TrainingDataStatistics.SampleCount();
+      nodeCount += tree.NodeCount();
+    }
+    int originalNodeCount = 0;
+    for (int t = 0; t < forest.TreeCount(); t++)
+      originalNodeCount += forest.GetTree(t).NodeCount();
+    Check(nodeCount + removed == originalNodeCount, "ForestPruner::PruneForest() counts the nodes it removes");
+    Check(consistent, "the leaves of a pruned tree hold the statistics of the data that reach them");
+
+    pruned = Copy(forest);
+    ForestPruner<F,S>::PruneForest(*pruned, context, 1e9, 0, &silent);
+    bool stumps = true;
+    for (int t = 0; t < pruned->TreeCount(); t++)
+      stumps = stumps && pruned->GetTree(t).NodeCount() == 1;
+    Check(stumps, "ForestPruner::PruneForest() prunes every tree to its root given a large enough penalty");
+  }
+
+  void TestRefitting(const Forest<F,S>& forest, const DataPointCollection& data)
+  {
+    // The forest was trained on the same data, so refitting should not change it
+    // (after Apply(), so that the trees being refitted have packed copies)
+    std::auto_ptr<Forest<F,S> > refitted = Copy(forest);
+    std::vector<std::vector<int> > leafNodeIndices;
+    refitted->Apply(data, leafNodeIndices, &silent);
+    ForestRefitter<F,S>::RefitForest(*refitted, data, RefitMode::Replace, true, &silent);
+    Check(Serialized(*refitted) == Serialized(forest), "refitting a forest to its training data leaves it unchanged");
+
+    ForestRefitter<F,S>::RefitForest(*refitted, data, RefitMode::Accumulate, true, &silent);
+    bool doubled = true;
+    for (int t = 0; t < refitted->TreeCount(); t++)
+      doubled = doubled && refitted->GetTree(t).GetNode(0).TrainingDataStatistics.SampleCount() == 2 * data.Count();
+    Check(doubled, "RefitMode::Accumulate adds new data to the previous statistics");
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2)
+  {
+    std::cout << "Usage: sw_test <directory for temporary files>" << std::endl;
+    return 1;
+  }
+  std::string directory = argv[1];
+
+  try
+  {
+    Random random(1);
+    std::auto_ptr<DataPointCollection> trainingData = CreateData(random, 1000);
+    std::auto_ptr<DataPointCollection> testData = CreateData(random, 2000, false);
+
+    std::auto_ptr<Forest<F,S> > forest = TrainForest(1, CreateParameters(), *trainingData);
+
+    // A forest whose split records exceed PackedTree::InterleaveMinTreeBytes
+    Forest<F,S> largeForest;
+    largeForest.AddTree(CreateCompleteTree(random, 13));
+    largeForest.AddTree(CreateCompleteTree(random, 12));
+
+    TestRandomSerialization();
+    TestForestSerialization(*forest, *testData);
+    TestTreeFormat_1_0(forest->GetTree(0), *testData);
+    TestTreeFormat_0_0(*testData);
+    TestCheckpoint(directory, *trainingData);
+    TestTruncation(*forest);
+    TestOnlineTraining();
+    TestPackedTrees(*forest, *testData);
+    TestPackedTrees(largeForest, *testData);
+    TestQuickScorer(*forest, *testData);
+    TestViews(*forest, *trainingData);
+    WriteCodeGeneratorTest(directory + "/test_nested.cpp", *forest, *testData, CodeLayout::Nested);
+    WriteCodeGeneratorTest(directory + "/test_flattened.cpp", *forest, *testData, CodeLayout::Flattened);
+    TestPruning(*forest, *trainingData);
+    TestRefitting(*forest, *trainingData);
+  }
+  catch (const std::exception& e)
+  {
+    std::cout << "FAILED: " << e.what() << std::endl;
+    return 1;
+  }
+
+  std::cout << failureCount << " of " << checkCount << " checks failed." << std::endl;
+
+  return failureCount == 0 ? 0 : 1;
+}